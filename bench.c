@@ -0,0 +1,281 @@
+/*
+ * bench.c
+ *
+ * The bench command
+ *
+ * Each run is timed on the monotonic clock, and its CPU time, page
+ * faults and context switches are the change in RUSAGE_CHILDREN across
+ * it. Outliers are flagged with Tukey's fences, 1.5 interquartile
+ * ranges outside the quartiles, which unlike a standard deviation rule
+ * are not themselves dragged by the outliers.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+#include "tokenize.h"
+#include "parse.h"
+#include "stats.h"
+#include "cmdlog.h"
+
+#define BN_LINE_MAX     512
+
+// The measures taken of each run
+enum {
+    BN_WALL,
+    BN_USER,
+    BN_SYS,
+    BN_FAULTS,
+    BN_CSW,
+    BN_NMEASURES
+};
+
+static const struct {
+    const char* name;
+    bool time;          // printed as a duration, in seconds
+} measures[BN_NMEASURES] = {
+    [BN_WALL] =     {"wall", true},
+    [BN_USER] =     {"user", true},
+    [BN_SYS] =      {"sys", true},
+    [BN_FAULTS] =   {"faults", false},
+    [BN_CSW] =      {"csw", false},
+};
+
+
+
+// Documented in .h file
+bool BN_is_bench(CList tokens)
+{
+    Token tok = TOK_next(tokens);
+    return TOK_next_type(tokens) == TOK_WORD && !strcmp(tok.value, "bench");
+}
+
+
+/*
+ * Parse the value of a -n or -w option
+ *
+ * Returns:
+ *  bool        true if it is an integer in [min, BN_MAX_RUNS]
+ */
+static bool parse_count(CList tokens, int min, int* value)
+{
+    if (TOK_next_type(tokens) != TOK_WORD) return false;
+
+    char* end;
+    errno = 0;
+    long n = strtol(TOK_next(tokens).value, &end, 10);
+    bool ok = !errno && !*end && n >= min && n <= BN_MAX_RUNS;
+    TOK_consume(tokens);
+    if (!ok) return false;
+    *value = n;
+    return true;
+}
+
+
+/*
+ * The value at a fraction of the way through sorted samples,
+ * interpolating between neighbours
+ */
+static double quantile(const double* sorted, int n, double q)
+{
+    double pos = q * (n - 1);
+    int lo = (int) pos;
+    if (lo >= n - 1) return sorted[n - 1];
+    return sorted[lo] + (pos - lo) * (sorted[lo + 1] - sorted[lo]);
+}
+
+
+static int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+
+// Documented in .h file
+void BN_summarize(double* samples, int n, BenchSummary* s)
+{
+    qsort(samples, n, sizeof(double), compare_double);
+
+    double sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += samples[i];
+
+    *s = (BenchSummary) {.n = n, .mean = sum / n,
+        .min = samples[0], .max = samples[n - 1]};
+
+    double sq = 0;
+    for (int i = 0; i < n; i++)
+        sq += (samples[i] - s->mean) * (samples[i] - s->mean);
+    s->stddev = n > 1? sqrt(sq / (n - 1)): 0;
+
+    s->p50 = quantile(samples, n, 0.50);
+    s->p90 = quantile(samples, n, 0.90);
+    s->p99 = quantile(samples, n, 0.99);
+    s->q1 = quantile(samples, n, 0.25);
+    s->q3 = quantile(samples, n, 0.75);
+
+    double iqr = s->q3 - s->q1;
+    for (int i = 0; i < n; i++) {
+        if (samples[i] < s->q1 - 1.5 * iqr) s->low_outliers++;
+        if (samples[i] > s->q3 + 1.5 * iqr) s->high_outliers++;
+    }
+}
+
+
+/*
+ * Print a value of a measure, durations in the most readable unit
+ */
+static void print_value(FILE* out, bool time, double v)
+{
+    if (!time) fprintf(out, " %9.1f ", v);
+    else if (v < 1e-3) fprintf(out, " %8.1fus", v * 1e6);
+    else if (v < 1) fprintf(out, " %8.3fms", v * 1e3);
+    else fprintf(out, " %8.3fs ", v);
+}
+
+
+static double tv_seconds(struct timeval tv)
+{   return tv.tv_sec + tv.tv_usec / 1e6; }
+
+
+/*
+ * Run the pipeline once, recording its measures, and a command log
+ * record under line unless it is NULL
+ *
+ * Returns:
+ *  int         The exit status of the pipeline
+ */
+static int run_once(AST pipeline, const char* line,
+    double sample[BN_NMEASURES])
+{
+    struct rusage before, after;
+    getrusage(RUSAGE_CHILDREN, &before);
+    uint64_t start = ST_now();
+
+    if (line) LOG_begin_line(line);
+    int status = AST_execute(pipeline);
+    if (line) LOG_end(status);
+
+    sample[BN_WALL] = (ST_now() - start) / 1e9;
+    getrusage(RUSAGE_CHILDREN, &after);
+    sample[BN_USER] = tv_seconds(after.ru_utime) - tv_seconds(before.ru_utime);
+    sample[BN_SYS] = tv_seconds(after.ru_stime) - tv_seconds(before.ru_stime);
+    sample[BN_FAULTS] = (after.ru_minflt + after.ru_majflt) -
+        (before.ru_minflt + before.ru_majflt);
+    sample[BN_CSW] = (after.ru_nvcsw + after.ru_nivcsw) -
+        (before.ru_nvcsw + before.ru_nivcsw);
+    return status;
+}
+
+
+// Documented in .h file
+int BN_bench(CList tokens, FILE* out, char* errmsg, size_t errmsg_sz)
+{
+    int runs = BN_DEFAULT_RUNS, warmup = BN_DEFAULT_WARMUP;
+
+    TOK_consume(tokens);    // bench
+    while (TOK_next_type(tokens) == TOK_WORD) {
+        const char* opt = TOK_next(tokens).value;
+        bool ok = true;
+        if (!strcmp(opt, "--")) {
+            TOK_consume(tokens);
+            break;
+        }
+        else if (!strcmp(opt, "-n")) {
+            TOK_consume(tokens);
+            ok = parse_count(tokens, 1, &runs);
+        }
+        else if (!strcmp(opt, "-w")) {
+            TOK_consume(tokens);
+            ok = parse_count(tokens, 0, &warmup);
+        }
+        else if (*opt == '-') ok = false;
+        else break;
+
+        if (!ok) {
+            snprintf(errmsg, errmsg_sz,
+                "usage: bench [-n RUNS] [-w WARMUP] [--] pipeline");
+            return -1;
+        }
+    }
+
+    AST pipeline = Parse(tokens, errmsg, errmsg_sz);
+    if (!pipeline) return -1;
+
+    // each run is a record of its own, as a record holds one run's stages
+    char line[BN_LINE_MAX];
+    if (LOG_enabled()) {
+        int len = snprintf(line, sizeof(line), "bench -n %d -w %d ",
+            runs, warmup);
+        AST_pipeline2str(pipeline, line + len, sizeof(line) - len);
+    }
+
+    // the pipeline's output would bury the report
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (saved_stdout != -1 && devnull != -1) dup2(devnull, STDOUT_FILENO);
+
+    double (*samples)[BN_NMEASURES] = calloc(runs, sizeof(*samples));
+    assert(samples);
+    double ignored[BN_NMEASURES];
+    int failed = 0;
+    for (int i = 0; i < warmup; i++)
+        run_once(pipeline, LOG_enabled()? line: NULL, ignored);
+    for (int i = 0; i < runs; i++)
+        failed += run_once(pipeline, LOG_enabled()? line: NULL,
+            samples[i]) != 0;
+
+    fflush(stdout);
+    if (saved_stdout != -1 && devnull != -1) dup2(saved_stdout, STDOUT_FILENO);
+    if (saved_stdout != -1) close(saved_stdout);
+    if (devnull != -1) close(devnull);
+    AST_free(pipeline);
+
+    fprintf(out, "%d runs after %d warmup", runs, warmup);
+    if (failed) fprintf(out, ", %d failed", failed);
+    fprintf(out, "\n%-8s %10s %10s %10s %10s %10s %10s %10s\n",
+        "", "mean", "stddev", "min", "p50", "p90", "p99", "max");
+
+    BenchSummary wall = {0};
+    double* column = malloc(runs * sizeof(double));
+    assert(column);
+    for (int m = 0; m < BN_NMEASURES; m++) {
+        for (int i = 0; i < runs; i++)
+            column[i] = samples[i][m];
+        BenchSummary s;
+        BN_summarize(column, runs, &s);
+        if (m == BN_WALL) wall = s;
+
+        fprintf(out, "%-8s", measures[m].name);
+        double values[] = {s.mean, s.stddev, s.min, s.p50, s.p90, s.p99, s.max};
+        for (int i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+            print_value(out, measures[m].time, values[i]);
+        fprintf(out, "\n");
+    }
+
+    int outliers = wall.low_outliers + wall.high_outliers;
+    if (outliers) {
+        fprintf(out, "%d wall time outliers (%d low, %d high) beyond 1.5 IQR",
+            outliers, wall.low_outliers, wall.high_outliers);
+        if (outliers * 10 > runs) fprintf(out, "; the system may be noisy");
+        fprintf(out, "\n");
+    }
+
+    free(column);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * bench.h
+ *
+ * The bench command: run a pipeline many times from within the shell
+ * and report the distribution of its wall time and resource usage
+ *
+ *   bench [-n RUNS] [-w WARMUP] [--] pipeline
+ *
+ * Like time in other shells, bench is recognized before parsing, since
+ * it takes a whole pipeline rather than the words of one stage.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "clist.h"
+
+#define BN_DEFAULT_RUNS     10
+#define BN_DEFAULT_WARMUP   1
+#define BN_MAX_RUNS         1000000
+
+typedef struct {
+    int n;
+    double mean;
+    double stddev;          // sample standard deviation
+    double min;
+    double max;
+    double p50;
+    double p90;
+    double p99;
+    double q1;              // quartiles, for the outlier fences
+    double q3;
+    int low_outliers;       // samples more than 1.5 IQR below q1
+    int high_outliers;      // samples more than 1.5 IQR above q3
+} BenchSummary;
+
+
+/*
+ * Whether a tokenized line is a bench command
+ *
+ * Parameters:
+ *  tokens      The tokens of the line
+ *
+ * Returns:
+ *  bool        true if its first token is the unquoted word "bench"
+ */
+bool BN_is_bench(CList tokens);
+
+
+/*
+ * Run a bench command. The pipeline is parsed once and executed through
+ * AST_execute, first the warmup runs and then the timed ones, with its
+ * standard output discarded. Each run is a record of its own in the
+ * command log.
+ *
+ * Parameters:
+ *  tokens      The tokens of the line, consumed
+ *  out         Where to print the report
+ *  errmsg      Return space for an error message
+ *  errmsg_sz   The size of errmsg
+ *
+ * Returns:
+ *  int         0 once the report is printed; -1 on a usage or parse
+ *              error, described in errmsg
+ */
+int BN_bench(CList tokens, FILE* out, char* errmsg, size_t errmsg_sz);
+
+
+/*
+ * Summarize a set of samples
+ *
+ * Parameters:
+ *  samples     The samples, sorted in place
+ *  n           How many there are, at least 1
+ *  summary     Return space for the summary
+ */
+void BN_summarize(double* samples, int n, BenchSummary* summary);
+
+#endif /* _BENCH_H_ */
@@ -0,0 +1,446 @@
+/*
+ * brace.c
+ *
+ * Lazy brace and range expansion of WORD tokens
+ *
+ * A word is parsed once into a sequence of parts: literal text,
+ * alternations (each alternative itself a sequence) and ranges. Words
+ * are then generated like an odometer, advancing the rightmost part and
+ * carrying into the parts to its left, so an expansion of any size is
+ * produced in constant memory.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "brace.h"
+
+
+typedef enum {
+    PART_LITERAL,
+    PART_ALT,
+    PART_RANGE
+} PartKind;
+
+struct _br_seq;
+
+struct _br_part {
+    PartKind kind;
+    const char* text;       // PART_LITERAL: slice of the word
+    size_t len;
+    struct _br_seq* alts;   // PART_ALT
+    int nalts;
+    long start;             // PART_RANGE
+    long end;
+    long step;              // signed, towards end
+    int width;              // zero padding, 0 for none
+    bool chars;             // character rather than integer range
+    long cur;               // current alternative or range value
+};
+
+struct _br_seq {
+    struct _br_part* parts;
+    int nparts;
+    int cap;
+};
+
+struct _brace {
+    char* word;             // literal parts point into this copy
+    struct _br_seq seq;
+    char* buf;              // the word last generated
+    size_t buf_sz;
+    bool started;
+    bool done;
+};
+
+
+
+static void seq_add(struct _br_seq* seq, struct _br_part part)
+{
+    if (seq->nparts == seq->cap) {
+        seq->cap = seq->cap? 2 * seq->cap: 4;
+        seq->parts = realloc(seq->parts, seq->cap * sizeof(struct _br_part));
+        assert(seq->parts);
+    }
+    seq->parts[seq->nparts++] = part;
+}
+
+
+static void seq_add_literal(struct _br_seq* seq, const char* text, size_t len)
+{
+    if (!len) return;
+    seq_add(seq, (struct _br_part) {.kind = PART_LITERAL,
+        .text = text, .len = len});
+}
+
+
+/*
+ * Find the '}' matching the '{' just before s, skipping escaped
+ * characters and nested braces
+ *
+ * Returns:
+ *  const char* The matching '}', or NULL if there is none before end
+ */
+static const char* find_close(const char* s, const char* end)
+{
+    int depth = 0;
+    for (; s < end; s++) {
+        if (*s == '\\') s++;
+        else if (*s == '{') depth++;
+        else if (*s == '}' && depth-- == 0) return s;
+    }
+    return NULL;
+}
+
+
+/*
+ * Parse a complete decimal integer
+ *
+ * Returns:
+ *  bool        true if [s, s+len) holds exactly one integer
+ */
+static bool parse_long(const char* s, size_t len, long* value)
+{
+    char buf[len + 1];
+    memcpy(buf, s, len);
+    buf[len] = 0;
+
+    char* end;
+    errno = 0;
+    *value = strtol(buf, &end, 10);
+    return len && !errno && !*end && !isspace((unsigned char) *buf);
+}
+
+
+/*
+ * Whether an integer endpoint is written with a leading zero, which
+ * requests zero padding
+ */
+static bool is_padded(const char* s, size_t len)
+{
+    if (len && *s == '-') {
+        s++;
+        len--;
+    }
+    return len > 1 && *s == '0';
+}
+
+
+/*
+ * Parse the inside of a brace as x..y or x..y..step
+ *
+ * Parameters:
+ *  part        Return space for the range
+ *  s, len      The text between the braces
+ *
+ * Returns:
+ *  bool        true if the text is a valid range
+ */
+static bool parse_range(struct _br_part* part, const char* s, size_t len)
+{
+    char text[len + 1];
+    memcpy(text, s, len);
+    text[len] = 0;
+    s = text;
+
+    const char* end = s + len;
+    const char* dots = strstr(s, "..");
+    if (!dots) return false;
+    const char* y = dots + 2;
+    const char* dots2 = strstr(y, "..");
+    const char* yend = dots2? dots2: end;
+
+    *part = (struct _br_part) {.kind = PART_RANGE, .step = 1};
+    if (dots2 && !parse_long(dots2 + 2, end - dots2 - 2, &part->step))
+        return false;
+
+    size_t xlen = dots - s, ylen = yend - y;
+    if (xlen == 1 && ylen == 1 && isalpha((unsigned char) *s) &&
+            isalpha((unsigned char) *y)) {
+        part->chars = true;
+        part->start = *s;
+        part->end = *y;
+    }
+    else if (parse_long(s, xlen, &part->start) && parse_long(y, ylen, &part->end)) {
+        if (is_padded(s, xlen) || is_padded(y, ylen))
+            part->width = xlen > ylen? xlen: ylen;
+    }
+    else return false;
+
+    if (part->step < 0) part->step = -part->step;
+    if (part->step == 0) part->step = 1;
+    if (part->start > part->end) part->step = -part->step;
+    part->cur = part->start;
+    return true;
+}
+
+
+static void parse_seq(struct _br_seq* seq, const char* s, const char* end);
+
+/*
+ * Parse the inside of a brace as a comma separated alternation
+ *
+ * Parameters:
+ *  part        Return space for the alternation
+ *  s, end      The text between the braces
+ *
+ * Returns:
+ *  bool        true if the text has at least one top level comma
+ */
+static bool parse_alt(struct _br_part* part, const char* s, const char* end)
+{
+    int ncommas = 0, depth = 0;
+    for (const char* p = s; p < end; p++) {
+        if (*p == '\\') p++;
+        else if (*p == '{') depth++;
+        else if (*p == '}') depth--;
+        else if (*p == ',' && depth == 0) ncommas++;
+    }
+    if (!ncommas) return false;
+
+    *part = (struct _br_part) {.kind = PART_ALT, .nalts = ncommas + 1};
+    part->alts = calloc(part->nalts, sizeof(struct _br_seq));
+    assert(part->alts);
+
+    int i = 0;
+    const char* start = s;
+    depth = 0;
+    for (const char* p = s; p <= end; p++) {
+        if (p < end && *p == '\\') p++;
+        else if (p < end && *p == '{') depth++;
+        else if (p < end && *p == '}') depth--;
+        else if (p == end || (*p == ',' && depth == 0)) {
+            parse_seq(&part->alts[i++], start, p);
+            start = p + 1;
+        }
+    }
+    return true;
+}
+
+
+/*
+ * Parse [s, end) into a sequence of parts. A '{' that does not start a
+ * valid alternation or range is kept as literal text, and parsing
+ * continues inside it.
+ */
+static void parse_seq(struct _br_seq* seq, const char* s, const char* end)
+{
+    const char* lit = s;
+    while (s < end) {
+        if (*s == '\\' && s + 1 < end) {
+            s += 2;
+            continue;
+        }
+
+        const char* close = *s == '{'? find_close(s + 1, end): NULL;
+        struct _br_part part;
+        if (close && (parse_alt(&part, s + 1, close) ||
+                      parse_range(&part, s + 1, close - s - 1))) {
+            seq_add_literal(seq, lit, s - lit);
+            seq_add(seq, part);
+            s = lit = close + 1;
+        }
+        else s++;
+    }
+    seq_add_literal(seq, lit, end - lit);
+}
+
+
+static void seq_free(struct _br_seq* seq)
+{
+    for (int i = 0; i < seq->nparts; i++) {
+        struct _br_part* part = &seq->parts[i];
+        if (part->kind != PART_ALT) continue;
+        for (int j = 0; j < part->nalts; j++)
+            seq_free(&part->alts[j]);
+        free(part->alts);
+    }
+    free(seq->parts);
+}
+
+
+static void seq_reset(struct _br_seq* seq)
+{
+    for (int i = 0; i < seq->nparts; i++) {
+        struct _br_part* part = &seq->parts[i];
+        if (part->kind == PART_ALT) {
+            part->cur = 0;
+            seq_reset(&part->alts[0]);
+        }
+        else if (part->kind == PART_RANGE) part->cur = part->start;
+    }
+}
+
+
+static bool seq_advance(struct _br_seq* seq);
+
+static bool part_advance(struct _br_part* part)
+{
+    switch (part->kind) {
+        case PART_LITERAL:
+            return false;
+        case PART_ALT:
+            if (seq_advance(&part->alts[part->cur])) return true;
+            if (++part->cur == part->nalts) return false;
+            seq_reset(&part->alts[part->cur]);
+            return true;
+        case PART_RANGE:
+            if (part->step > 0 && part->cur > part->end - part->step)
+                return false;
+            if (part->step < 0 && part->cur < part->end - part->step)
+                return false;
+            part->cur += part->step;
+            return true;
+    }
+    __builtin_unreachable();
+}
+
+
+/*
+ * Step a sequence to its next combination, rightmost part first
+ *
+ * Returns:
+ *  bool        false once every combination has been generated, in which
+ *              case the sequence is left reset
+ */
+static bool seq_advance(struct _br_seq* seq)
+{
+    for (int i = seq->nparts - 1; i >= 0; i--) {
+        if (part_advance(&seq->parts[i])) return true;
+        if (seq->parts[i].kind == PART_ALT) {
+            seq->parts[i].cur = 0;
+            seq_reset(&seq->parts[i].alts[0]);
+        }
+        else seq->parts[i].cur = seq->parts[i].start;
+    }
+    return false;
+}
+
+
+static size_t mul_sat(size_t a, size_t b)
+{   return a && b > SIZE_MAX / a? SIZE_MAX: a * b; }
+
+static size_t add_sat(size_t a, size_t b)
+{   return a > SIZE_MAX - b? SIZE_MAX: a + b; }
+
+static size_t seq_count(struct _br_seq* seq)
+{
+    size_t count = 1;
+    for (int i = 0; i < seq->nparts; i++) {
+        struct _br_part* part = &seq->parts[i];
+        size_t n = 1;
+        if (part->kind == PART_ALT) {
+            n = 0;
+            for (int j = 0; j < part->nalts; j++)
+                n = add_sat(n, seq_count(&part->alts[j]));
+        }
+        else if (part->kind == PART_RANGE) {
+            unsigned long span = part->step > 0?
+                (unsigned long) part->end - part->start:
+                (unsigned long) part->start - part->end;
+            n = span / labs(part->step) + 1;
+        }
+        count = mul_sat(count, n);
+    }
+    return count;
+}
+
+
+static void buf_append(Brace br, size_t* pos, const char* s, size_t len)
+{
+    if (*pos + len + 1 > br->buf_sz) {
+        while (*pos + len + 1 > br->buf_sz)
+            br->buf_sz = br->buf_sz? 2 * br->buf_sz: 64;
+        br->buf = realloc(br->buf, br->buf_sz);
+        assert(br->buf);
+    }
+    memcpy(br->buf + *pos, s, len);
+    *pos += len;
+    br->buf[*pos] = 0;
+}
+
+
+static void seq_render(Brace br, struct _br_seq* seq, size_t* pos)
+{
+    for (int i = 0; i < seq->nparts; i++) {
+        struct _br_part* part = &seq->parts[i];
+        if (part->kind == PART_LITERAL)
+            buf_append(br, pos, part->text, part->len);
+        else if (part->kind == PART_ALT)
+            seq_render(br, &part->alts[part->cur], pos);
+        else {
+            char num[32];
+            int len = part->chars?
+                snprintf(num, sizeof(num), "%c", (char) part->cur):
+                snprintf(num, sizeof(num), "%0*ld", part->width, part->cur);
+            buf_append(br, pos, num, len);
+        }
+    }
+}
+
+
+// Documented in .h file
+Brace BR_new(const char* word)
+{
+    Brace br = calloc(1, sizeof(struct _brace));
+    assert(br);
+    br->word = strdup(word);
+    parse_seq(&br->seq, br->word, br->word + strlen(br->word));
+
+    for (int i = 0; i < br->seq.nparts; i++)
+        if (br->seq.parts[i].kind != PART_LITERAL) return br;
+
+    BR_free(br);
+    return NULL;
+}
+
+
+// Documented in .h file
+const char* BR_next(Brace br)
+{
+    if (br->done) return NULL;
+    if (br->started && !seq_advance(&br->seq)) {
+        br->done = true;
+        return NULL;
+    }
+    br->started = true;
+
+    size_t pos = 0;
+    buf_append(br, &pos, "", 0);
+    seq_render(br, &br->seq, &pos);
+    return br->buf;
+}
+
+
+// Documented in .h file
+void BR_reset(Brace br)
+{
+    seq_reset(&br->seq);
+    br->started = false;
+    br->done = false;
+}
+
+
+// Documented in .h file
+size_t BR_count(Brace br)
+{   return seq_count(&br->seq); }
+
+
+// Documented in .h file
+void BR_free(Brace br)
+{
+    if (!br) return;
+    seq_free(&br->seq);
+    free(br->word);
+    free(br->buf);
+    free(br);
+}
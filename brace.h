@@ -0,0 +1,83 @@
+/*
+ * brace.h
+ *
+ * Lazy brace and range expansion of WORD tokens, e.g. a{b,c}d and
+ * {1..1000000}
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _BRACE_H_
+#define _BRACE_H_
+
+#include <stddef.h>
+
+typedef struct _brace* Brace;
+
+
+/*
+ * Create an iterator over the brace expansion of a word. Supported forms
+ * are alternations {a,b,c}, integer ranges {x..y} and {x..y..step}, with
+ * zero padding when either end has a leading zero, and character ranges
+ * {a..e}. Braces nest, and several brace expressions in one word expand
+ * to their cartesian product, leftmost varying slowest. A brace that is
+ * not one of these forms is kept literally, as are braces preceded by a
+ * backslash.
+ *
+ * Only the parsed form of the word is stored; words are generated one
+ * at a time by BR_next.
+ *
+ * Parameters:
+ *  word        The value of a WORD token
+ *
+ * Returns:
+ *  Brace       The new iterator, or NULL if the word has nothing to
+ *              expand. Release it with BR_free.
+ */
+Brace BR_new(const char* word);
+
+
+/*
+ * Generate the next word of the expansion
+ *
+ * Parameters:
+ *  br          The iterator
+ *
+ * Returns:
+ *  const char* The next word, valid until the following call on br, or
+ *              NULL once the expansion is exhausted
+ */
+const char* BR_next(Brace br);
+
+
+/*
+ * Restart the expansion from its first word
+ *
+ * Parameters:
+ *  br          The iterator
+ */
+void BR_reset(Brace br);
+
+
+/*
+ * The total number of words the expansion generates
+ *
+ * Parameters:
+ *  br          The iterator
+ *
+ * Returns:
+ *  size_t      The number of words, saturating at SIZE_MAX
+ */
+size_t BR_count(Brace br);
+
+
+/*
+ * Return to heap the memory of an iterator
+ *
+ * Parameters:
+ *  br          The iterator, may be NULL
+ */
+void BR_free(Brace br);
+
+#endif /* _BRACE_H_ */
@@ -0,0 +1,465 @@
+/*
+ * clist_generic.h
+ *
+ * Type-generic linked list, instantiated by macro for each element
+ * type. Every instance gets its own node type, node pool and functions,
+ * so elements are stored unboxed and the compiler sees the real type.
+ *
+ * In a header:
+ *   DECLARE_CLIST(Int, int)
+ * declares the list type IntList and the functions IntL_new,
+ * IntL_append and so on. In one .c file:
+ *   DEFINE_CLIST(Int, int, CLIST_NO_DTOR, -1)
+ * defines them. CList in clist.h is the instance DEFINE_CLIST(C, Token, ...).
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _CLIST_GENERIC_H_
+#define _CLIST_GENERIC_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+
+
+// The element destructor of lists whose elements own nothing
+#define CLIST_NO_DTOR(element) ((void) (element))
+
+// In debug mode, NameL_length walks the list to check the stored length
+// and tail. Define CLIST_DEBUG to 0 to turn this off.
+#ifndef CLIST_DEBUG
+#define CLIST_DEBUG 1
+#endif
+
+// Nodes are carved out of slabs of this many nodes each. Build with
+// -DCL_NO_POOL to malloc every node instead, e.g. to compare.
+#define CL_SLAB_NODES 256
+#ifdef CL_NO_POOL
+#define CLIST_POOL 0
+#else
+#define CLIST_POOL 1
+#endif
+
+// The allocator of nodes, slabs and lists. Define these before including
+// this file to allocate through something else.
+#ifndef CL_MALLOC
+#define CL_MALLOC   malloc
+#define CL_FREE     free
+#endif
+
+// The most elements name##L_foreach_batch passes to its callback at once
+#define CLIST_BATCH 64
+
+// Freed pool nodes are poisoned, so ASan still reports use after free
+#if defined(__SANITIZE_ADDRESS__) && !defined(CL_NO_POOL)
+#include <sanitizer/asan_interface.h>
+#define CL_POISON(p, sz)    ASAN_POISON_MEMORY_REGION(p, sz)
+#define CL_UNPOISON(p, sz)  ASAN_UNPOISON_MEMORY_REGION(p, sz)
+#else
+#define CL_POISON(p, sz)    ((void) (p), (void) (sz))
+#define CL_UNPOISON(p, sz)  ((void) (p), (void) (sz))
+#endif
+
+
+/*
+ * Declare a list type name##List of elements of type, and its functions.
+ * In what follows, "the destructor" is the dtor given to DEFINE_CLIST.
+ *
+ * name##List name##L_new()
+ *   Create a new, empty list.
+ *
+ * void name##L_free(name##List list)
+ *   Destroy a list, calling the destructor on each element. list may be
+ *   NULL.
+ *
+ * int name##L_length(name##List list)
+ *   The length of the list, or 0 if list is empty.
+ *
+ * void name##L_push(name##List list, type element)
+ *   Insert element onto the head of the list.
+ *
+ * type name##L_pop(name##List list)
+ *   Remove the element from the head of the list, call the destructor on
+ *   it and return it, or the invalid value if the list is empty. Only
+ *   what the destructor leaves valid may be used of the returned element.
+ *
+ * void name##L_append(name##List list, type element)
+ *   Append element to the tail of the list, in O(1).
+ *
+ * type name##L_nth(name##List list, int pos)
+ *   Return the element at pos without modifying the list. pos >= 0
+ *   counts from the head, pos <= -1 from the tail, so -1 is the tail
+ *   element, returned in O(1). pos must be in [-length, length-1], or
+ *   the invalid value is returned.
+ *
+ * bool name##L_insert(name##List list, type element, int pos)
+ *   Insert element so that a following name##L_nth(list, pos) returns
+ *   it; pos == -1 appends. pos must be in [-length-1, length], or false
+ *   is returned.
+ *
+ * type name##L_remove(name##List list, int pos)
+ *   Remove the element at pos, counted as for name##L_nth, call the
+ *   destructor on it and return it as name##L_pop does, or the invalid
+ *   value if pos is out of range.
+ *
+ * name##List name##L_copy(name##List list)
+ *   A new list holding a shallow copy of each element.
+ *
+ * void name##L_join(name##List list1, name##List list2)
+ *   Move the elements of list2 onto the tail of list1, in O(1). list2
+ *   is left empty.
+ *
+ * void name##L_reverse(name##List list)
+ *   Reverse the order of the elements.
+ *
+ * void name##L_foreach(name##List list, name##L_foreach_callback callback,
+ *         void* cb_data)
+ *   Call callback(<position>, <element>, cb_data) for each element, from
+ *   the head.
+ *
+ * void name##L_extend(name##List list, const type* arr, int n)
+ *   Append the n elements of arr to the tail of the list, in order.
+ *
+ * int name##L_drain(name##List list, type* out, int n)
+ *   Move up to n elements from the head of the list into out, in order,
+ *   and return how many were moved. Unlike name##L_pop, the destructor
+ *   is not called: the caller takes ownership of the elements.
+ *
+ * void name##L_foreach_batch(name##List list,
+ *         name##L_batch_callback callback, void* cb_data)
+ *   Call callback(<position of batch[0]>, batch, <n>, cb_data) for
+ *   consecutive runs of up to CLIST_BATCH elements held contiguously in
+ *   batch, from the head. batch is valid only during the call.
+ */
+#define DECLARE_CLIST(name, type)                                           \
+    typedef struct _##name##list* name##List;                               \
+    typedef void (*name##L_foreach_callback)(int pos, type element,         \
+        void* cb_data);                                                     \
+                                                                            \
+    name##List name##L_new();                                               \
+    void name##L_free(name##List list);                                     \
+    int name##L_length(name##List list);                                    \
+    void name##L_push(name##List list, type element);                       \
+    type name##L_pop(name##List list);                                      \
+    void name##L_append(name##List list, type element);                     \
+    type name##L_nth(name##List list, int pos);                             \
+    bool name##L_insert(name##List list, type element, int pos);            \
+    type name##L_remove(name##List list, int pos);                          \
+    name##List name##L_copy(name##List list);                               \
+    void name##L_join(name##List list1, name##List list2);                  \
+    void name##L_reverse(name##List list);                                  \
+    void name##L_foreach(name##List list, name##L_foreach_callback callback, \
+        void* cb_data);                                                     \
+                                                                            \
+    typedef void (*name##L_batch_callback)(int pos, const type* batch,      \
+        int n, void* cb_data);                                              \
+                                                                            \
+    void name##L_extend(name##List list, const type* arr, int n);           \
+    int name##L_drain(name##List list, type* out, int n);                   \
+    void name##L_foreach_batch(name##List list,                             \
+        name##L_batch_callback callback, void* cb_data);
+
+
+/*
+ * Define the functions declared by DECLARE_CLIST(name, type)
+ *
+ * Parameters:
+ *   name       The name of the instance
+ *   type       The element type
+ *   dtor       A function or macro called as dtor(element) on each
+ *              element the list destroys, e.g. CLIST_NO_DTOR
+ *   invalid    The value returned by the functions that can fail
+ */
+#define DEFINE_CLIST(name, type, dtor, invalid)                             \
+    struct _##name##l_node {                                                \
+        type element;                                                       \
+        struct _##name##l_node* next;                                       \
+    };                                                                      \
+                                                                            \
+    struct _##name##list {                                                  \
+        struct _##name##l_node* head;                                       \
+        struct _##name##l_node* tail;   /* NULL when the list is empty */   \
+        int length;                                                         \
+    };                                                                      \
+                                                                            \
+    struct _##name##l_slab {                                                \
+        struct _##name##l_slab* next;                                       \
+        struct _##name##l_node nodes[CL_SLAB_NODES];                        \
+    };                                                                      \
+                                                                            \
+    /* Per-thread node pool: a free list of returned nodes, then the     */ \
+    /* unused tail of the newest slab, kept for the life of the thread   */ \
+    static __thread struct {                                                \
+        struct _##name##l_node* free;                                       \
+        struct _##name##l_slab* slabs;                                      \
+        int used;                                                           \
+    } name##l_pool;                                                         \
+                                                                            \
+    static struct _##name##l_node*                                          \
+    _##name##L_new_node(type element, struct _##name##l_node* next)         \
+    {                                                                       \
+        struct _##name##l_node* node = name##l_pool.free;                   \
+        if (!CLIST_POOL) {                                                  \
+            node = CL_MALLOC(sizeof(struct _##name##l_node));               \
+            assert(node);                                                   \
+        }                                                                   \
+        else if (node) {                                                    \
+            CL_UNPOISON(node, sizeof(struct _##name##l_node));              \
+            name##l_pool.free = node->next;                                 \
+        }                                                                   \
+        else {                                                              \
+            if (!name##l_pool.slabs || name##l_pool.used == CL_SLAB_NODES) { \
+                struct _##name##l_slab* slab =                              \
+                    CL_MALLOC(sizeof(struct _##name##l_slab));              \
+                assert(slab);                                               \
+                slab->next = name##l_pool.slabs;                            \
+                name##l_pool.slabs = slab;                                  \
+                name##l_pool.used = 0;                                      \
+            }                                                               \
+            node = &name##l_pool.slabs->nodes[name##l_pool.used++];         \
+        }                                                                   \
+                                                                            \
+        node->element = element;                                            \
+        node->next = next;                                                  \
+        return node;                                                        \
+    }                                                                       \
+                                                                            \
+    static void _##name##L_free_node(struct _##name##l_node* node)          \
+    {                                                                       \
+        if (!CLIST_POOL) {                                                  \
+            CL_FREE(node);                                                  \
+            return;                                                         \
+        }                                                                   \
+        node->next = name##l_pool.free;                                     \
+        name##l_pool.free = node;                                           \
+        CL_POISON(&node->element, sizeof(node->element));                   \
+    }                                                                       \
+                                                                            \
+    name##List name##L_new()                                                \
+    {                                                                       \
+        name##List list = CL_MALLOC(sizeof(struct _##name##list));          \
+        assert(list);                                                       \
+        list->head = list->tail = NULL;                                     \
+        list->length = 0;                                                   \
+        return list;                                                        \
+    }                                                                       \
+                                                                            \
+    void name##L_free(name##List list)                                      \
+    {                                                                       \
+        if (!list) return;                                                  \
+        while (list->head) {                                                \
+            struct _##name##l_node* temp = list->head;                      \
+            list->head = temp->next;                                        \
+            dtor(temp->element);                                            \
+            _##name##L_free_node(temp);                                     \
+        }                                                                   \
+        CL_FREE(list);                                                      \
+    }                                                                       \
+                                                                            \
+    int name##L_length(name##List list)                                     \
+    {                                                                       \
+        assert(list);                                                       \
+        if (CLIST_DEBUG) {                                                  \
+            int len = 0;                                                    \
+            struct _##name##l_node* last = NULL;                            \
+            for (struct _##name##l_node* node = list->head; node;           \
+                    node = node->next) {                                    \
+                last = node;                                                \
+                len++;                                                      \
+            }                                                               \
+            assert(len == list->length);                                    \
+            assert(last == list->tail);                                     \
+        }                                                                   \
+        return list->length;                                                \
+    }                                                                       \
+                                                                            \
+    void name##L_push(name##List list, type element)                        \
+    {                                                                       \
+        assert(list);                                                       \
+        list->head = _##name##L_new_node(element, list->head);              \
+        if (!list->tail) list->tail = list->head;                           \
+        list->length++;                                                     \
+    }                                                                       \
+                                                                            \
+    type name##L_pop(name##List list)                                       \
+    {                                                                       \
+        assert(list);                                                       \
+        struct _##name##l_node* popped = list->head;                        \
+        if (!popped) return invalid;                                        \
+                                                                            \
+        type ret = popped->element;                                         \
+        list->head = popped->next;                                          \
+        if (!list->head) list->tail = NULL;                                 \
+        dtor(popped->element);                                              \
+        _##name##L_free_node(popped);                                       \
+        list->length--;                                                     \
+        return ret;                                                         \
+    }                                                                       \
+                                                                            \
+    void name##L_append(name##List list, type element)                      \
+    {                                                                       \
+        assert(list);                                                       \
+        struct _##name##l_node* temp = _##name##L_new_node(element, NULL);  \
+        if (list->length++ == 0) list->head = temp;                         \
+        else list->tail->next = temp;                                       \
+        list->tail = temp;                                                  \
+    }                                                                       \
+                                                                            \
+    type name##L_nth(name##List list, int pos)                              \
+    {                                                                       \
+        assert(list);                                                       \
+        if (pos < -list->length || pos >= list->length) return invalid;     \
+        if (pos == -1 || pos == list->length - 1)                           \
+            return list->tail->element;                                     \
+                                                                            \
+        int i = (pos + list->length) % list->length;                        \
+        struct _##name##l_node* node = list->head;                          \
+        while (i--) node = node->next;                                      \
+        return node->element;                                               \
+    }                                                                       \
+                                                                            \
+    bool name##L_insert(name##List list, type element, int pos)             \
+    {                                                                       \
+        assert(list);                                                       \
+        if (pos < -list->length - 1 || pos > list->length) return false;    \
+                                                                            \
+        if (pos < 0) pos += list->length + 1;                               \
+        if (pos == 0) name##L_push(list, element);                          \
+        else if (pos == list->length) name##L_append(list, element);        \
+        else {                                                              \
+            /* find the node to insert after */                             \
+            struct _##name##l_node* node = list->head;                      \
+            while (--pos) node = node->next;                                \
+            node->next = _##name##L_new_node(element, node->next);          \
+            list->length++;                                                 \
+        }                                                                   \
+        return true;                                                        \
+    }                                                                       \
+                                                                            \
+    type name##L_remove(name##List list, int pos)                           \
+    {                                                                       \
+        assert(list);                                                       \
+        if (pos < -list->length || pos > list->length - 1) return invalid;  \
+                                                                            \
+        if (pos < 0) pos += list->length;                                   \
+        if (pos == 0) return name##L_pop(list);                             \
+                                                                            \
+        /* find the node previous to the node to remove */                  \
+        struct _##name##l_node* prev = list->head;                          \
+        while (--pos) prev = prev->next;                                    \
+                                                                            \
+        struct _##name##l_node* temp = prev->next;                          \
+        type elem = temp->element;                                          \
+        prev->next = temp->next;                                            \
+        if (temp == list->tail) list->tail = prev;                          \
+        list->length--;                                                     \
+        dtor(temp->element);                                                \
+        _##name##L_free_node(temp);                                         \
+        return elem;                                                        \
+    }                                                                       \
+                                                                            \
+    name##List name##L_copy(name##List list)                                \
+    {                                                                       \
+        assert(list);                                                       \
+        name##List res = name##L_new();                                     \
+        for (struct _##name##l_node* node = list->head; node;               \
+                node = node->next)                                          \
+            name##L_append(res, node->element);                             \
+        return res;                                                         \
+    }                                                                       \
+                                                                            \
+    void name##L_join(name##List list1, name##List list2)                   \
+    {                                                                       \
+        assert(list1);                                                      \
+        assert(list2);                                                      \
+        if (!list2->head) return;                                           \
+                                                                            \
+        /* splice the nodes of list2 onto the tail of list1 */              \
+        if (list1->tail) list1->tail->next = list2->head;                   \
+        else list1->head = list2->head;                                     \
+        list1->tail = list2->tail;                                          \
+        list1->length += list2->length;                                     \
+                                                                            \
+        list2->head = list2->tail = NULL;                                   \
+        list2->length = 0;                                                  \
+    }                                                                       \
+                                                                            \
+    void name##L_reverse(name##List list)                                   \
+    {                                                                       \
+        assert(list);                                                       \
+        list->tail = list->head;                                            \
+        struct _##name##l_node* reverse = NULL;                             \
+        while (list->head) {                                                \
+            struct _##name##l_node* second = list->head->next;              \
+            list->head->next = reverse;                                     \
+            reverse = list->head;                                           \
+            list->head = second;                                            \
+        }                                                                   \
+        list->head = reverse;                                               \
+    }                                                                       \
+                                                                            \
+    void name##L_foreach(name##List list, name##L_foreach_callback callback, \
+        void* cb_data)                                                      \
+    {                                                                       \
+        assert(list);                                                       \
+        int i = 0;                                                          \
+        for (struct _##name##l_node* node = list->head; node;               \
+                node = node->next)                                          \
+            callback(i++, node->element, cb_data);                          \
+    }                                                                       \
+                                                                            \
+    void name##L_extend(name##List list, const type* arr, int n)            \
+    {                                                                       \
+        assert(list);                                                       \
+        if (n <= 0) return;                                                 \
+                                                                            \
+        /* chain the new nodes, then link them in once */                   \
+        struct _##name##l_node* first = _##name##L_new_node(arr[0], NULL);  \
+        struct _##name##l_node* last = first;                               \
+        for (int i = 1; i < n; i++)                                         \
+            last = last->next = _##name##L_new_node(arr[i], NULL);          \
+                                                                            \
+        if (list->tail) list->tail->next = first;                           \
+        else list->head = first;                                            \
+        list->tail = last;                                                  \
+        list->length += n;                                                  \
+    }                                                                       \
+                                                                            \
+    int name##L_drain(name##List list, type* out, int n)                    \
+    {                                                                       \
+        assert(list);                                                       \
+        int i = 0;                                                          \
+        while (i < n && list->head) {                                       \
+            struct _##name##l_node* node = list->head;                      \
+            out[i++] = node->element;                                       \
+            list->head = node->next;                                        \
+            _##name##L_free_node(node);                                     \
+        }                                                                   \
+        if (!list->head) list->tail = NULL;                                 \
+        list->length -= i;                                                  \
+        return i;                                                           \
+    }                                                                       \
+                                                                            \
+    void name##L_foreach_batch(name##List list,                             \
+        name##L_batch_callback callback, void* cb_data)                     \
+    {                                                                       \
+        assert(list);                                                       \
+        type batch[CLIST_BATCH];                                            \
+        int n = 0, pos = 0;                                                 \
+        for (struct _##name##l_node* node = list->head; node;               \
+                node = node->next) {                                        \
+            batch[n++] = node->element;                                     \
+            if (n == CLIST_BATCH) {                                         \
+                callback(pos, batch, n, cb_data);                           \
+                pos += n;                                                   \
+                n = 0;                                                      \
+            }                                                               \
+        }                                                                   \
+        if (n) callback(pos, batch, n, cb_data);                            \
+    }
+
+#endif /* _CLIST_GENERIC_H_ */
@@ -0,0 +1,478 @@
+/*
+ * clist_unrolled.c
+ *
+ * Unrolled linked list implementation of the CList API in clist.h. Each
+ * node holds a chunk of up to CL_CHUNK_ELEMS elements, so traversals
+ * scan mostly sequential memory. Select it over clist.c with
+ * "make CLIST=clist_unrolled".
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "clist.h"
+#include "memstats.h"
+
+#define DEBUG
+
+// Elements per chunk: 32 Tokens make a 512 byte chunk, 8 cache lines
+#define CL_CHUNK_ELEMS 32
+
+// The live elements of a chunk are elems[start, start + count), so both
+// ends of the list take pushes and pops without moving elements
+struct _cl_chunk {
+    struct _cl_chunk* next;
+    int start;
+    int count;
+    CListElementType elems[CL_CHUNK_ELEMS];
+};
+
+struct _Clist {
+    struct _cl_chunk *head;
+    struct _cl_chunk *tail;  // NULL when the list is empty
+    int length;
+};
+
+
+
+/*
+ * Create (malloc) a new, empty chunk
+ *
+ * Parameters:
+ *   start  Where in the chunk its elements will begin
+ *   next   The chunk to follow it
+ *
+ * Returns: The newly-malloc'd chunk
+ */
+static struct _cl_chunk* _CL_new_chunk(int start, struct _cl_chunk* next)
+{
+    struct _cl_chunk* new = (struct _cl_chunk*) MEM_malloc(sizeof(struct _cl_chunk));
+    assert(new);
+
+    new->next = next;
+    new->start = start;
+    new->count = 0;
+
+    return new;
+}
+
+
+/*
+ * Move the elements of a chunk to its front, making room at the back
+ */
+static void _CL_compact(struct _cl_chunk* chunk)
+{
+    if (!chunk->start) return;
+    memmove(chunk->elems, chunk->elems + chunk->start,
+        chunk->count * sizeof(CListElementType));
+    chunk->start = 0;
+}
+
+
+/*
+ * Find the chunk holding a position of the list
+ *
+ * Parameters:
+ *   list   The list
+ *   pos    The normalized position, in [0, length)
+ *   prevp  Return space for the chunk before it, NULL for the head;
+ *          may be NULL
+ *   offp   Return space for the position within the chunk
+ *
+ * Returns: The chunk
+ */
+static struct _cl_chunk* _CL_find(CList list, int pos,
+        struct _cl_chunk** prevp, int* offp)
+{
+    struct _cl_chunk *prev = NULL, *chunk = list->head;
+
+    // the tail chunk is at hand without walking the list
+    if (pos >= list->length - list->tail->count && !prevp) {
+        *offp = pos - (list->length - list->tail->count);
+        return list->tail;
+    }
+
+    while (pos >= chunk->count) {
+        pos -= chunk->count;
+        prev = chunk;
+        chunk = chunk->next;
+    }
+    if (prevp) *prevp = prev;
+    *offp = pos;
+    return chunk;
+}
+
+
+/*
+ * Unlink and free a chunk that has become empty
+ *
+ * Parameters:
+ *   list   The list
+ *   prev   The chunk before it, NULL if it is the head
+ *   chunk  The empty chunk
+ */
+static void _CL_unlink(CList list, struct _cl_chunk* prev, struct _cl_chunk* chunk)
+{
+    if (prev) prev->next = chunk->next;
+    else list->head = chunk->next;
+    if (list->tail == chunk) list->tail = prev;
+    MEM_free(chunk);
+}
+
+
+
+// Documented in .h file
+CList CL_new()
+{
+    CList list = (CList) MEM_malloc(sizeof(struct _Clist));
+    assert(list);
+
+    list->head = NULL;
+    list->tail = NULL;
+    list->length = 0;
+
+    return list;
+}
+
+
+
+// Documented in .h file
+void CL_free(CList list)
+{
+    if (!list) return;
+
+    while (list->head) {
+        struct _cl_chunk *temp = list->head;
+        list->head = temp->next;
+        for (int i = temp->start; i < temp->start + temp->count; i++)
+            MEM_free((void *) temp->elems[i].value);
+        MEM_free(temp);
+    }
+    MEM_free(list);
+}
+
+
+
+// Documented in .h file
+int CL_length(CList list)
+{
+    assert(list);
+#ifdef DEBUG
+    // As in clist.c, walk the list in DEBUG mode and check the stored
+    // length and tail. Chunks are never left empty.
+
+    int len = 0;
+    struct _cl_chunk *last = NULL;
+    for (struct _cl_chunk *chunk = list->head; chunk != NULL; chunk = chunk->next) {
+        assert(chunk->count > 0);
+        assert(chunk->start >= 0 && chunk->start + chunk->count <= CL_CHUNK_ELEMS);
+        len += chunk->count;
+        last = chunk;
+    }
+
+    assert(len == list->length);
+    assert(last == list->tail);
+#endif // DEBUG
+
+    return list->length;
+}
+
+
+
+// Documented in .h file
+void CL_push(CList list, CListElementType element)
+{
+    assert(list);
+
+    struct _cl_chunk *head = list->head;
+    if (!head || head->count == CL_CHUNK_ELEMS) {
+        // fill a new head chunk from the back, so pushes keep landing in it
+        head = list->head = _CL_new_chunk(CL_CHUNK_ELEMS, head);
+        if (!list->tail) list->tail = head;
+    }
+    else if (head->start == 0) {
+        memmove(head->elems + 1, head->elems,
+            head->count * sizeof(CListElementType));
+        head->start = 1;
+    }
+
+    head->elems[--head->start] = element;
+    head->count++;
+    list->length++;
+}
+
+
+
+// Documented in .h file
+CListElementType CL_pop(CList list)
+{
+    assert(list);
+    struct _cl_chunk *head = list->head;
+
+    if (head == NULL)
+        return INVALID_RETURN;
+
+    CListElementType ret = head->elems[head->start++];
+    MEM_free((void *) ret.value);
+    if (--head->count == 0) _CL_unlink(list, NULL, head);
+
+    list->length--;
+
+    return ret;
+}
+
+
+
+// Documented in .h file
+void CL_append(CList list, CListElementType element)
+{
+    assert(list);
+
+    struct _cl_chunk *tail = list->tail;
+    if (!tail || tail->count == CL_CHUNK_ELEMS) {
+        struct _cl_chunk *new = _CL_new_chunk(0, NULL);
+        if (tail) tail->next = new;
+        else list->head = new;
+        tail = list->tail = new;
+    }
+    else if (tail->start + tail->count == CL_CHUNK_ELEMS) _CL_compact(tail);
+
+    tail->elems[tail->start + tail->count++] = element;
+    list->length++;
+}
+
+
+
+// Documented in .h file
+CListElementType CL_nth(CList list, int pos)
+{
+    assert(list);
+
+    // Validate index position
+    if (pos < -list->length || pos >= list->length)
+        return INVALID_RETURN;
+
+    int off;
+    struct _cl_chunk *chunk = _CL_find(list, (pos + list->length) % list->length,
+        NULL, &off);
+    return chunk->elems[chunk->start + off];
+}
+
+
+
+// Documented in .h file
+bool CL_insert(CList list, CListElementType element, int pos)
+{
+    assert(list);
+
+    // Validate index
+    if (pos < -list->length-1 || pos > list->length) return false;
+
+    // Normalize index; the ends are plain pushes and appends
+    if (pos < 0) pos += list->length + 1;
+    if (pos == 0) {
+        CL_push(list, element);
+        return true;
+    }
+    if (pos == list->length) {
+        CL_append(list, element);
+        return true;
+    }
+
+    int off;
+    struct _cl_chunk *chunk = _CL_find(list, pos, NULL, &off);
+
+    // a full chunk is split in two, and the insert goes into either half
+    if (chunk->count == CL_CHUNK_ELEMS) {
+        int half = CL_CHUNK_ELEMS / 2;
+        struct _cl_chunk *new = _CL_new_chunk(0, chunk->next);
+        memcpy(new->elems, chunk->elems + chunk->start + half,
+            (CL_CHUNK_ELEMS - half) * sizeof(CListElementType));
+        new->count = CL_CHUNK_ELEMS - half;
+        chunk->count = half;
+        chunk->next = new;
+        if (list->tail == chunk) list->tail = new;
+
+        if (off > half) {
+            chunk = new;
+            off -= half;
+        }
+    }
+
+    _CL_compact(chunk);
+    memmove(chunk->elems + off + 1, chunk->elems + off,
+        (chunk->count - off) * sizeof(CListElementType));
+    chunk->elems[off] = element;
+    chunk->count++;
+    list->length++;
+
+    return true;
+}
+
+
+
+// Documented in .h file
+CListElementType CL_remove(CList list, int pos)
+{
+    assert(list);
+
+    // Validate index position
+    if (pos < -list->length || pos > list->length-1)
+        return INVALID_RETURN;
+
+    // Normalize index and handle special case of pos = 0 with pop
+    if (pos < 0)  pos += list->length;
+    if (pos == 0) return CL_pop(list);
+
+    int off;
+    struct _cl_chunk *prev;
+    struct _cl_chunk *chunk = _CL_find(list, pos, &prev, &off);
+
+    CListElementType *slot = chunk->elems + chunk->start + off;
+    CListElementType elem = *slot;
+    memmove(slot, slot + 1, (chunk->count - off - 1) * sizeof(CListElementType));
+    if (--chunk->count == 0) _CL_unlink(list, prev, chunk);
+    list->length--;
+    MEM_free((void *) elem.value);
+
+    return elem;
+}
+
+
+
+// Documented in .h file
+CList CL_copy(CList list)
+{
+    assert(list);
+
+    CList res = CL_new();
+    for (struct _cl_chunk *chunk = list->head; chunk != NULL; chunk = chunk->next)
+        for (int i = chunk->start; i < chunk->start + chunk->count; i++)
+            CL_append(res, chunk->elems[i]);
+    return res;
+}
+
+
+
+// Documented in .h file
+void CL_join(CList list1, CList list2)
+{
+    assert(list1);
+    assert(list2);
+
+    if (!list2->head) return;
+
+    // Splice the chunks of list2 onto the tail of list1
+    if (list1->tail) list1->tail->next = list2->head;
+    else list1->head = list2->head;
+    list1->tail = list2->tail;
+    list1->length += list2->length;
+
+    list2->head = list2->tail = NULL;
+    list2->length = 0;
+}
+
+
+// Documented in .h file
+void CL_reverse(CList list)
+{
+    assert(list);
+
+    // Reverse the order of the chunks, and the elements within each
+    list->tail = list->head;
+    struct _cl_chunk *reverse = NULL;
+    while (list->head) {
+        struct _cl_chunk *chunk = list->head;
+        list->head = chunk->next;
+
+        CListElementType *lo = chunk->elems + chunk->start;
+        CListElementType *hi = lo + chunk->count - 1;
+        for (; lo < hi; lo++, hi--) {
+            CListElementType temp = *lo;
+            *lo = *hi;
+            *hi = temp;
+        }
+
+        chunk->next = reverse;
+        reverse = chunk;
+    }
+    list->head = reverse;
+}
+
+
+// Documented in .h file
+void CL_foreach(CList list, CL_foreach_callback callback, void *cb_data)
+{
+    assert(list);
+
+    int pos = 0;
+    for (struct _cl_chunk *chunk = list->head; chunk != NULL; chunk = chunk->next)
+        for (int i = chunk->start; i < chunk->start + chunk->count; i++)
+            callback(pos++, chunk->elems[i], cb_data);
+}
+
+
+// Documented in .h file
+void CL_extend(CList list, const CListElementType* arr, int n)
+{
+    assert(list);
+
+    while (n > 0) {
+        struct _cl_chunk *tail = list->tail;
+        if (!tail || tail->count == CL_CHUNK_ELEMS) {
+            struct _cl_chunk *new = _CL_new_chunk(0, NULL);
+            if (tail) tail->next = new;
+            else list->head = new;
+            tail = list->tail = new;
+        }
+        _CL_compact(tail);
+
+        // fill the tail chunk as far as it goes
+        int room = CL_CHUNK_ELEMS - tail->count;
+        int k = n < room? n: room;
+        memcpy(tail->elems + tail->count, arr, k * sizeof(CListElementType));
+        tail->count += k;
+        list->length += k;
+        arr += k;
+        n -= k;
+    }
+}
+
+
+// Documented in .h file
+int CL_drain(CList list, CListElementType* out, int n)
+{
+    assert(list);
+
+    int moved = 0;
+    while (moved < n && list->head) {
+        struct _cl_chunk *head = list->head;
+        int k = n - moved < head->count? n - moved: head->count;
+        memcpy(out + moved, head->elems + head->start, k * sizeof(CListElementType));
+        head->start += k;
+        head->count -= k;
+        moved += k;
+        if (head->count == 0) _CL_unlink(list, NULL, head);
+    }
+    list->length -= moved;
+    return moved;
+}
+
+
+// Documented in .h file
+void CL_foreach_batch(CList list, CL_batch_callback callback, void *cb_data)
+{
+    assert(list);
+
+    // each chunk already is a contiguous batch
+    int pos = 0;
+    for (struct _cl_chunk *chunk = list->head; chunk != NULL; chunk = chunk->next) {
+        callback(pos, chunk->elems + chunk->start, chunk->count, cb_data);
+        pos += chunk->count;
+    }
+}
@@ -0,0 +1,300 @@
+/*
+ * cmdlog.c
+ *
+ * Structured command log
+ *
+ * The shell thread fills in one record per pipeline in place and pushes
+ * it to the ring with a single copy when the pipeline is done; it never
+ * formats JSON or makes a system call for the log. The ring's writer
+ * thread turns records into JSON lines and writes them with writev.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "cmdlog.h"
+#include "ring.h"
+
+#define LOG_RING_BYTES  (1 << 20)
+#define LOG_LINE_MAX    512
+#define LOG_NAME_MAX    32
+#define LOG_STAGES_MAX  16
+#define LOG_JSON_MAX    16384
+
+struct _log_stage {
+    char name[LOG_NAME_MAX];
+    int pid;
+    int status;
+    int64_t utime_us, stime_us;
+    int64_t maxrss_kb, minflt, majflt, nvcsw, nivcsw;
+};
+
+struct _log_record {
+    int64_t start_ns, end_ns;       // CLOCK_REALTIME
+    int status;
+    int nstages;
+    int omitted;                    // stages past LOG_STAGES_MAX
+    char line[LOG_LINE_MAX];
+    struct _log_stage stages[LOG_STAGES_MAX];   // only nstages are pushed
+};
+
+static Ring ring = NULL;
+static RingWriter writer = NULL;
+static int log_fd = -1;
+
+// the record being filled in, between LOG_begin and LOG_end
+static struct _log_record rec;
+static bool in_record = false;
+
+
+
+static int64_t realtime_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * Output cursor for formatting a record, which stops adding once full
+ */
+struct _out {
+    char* buf;
+    size_t size;
+    size_t len;
+};
+
+
+static void out_printf(struct _out* out, const char* fmt, ...)
+{
+    if (out->len >= out->size) return;
+    va_list ap;
+    va_start(ap, fmt);
+    out->len += vsnprintf(out->buf + out->len, out->size - out->len, fmt, ap);
+    va_end(ap);
+}
+
+
+/*
+ * Add s as a JSON string, quotes included
+ */
+static void out_string(struct _out* out, const char* s)
+{
+    out_printf(out, "\"");
+    for (; *s && out->len + 7 < out->size; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') out_printf(out, "\\%c", c);
+        else if (c < 0x20) out_printf(out, "\\u%04x", c);
+        else out->buf[out->len++] = c;
+    }
+    out_printf(out, "\"");
+}
+
+
+/*
+ * Add a wall clock time in ISO 8601, to the microsecond
+ */
+static void out_time(struct _out* out, int64_t ns)
+{
+    time_t secs = ns / 1000000000;
+    struct tm tm;
+    char date[32];
+    gmtime_r(&secs, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+    out_printf(out, "\"%s.%06dZ\"", date, (int) (ns % 1000000000 / 1000));
+}
+
+
+/*
+ * RingFormat for the log: one record to one line of JSON
+ */
+static size_t format_record(const void* data, size_t len, char* buf, size_t buf_sz)
+{
+    const struct _log_record* r = data;
+    struct _out out = {buf, buf_sz, 0};
+
+    out_printf(&out, "{\"start\":");
+    out_time(&out, r->start_ns);
+    out_printf(&out, ",\"end\":");
+    out_time(&out, r->end_ns);
+    out_printf(&out, ",\"duration_us\":%ld,\"pipeline\":",
+        (long) ((r->end_ns - r->start_ns) / 1000));
+    out_string(&out, r->line);
+    out_printf(&out, ",\"status\":%d,\"stages\":[", r->status);
+
+    for (int i = 0; i < r->nstages; i++) {
+        const struct _log_stage* s = &r->stages[i];
+        out_printf(&out, "%s{\"name\":", i? ",": "");
+        out_string(&out, s->name);
+        out_printf(&out, ",\"pid\":%d", s->pid);
+        if (WIFSIGNALED(s->status))
+            out_printf(&out, ",\"signal\":%d", WTERMSIG(s->status));
+        else
+            out_printf(&out, ",\"exit\":%d", WEXITSTATUS(s->status));
+        if (s->pid)
+            out_printf(&out, ",\"utime_us\":%ld,\"stime_us\":%ld,"
+                "\"maxrss_kb\":%ld,\"minflt\":%ld,\"majflt\":%ld,"
+                "\"nvcsw\":%ld,\"nivcsw\":%ld", (long) s->utime_us,
+                (long) s->stime_us, (long) s->maxrss_kb, (long) s->minflt,
+                (long) s->majflt, (long) s->nvcsw, (long) s->nivcsw);
+        out_printf(&out, "}");
+    }
+    out_printf(&out, "]");
+    if (r->omitted) out_printf(&out, ",\"stages_omitted\":%d", r->omitted);
+    out_printf(&out, "}\n");
+
+    // a truncated line would not be JSON
+    return out.len < out.size? out.len: 0;
+}
+
+
+/*
+ * pthread_atfork child handler: the writer thread is not forked, so the
+ * child lets go of the log without stopping it
+ */
+static void forget_log()
+{
+    ring = NULL;
+    writer = NULL;
+    log_fd = -1;
+    in_record = false;
+}
+
+
+// Documented in .h file
+bool LOG_start(const char* path)
+{
+    LOG_stop();
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) return false;
+
+    static bool registered = false;
+    if (!registered) registered = !pthread_atfork(NULL, NULL, forget_log);
+
+    ring = RING_new(LOG_RING_BYTES);
+    writer = RING_formatter_start(ring, fd, format_record, LOG_JSON_MAX);
+    if (!writer) {
+        RING_free(ring);
+        ring = NULL;
+        close(fd);
+        return false;
+    }
+    log_fd = fd;
+    in_record = false;
+    return true;
+}
+
+
+// Documented in .h file
+void LOG_stop()
+{
+    if (!ring) return;
+
+    RING_writer_stop(writer);
+    close(log_fd);
+    if (RING_dropped(ring))
+        fprintf(stderr, "cmdlog: %lu records dropped\n",
+            (unsigned long) RING_dropped(ring));
+
+    RING_free(ring);
+    ring = NULL;
+    writer = NULL;
+    log_fd = -1;
+}
+
+
+// Documented in .h file
+bool LOG_enabled()
+{   return ring != NULL; }
+
+
+// Documented in .h file
+void LOG_begin(AST pipeline)
+{
+    if (!ring) return;
+
+    rec.start_ns = realtime_ns();
+    rec.nstages = rec.omitted = 0;
+    AST_pipeline2str(pipeline, rec.line, sizeof(rec.line));
+    in_record = true;
+}
+
+
+// Documented in .h file
+void LOG_begin_line(const char* line)
+{
+    if (!ring) return;
+
+    rec.start_ns = realtime_ns();
+    rec.nstages = rec.omitted = 0;
+    snprintf(rec.line, sizeof(rec.line), "%s", line);
+    in_record = true;
+}
+
+
+// Documented in .h file
+void LOG_stage(const char* name, int pid, int status,
+    const struct rusage* usage)
+{
+    if (!in_record) return;
+    if (rec.nstages == LOG_STAGES_MAX) {
+        rec.omitted++;
+        return;
+    }
+
+    struct _log_stage* s = &rec.stages[rec.nstages++];
+    memset(s, 0, sizeof(*s));
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    s->pid = pid;
+    s->status = status;
+    if (!usage) return;
+    s->utime_us = usage->ru_utime.tv_sec * 1000000 + usage->ru_utime.tv_usec;
+    s->stime_us = usage->ru_stime.tv_sec * 1000000 + usage->ru_stime.tv_usec;
+    s->maxrss_kb = usage->ru_maxrss;
+    s->minflt = usage->ru_minflt;
+    s->majflt = usage->ru_majflt;
+    s->nvcsw = usage->ru_nvcsw;
+    s->nivcsw = usage->ru_nivcsw;
+}
+
+
+// Documented in .h file
+void LOG_end(int status)
+{
+    if (!in_record) return;
+    in_record = false;
+    if (!ring) return;
+
+    rec.end_ns = realtime_ns();
+    rec.status = status;
+    RING_push(ring, &rec, offsetof(struct _log_record, stages)
+        + rec.nstages * sizeof(struct _log_stage));
+}
+
+
+// Documented in .h file
+void LOG_child(const char* line, const struct timespec* started, int pid,
+    int status, const struct rusage* usage)
+{
+    if (!ring) return;
+
+    LOG_begin_line(line);
+    rec.start_ns = (int64_t) started->tv_sec * 1000000000 + started->tv_nsec;
+    LOG_stage(line, pid, status, usage);
+    LOG_end(WIFSIGNALED(status)? 128 + WTERMSIG(status): WEXITSTATUS(status));
+}
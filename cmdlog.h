@@ -0,0 +1,112 @@
+/*
+ * cmdlog.h
+ *
+ * Structured command log for auditing: one JSON object per line for
+ * every pipeline executed, with its text, wall clock start and end, and
+ * the exit status and resource usage of each stage. The shell thread
+ * only copies a fixed-size record into a ring; a writer thread formats
+ * the records and writes them in batches. Started by the PSH_LOG
+ * environment variable or the cmdlog builtin. A forked child has no
+ * writer thread, so the log stays the parent's and the child logs
+ * nothing.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _CMDLOG_H_
+#define _CMDLOG_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "pipeline.h"
+
+
+/*
+ * Start logging, appending to a file. A log already being written is
+ * stopped first.
+ *
+ * Parameters:
+ *  path        The file to append to, created if need be
+ *
+ * Returns:
+ *  bool        false if the file could not be opened
+ */
+bool LOG_start(const char* path);
+
+
+/*
+ * Write out every record logged so far and close the log, if any
+ */
+void LOG_stop();
+
+
+/*
+ * Whether a log is being written
+ */
+bool LOG_enabled();
+
+
+/*
+ * Begin the record of a pipeline about to be executed. Does nothing
+ * when no log is being written.
+ *
+ * Parameters:
+ *  pipeline    The pipeline
+ */
+void LOG_begin(AST pipeline);
+
+
+/*
+ * Begin the record of a command line that is not a plain pipeline, such
+ * as limit or parallel, logged by its text. Does nothing when no log is
+ * being written.
+ *
+ * Parameters:
+ *  line        The command line, truncated if need be
+ */
+void LOG_begin_line(const char* line);
+
+
+/*
+ * Add a stage to the record begun by LOG_begin. Stages past the most a
+ * record holds are counted but not described.
+ *
+ * Parameters:
+ *  name        The command
+ *  pid         Its process, or 0 for a builtin run in the shell
+ *  status      Its status, as from wait
+ *  usage       Its resource usage, or NULL for a builtin
+ */
+void LOG_stage(const char* name, int pid, int status,
+    const struct rusage* usage);
+
+
+/*
+ * Finish the record begun by LOG_begin and queue it for writing
+ *
+ * Parameters:
+ *  status      The pipeline's exit status
+ */
+void LOG_end(int status);
+
+
+/*
+ * Log the record of a command line run whole in a child, which lets go
+ * of the log when it forks, such as a server request: a single stage
+ * for the child, from its start until it was reaped. Does nothing when
+ * no log is being written.
+ *
+ * Parameters:
+ *  line        The command line, truncated if need be
+ *  started     When the child was started, on CLOCK_REALTIME
+ *  pid         The child
+ *  status      Its status, as from wait
+ *  usage       Its resource usage, with that of the stages it reaped
+ */
+void LOG_child(const char* line, const struct timespec* started, int pid,
+    int status, const struct rusage* usage);
+
+#endif /* _CMDLOG_H_ */
@@ -0,0 +1,457 @@
+/*
+ * globcache.c
+ *
+ * Directory listing cache for glob expansion, kept up to date with
+ * inotify
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE     // typed GLOB_ALTDIRFUNC members of glob_t
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <glob.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "globcache.h"
+
+#define GC_MAX_DIRS     64
+#define GC_WATCH_MASK   (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+                        | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+
+struct _gc_entry {
+    char* name;
+    unsigned char type;     // d_type, or DT_UNKNOWN
+};
+
+// A cached directory; entries are kept sorted by name
+struct _gc_dir {
+    char* path;             // absolute path, the cache key
+    int wd;                 // inotify watch descriptor
+    struct _gc_entry* entries;
+    size_t n;
+    size_t cap;
+    int refs;               // open handles; pinned while nonzero
+    unsigned long last_used;
+};
+
+// What gl_opendir hands to glob: a cursor over a cached listing, or a
+// real DIR for directories that could not be cached
+struct _gc_handle {
+    struct _gc_dir* dir;
+    size_t pos;
+    DIR* real;
+    struct dirent ent;
+};
+
+static struct {
+    int ifd;                // inotify instance, -1 until first use
+    char* cwd;              // cached getcwd(), NULL after a chdir
+    struct _gc_dir* dirs[GC_MAX_DIRS];
+    unsigned long clock;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long uncached;
+    unsigned long deltas;
+    unsigned long evictions;
+} gc = {.ifd = -1};
+
+
+
+/*
+ * Build the cache key for path: absolute, without trailing slashes
+ *
+ * Parameters:
+ *  path        The directory as passed to gl_opendir
+ *
+ * Returns:
+ *  char*       The malloc'd key, or NULL if the working directory is
+ *              unknown
+ */
+static char* gc_key(const char* path)
+{
+    if (*path != '/' && !gc.cwd && !(gc.cwd = getcwd(NULL, 0)))
+        return NULL;
+
+    size_t len = strlen(path);
+    while (len > 1 && path[len-1] == '/') len--;
+    if (len == 1 && *path == '.') len = 0;
+
+    size_t cwdlen = *path == '/'? 0: strlen(gc.cwd);
+    char* key = malloc(cwdlen + len + 2);
+    assert(key);
+    if (*path == '/') *key = 0;
+    else strcpy(key, gc.cwd);
+    if (cwdlen && len && key[cwdlen-1] != '/') strcat(key, "/");
+    strncat(key, path, len);
+    return key;
+}
+
+
+/*
+ * Binary search the entries of dir for name
+ *
+ * Parameters:
+ *  dir         The cached directory
+ *  name        The name to find
+ *  found       Return space, set to whether the name is present
+ *
+ * Returns:
+ *  size_t      The index of name, or where it would be inserted
+ */
+static size_t gc_search(struct _gc_dir* dir, const char* name, bool* found)
+{
+    size_t lo = 0, hi = dir->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(dir->entries[mid].name, name);
+        if (!cmp) {
+            *found = true;
+            return mid;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *found = false;
+    return lo;
+}
+
+
+static void gc_insert(struct _gc_dir* dir, const char* name, unsigned char type)
+{
+    bool found;
+    size_t i = gc_search(dir, name, &found);
+    if (found) {
+        dir->entries[i].type = type;
+        return;
+    }
+
+    if (dir->n == dir->cap) {
+        dir->cap = dir->cap? 2 * dir->cap: 16;
+        dir->entries = realloc(dir->entries,
+            dir->cap * sizeof(struct _gc_entry));
+        assert(dir->entries);
+    }
+    memmove(dir->entries + i + 1, dir->entries + i,
+        (dir->n - i) * sizeof(struct _gc_entry));
+    dir->entries[i].name = strdup(name);
+    dir->entries[i].type = type;
+    dir->n++;
+}
+
+
+static void gc_delete(struct _gc_dir* dir, const char* name)
+{
+    bool found;
+    size_t i = gc_search(dir, name, &found);
+    if (!found) return;
+
+    free(dir->entries[i].name);
+    memmove(dir->entries + i, dir->entries + i + 1,
+        (dir->n - i - 1) * sizeof(struct _gc_entry));
+    dir->n--;
+}
+
+
+/*
+ * Remove dirs[slot] from the cache. The inotify watch is removed unless
+ * another cached path refers to the same directory.
+ */
+static void gc_evict(int slot)
+{
+    struct _gc_dir* dir = gc.dirs[slot];
+    gc.dirs[slot] = NULL;
+
+    bool shared = false;
+    for (int i = 0; i < GC_MAX_DIRS; i++)
+        if (gc.dirs[i] && gc.dirs[i]->wd == dir->wd) shared = true;
+    if (!shared) inotify_rm_watch(gc.ifd, dir->wd);
+
+    for (size_t i = 0; i < dir->n; i++)
+        free(dir->entries[i].name);
+    free(dir->entries);
+    free(dir->path);
+    free(dir);
+    gc.evictions++;
+}
+
+
+/*
+ * Apply the inotify events queued since the last call
+ */
+static void gc_sync()
+{
+    if (gc.ifd == -1) return;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(gc.ifd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + len; ) {
+            struct inotify_event* ev = (struct inotify_event*) p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            for (int i = 0; i < GC_MAX_DIRS; i++) {
+                struct _gc_dir* dir = gc.dirs[i];
+                if (!dir) continue;
+                if (ev->mask & IN_Q_OVERFLOW) gc_evict(i);
+                else if (dir->wd != ev->wd) continue;
+                else if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF |
+                            IN_IGNORED | IN_UNMOUNT))
+                    gc_evict(i);
+                else if (ev->len && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+                    gc_insert(dir, ev->name,
+                        (ev->mask & IN_ISDIR)? DT_DIR: DT_UNKNOWN);
+                    gc.deltas++;
+                }
+                else if (ev->len && (ev->mask & (IN_DELETE | IN_MOVED_FROM))) {
+                    gc_delete(dir, ev->name);
+                    gc.deltas++;
+                }
+            }
+        }
+    }
+}
+
+
+/*
+ * qsort comparator for cached entries
+ */
+static int gc_entry_cmp(const void* a, const void* b)
+{
+    return strcmp(((const struct _gc_entry*) a)->name,
+                  ((const struct _gc_entry*) b)->name);
+}
+
+
+/*
+ * Find the cached listing for key, reading the directory on a miss
+ *
+ * Parameters:
+ *  key         The absolute directory path
+ *
+ * Returns:
+ *  struct _gc_dir*     The listing, or NULL if it cannot be cached
+ */
+static struct _gc_dir* gc_lookup(const char* key)
+{
+    int slot = -1;
+    for (int i = 0; i < GC_MAX_DIRS; i++) {
+        struct _gc_dir* dir = gc.dirs[i];
+        if (dir && !strcmp(dir->path, key)) {
+            gc.hits++;
+            dir->last_used = ++gc.clock;
+            return dir;
+        }
+        if (!dir) slot = i;
+    }
+    gc.misses++;
+
+    if (gc.ifd == -1 && (gc.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+        return NULL;
+
+    // make room by evicting the least recently used unpinned listing
+    if (slot == -1) {
+        for (int i = 0; i < GC_MAX_DIRS; i++) {
+            if (gc.dirs[i]->refs) continue;
+            if (slot == -1 || gc.dirs[i]->last_used < gc.dirs[slot]->last_used)
+                slot = i;
+        }
+        if (slot == -1) return NULL;
+        gc_evict(slot);
+    }
+
+    // watch before reading, so no change can slip in between; events for
+    // entries already read are applied idempotently
+    int wd = inotify_add_watch(gc.ifd, key, GC_WATCH_MASK);
+    if (wd == -1) return NULL;
+    DIR* d = opendir(key);
+    if (!d) {
+        int err = errno;
+        bool shared = false;
+        for (int i = 0; i < GC_MAX_DIRS; i++)
+            if (gc.dirs[i] && gc.dirs[i]->wd == wd) shared = true;
+        if (!shared) inotify_rm_watch(gc.ifd, wd);
+        errno = err;
+        return NULL;
+    }
+
+    struct _gc_dir* dir = calloc(1, sizeof(struct _gc_dir));
+    assert(dir);
+    dir->path = strdup(key);
+    dir->wd = wd;
+    dir->last_used = ++gc.clock;
+
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (dir->n == dir->cap) {
+            dir->cap = dir->cap? 2 * dir->cap: 16;
+            dir->entries = realloc(dir->entries,
+                dir->cap * sizeof(struct _gc_entry));
+            assert(dir->entries);
+        }
+        dir->entries[dir->n].name = strdup(ent->d_name);
+        dir->entries[dir->n++].type = ent->d_type;
+    }
+    closedir(d);
+
+    qsort(dir->entries, dir->n, sizeof(struct _gc_entry), gc_entry_cmp);
+
+    gc.dirs[slot] = dir;
+    return dir;
+}
+
+
+static void* gc_opendir(const char* path)
+{
+    struct _gc_handle* h = calloc(1, sizeof(struct _gc_handle));
+    assert(h);
+
+    char* key = gc_key(path);
+    if (key) h->dir = gc_lookup(key);
+    free(key);
+
+    if (h->dir) {
+        h->dir->refs++;
+        return h;
+    }
+
+    gc.uncached++;
+    if (!(h->real = opendir(path))) {
+        int err = errno;
+        free(h);
+        errno = err;
+        return NULL;
+    }
+    return h;
+}
+
+
+static struct dirent* gc_readdir(void* p)
+{
+    struct _gc_handle* h = (struct _gc_handle*) p;
+    if (h->real) return readdir(h->real);
+    if (h->pos == h->dir->n) return NULL;
+
+    struct _gc_entry* entry = &h->dir->entries[h->pos++];
+    h->ent.d_ino = 1;
+    h->ent.d_type = entry->type;
+    strncpy(h->ent.d_name, entry->name, sizeof(h->ent.d_name) - 1);
+    return &h->ent;
+}
+
+
+static void gc_closedir(void* p)
+{
+    struct _gc_handle* h = (struct _gc_handle*) p;
+    if (h->real) closedir(h->real);
+    else h->dir->refs--;
+    free(h);
+}
+
+
+/*
+ * Answer an lstat or stat from the cache when the parent directory is
+ * cached and the entry type is known: a missing entry fails with ENOENT,
+ * a present one reports only its file type. Anything else is passed on
+ * to the real call.
+ */
+static int gc_stat_common(const char* path, struct stat* st, bool follow)
+{
+    const char* slash = strrchr(path, '/');
+    const char* name = slash? slash + 1: path;
+    char* dirpath = slash? strndup(path, slash == path? 1: slash - path):
+                           strdup(".");
+    char* key = *name? gc_key(dirpath): NULL;
+    free(dirpath);
+
+    struct _gc_dir* dir = NULL;
+    for (int i = 0; key && i < GC_MAX_DIRS; i++)
+        if (gc.dirs[i] && !strcmp(gc.dirs[i]->path, key)) dir = gc.dirs[i];
+    free(key);
+
+    if (dir) {
+        bool found;
+        size_t i = gc_search(dir, name, &found);
+        unsigned char type = found? dir->entries[i].type: DT_UNKNOWN;
+        if (!found) {
+            errno = ENOENT;
+            return -1;
+        }
+        if (type != DT_UNKNOWN && !(follow && type == DT_LNK)) {
+            memset(st, 0, sizeof(struct stat));
+            st->st_mode = DTTOIF(type);
+            return 0;
+        }
+    }
+    return follow? stat(path, st): lstat(path, st);
+}
+
+static int gc_lstat(const char* path, struct stat* st)
+{   return gc_stat_common(path, st, false); }
+
+static int gc_stat(const char* path, struct stat* st)
+{   return gc_stat_common(path, st, true); }
+
+
+// Documented in .h file
+int GC_glob(const char* pattern, int flags, glob_t* pglob)
+{
+    gc_sync();
+
+    pglob->gl_opendir  = gc_opendir;
+    pglob->gl_readdir  = gc_readdir;
+    pglob->gl_closedir = gc_closedir;
+    pglob->gl_lstat    = gc_lstat;
+    pglob->gl_stat     = gc_stat;
+
+    return glob(pattern, flags | GLOB_ALTDIRFUNC, NULL, pglob);
+}
+
+
+// Documented in .h file
+void GC_chdir()
+{
+    free(gc.cwd);
+    gc.cwd = NULL;
+}
+
+
+// Documented in .h file
+void GC_flush()
+{
+    gc_sync();
+    for (int i = 0; i < GC_MAX_DIRS; i++)
+        if (gc.dirs[i]) gc_evict(i);
+}
+
+
+// Documented in .h file
+void GC_print_stats(FILE* out)
+{
+    gc_sync();
+
+    int ndirs = 0;
+    size_t nentries = 0;
+    for (int i = 0; i < GC_MAX_DIRS; i++) {
+        if (!gc.dirs[i]) continue;
+        ndirs++;
+        nentries += gc.dirs[i]->n;
+    }
+
+    fprintf(out, "globcache: %d directories, %zu entries cached\n",
+        ndirs, nentries);
+    fprintf(out, "  hits %lu, misses %lu, uncached %lu\n",
+        gc.hits, gc.misses, gc.uncached);
+    fprintf(out, "  deltas %lu, evictions %lu\n", gc.deltas, gc.evictions);
+}
@@ -0,0 +1,61 @@
+/*
+ * globcache.h
+ *
+ * Directory listing cache for glob expansion, kept up to date with
+ * inotify
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _GLOBCACHE_H_
+#define _GLOBCACHE_H_
+
+#include <stdio.h>
+#include <glob.h>
+
+/*
+ * A drop-in replacement for glob(3) that reads directories through the
+ * listing cache. The first glob over a directory reads it and places an
+ * inotify watch on it; later globs are served from memory. Before each
+ * call the pending inotify events are applied: created and deleted
+ * entries are patched into the cached listing, while a directory that
+ * is itself removed or renamed, or an event queue overflow, evicts the
+ * affected listings. Directories that cannot be watched are read
+ * directly every time.
+ *
+ * Parameters:
+ *  pattern     The pattern to expand
+ *  flags       The glob(3) flags; GLOB_ALTDIRFUNC is added internally
+ *  pglob       Return space for the results, released with globfree
+ *
+ * Returns:
+ *  int         The glob(3) return value
+ */
+int GC_glob(const char* pattern, int flags, glob_t* pglob);
+
+
+/*
+ * Tell the cache the shell's working directory has changed, so that
+ * relative directories are keyed correctly. Must be called after every
+ * successful chdir.
+ */
+void GC_chdir();
+
+
+/*
+ * Drop every cached listing and its inotify watch. Statistics are
+ * kept.
+ */
+void GC_flush();
+
+
+/*
+ * Print cache statistics, for the globcache builtin
+ *
+ * Parameters:
+ *  out         The stream to print to
+ */
+void GC_print_stats(FILE* out);
+
+#endif /* _GLOBCACHE_H_ */
@@ -0,0 +1,199 @@
+/*
+ * jobserver.c
+ *
+ * GNU make jobserver client and server
+ *
+ * Tokens are taken without blocking, so a caller can wait for one in
+ * poll alongside its children. An inherited pipe's read end is shared
+ * with make and its other children, so rather than setting O_NONBLOCK
+ * on it under their feet, the shell reopens it through /proc for a
+ * nonblocking description of its own.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "jobserver.h"
+
+#define JS_HELD_MAX     1024
+#define JS_FLAGS_MAX    4096
+
+static int read_fd = -1;        // the shell's own, nonblocking if possible
+static int write_fd = -1;
+static bool read_blocks = false;
+
+// tokens taken, so the same bytes go back: make uses them to signal
+static char held[JS_HELD_MAX];
+static int nheld = 0;
+
+// the pipe served to children, and MAKEFLAGS as it was before
+static int serving = 0;
+static int served[2] = {-1, -1};
+static char* saved_makeflags = NULL;
+
+
+
+/*
+ * Open a nonblocking description of a pipe's read end, falling back to
+ * a duplicate that blocks
+ */
+static int open_private(int fd)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    int priv = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    read_blocks = priv == -1;
+    if (priv == -1) priv = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    return priv;
+}
+
+
+/*
+ * The value of the last jobserver option in MAKEFLAGS, copied to buf
+ */
+static bool find_auth(const char* flags, char* buf, size_t buf_sz)
+{
+    const char* opts[] = {"--jobserver-auth=", "--jobserver-fds="};
+    bool found = false;
+    for (const char* p = flags; *p; ) {
+        p += strspn(p, " ");
+        size_t len = strcspn(p, " ");
+        for (int i = 0; i < 2; i++) {
+            size_t olen = strlen(opts[i]);
+            if (len > olen && !strncmp(p, opts[i], olen)) {
+                snprintf(buf, buf_sz, "%.*s", (int) (len - olen), p + olen);
+                found = true;
+            }
+        }
+        p += len;
+    }
+    return found;
+}
+
+
+// Documented in .h file
+bool JS_init()
+{
+    const char* flags = getenv("MAKEFLAGS");
+    char auth[JS_FLAGS_MAX];
+    if (!flags || !find_auth(flags, auth, sizeof(auth))) return false;
+
+    if (!strncmp(auth, "fifo:", 5)) {
+        int fd = open(auth + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1) return false;
+        read_fd = write_fd = fd;
+        return true;
+    }
+
+    // make only passes the fds to commands it knows to be recursive
+    int r, w;
+    if (sscanf(auth, "%d,%d", &r, &w) != 2 || r < 0 || w < 0 ||
+        fcntl(r, F_GETFD) == -1 || fcntl(w, F_GETFD) == -1)
+        return false;
+    read_fd = open_private(r);
+    if (read_fd == -1) return false;
+    write_fd = w;
+    return true;
+}
+
+
+// Documented in .h file
+bool JS_active()
+{   return read_fd != -1; }
+
+
+// Documented in .h file
+bool JS_serve(int jobs)
+{
+    if (JS_active()) return false;
+    if (jobs < 1) jobs = 1;
+
+    // children inherit the pipe, as they do from make
+    if (pipe(served) == -1) return false;
+    read_fd = open_private(served[0]);
+    if (read_fd == -1) {
+        close(served[0]);
+        close(served[1]);
+        served[0] = served[1] = -1;
+        return false;
+    }
+    write_fd = served[1];
+    for (int i = 1; i < jobs; i++)
+        if (write(write_fd, "+", 1) != 1) break;
+    serving = jobs;
+
+    const char* old = getenv("MAKEFLAGS");
+    saved_makeflags = old? strdup(old): NULL;
+    char flags[JS_FLAGS_MAX];
+    snprintf(flags, sizeof(flags), "%s -j%d --jobserver-auth=%d,%d",
+        old? old: "", jobs, served[0], served[1]);
+    setenv("MAKEFLAGS", flags, 1);
+    return true;
+}
+
+
+// Documented in .h file
+void JS_stop_serving()
+{
+    if (!serving) return;
+
+    close(read_fd);
+    close(served[0]);
+    close(served[1]);
+    read_fd = write_fd = -1;
+    served[0] = served[1] = -1;
+    serving = 0;
+    nheld = 0;
+
+    if (saved_makeflags) setenv("MAKEFLAGS", saved_makeflags, 1);
+    else unsetenv("MAKEFLAGS");
+    free(saved_makeflags);
+    saved_makeflags = NULL;
+}
+
+
+// Documented in .h file
+bool JS_try_acquire()
+{
+    if (read_fd == -1) return false;
+
+    // a blocking fd may still lose the token to another reader
+    // between poll and read; that wait is the best it can do
+    struct pollfd p = {read_fd, POLLIN, 0};
+    if (read_blocks && poll(&p, 1, 0) != 1) return false;
+
+    char c;
+    ssize_t n;
+    while ((n = read(read_fd, &c, 1)) == -1 && errno == EINTR);
+    if (n != 1) return false;
+    if (nheld < JS_HELD_MAX) held[nheld++] = c;
+    return true;
+}
+
+
+// Documented in .h file
+void JS_release()
+{
+    if (write_fd == -1) return;
+    char c = nheld? held[--nheld]: '+';
+    while (write(write_fd, &c, 1) == -1 && errno == EINTR);
+}
+
+
+// Documented in .h file
+int JS_poll_fd()
+{   return read_fd; }
+
+
+// Documented in .h file
+int JS_serving()
+{   return serving; }
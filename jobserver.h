@@ -0,0 +1,95 @@
+/*
+ * jobserver.h
+ *
+ * The GNU make jobserver protocol, so that parallel work started by the
+ * shell shares one concurrency budget with make and everything else in
+ * the build. Every process may run one job for free; each further job
+ * needs a token, a byte read from the jobserver, which is written back
+ * when the job finishes.
+ *
+ * As a client the shell finds the jobserver in MAKEFLAGS, as either a
+ * pair of inherited pipe fds or a named fifo. As a server, when there
+ * is none, it creates a pipe of tokens and advertises it in MAKEFLAGS
+ * for its children.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _JOBSERVER_H_
+#define _JOBSERVER_H_
+
+#include <stdbool.h>
+
+
+/*
+ * Join the jobserver described by MAKEFLAGS, if any. Its fds are only
+ * used if make actually passed them on.
+ *
+ * Returns:
+ *  bool        true if there is now a jobserver to draw tokens from
+ */
+bool JS_init();
+
+
+/*
+ * Whether there is a jobserver, joined or served
+ */
+bool JS_active();
+
+
+/*
+ * Serve jobs slots to the shell and its children, unless there is a
+ * jobserver already
+ *
+ * Parameters:
+ *  jobs        The total number of jobs that may run at once, counting
+ *              the free one
+ *
+ * Returns:
+ *  bool        true if a new jobserver was started, to be stopped with
+ *              JS_stop_serving
+ */
+bool JS_serve(int jobs);
+
+
+/*
+ * Stop serving, restoring MAKEFLAGS. Does nothing if the shell is a
+ * client rather than the server.
+ */
+void JS_stop_serving();
+
+
+/*
+ * Take a token without waiting
+ *
+ * Returns:
+ *  bool        true if a token was taken, to be given back with
+ *              JS_release; false if none is free or there is no
+ *              jobserver
+ */
+bool JS_try_acquire();
+
+
+/*
+ * Give back a token taken by JS_try_acquire
+ */
+void JS_release();
+
+
+/*
+ * An fd that polls readable when a token may be free
+ *
+ * Returns:
+ *  int         The fd, or -1 if there is no jobserver
+ */
+int JS_poll_fd();
+
+
+/*
+ * The jobs that may run at once under the jobserver this shell serves,
+ * or 0 if it serves none
+ */
+int JS_serving();
+
+#endif /* _JOBSERVER_H_ */
@@ -0,0 +1,317 @@
+/*
+ * limit.c
+ *
+ * The limit command
+ *
+ * The timeout waits on pidfds rather than a timer signal, so the shell
+ * sleeps in poll until either a stage exits or the deadline passes,
+ * and a stage is killed through its pidfd, never through a pid that may
+ * already have been reused.
+ *
+ * With a timeout, the stages share a process group led by the first, so
+ * whatever they start in the background dies with them. The group's id
+ * cannot be reused while a stage in it is still unreaped, which holds
+ * whenever the timeout fires. A shell in the terminal's foreground hands
+ * it to the group for the pipeline, as a shell with job control would,
+ * so stages reading the terminal are not stopped.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/pidfd.h>
+#include <sys/resource.h>
+
+#include "limit.h"
+#include "tokenize.h"
+#include "parse.h"
+#include "walk.h"
+#include "stats.h"
+#include "cmdlog.h"
+
+#define LIM_NRES        4
+#define LIM_LINE_MAX    512
+
+static const struct {
+    const char* opt;
+    const char* name;
+    int resource;
+} resources[LIM_NRES] = {
+    {"-c", "cpu", RLIMIT_CPU},
+    {"-m", "address space", RLIMIT_AS},
+    {"-n", "open files", RLIMIT_NOFILE},
+    {"-u", "processes", RLIMIT_NPROC},
+};
+
+struct _limits {
+    bool set[LIM_NRES];
+    rlim_t value[LIM_NRES];
+    double timeout;         // seconds, 0 for none
+};
+
+struct _watched {
+    pid_t pid;
+    int fd;                 // its pidfd, or -1
+};
+
+// the running limit command
+static bool active = false;
+static struct _limits limits;
+static uint64_t deadline = 0;
+static bool timed_out = false;
+static pid_t pgid = 0;          // the stages' group, 0 until the first
+static bool foreground = false; // the shell owns the terminal on stdin
+
+static struct _watched* watched = NULL;
+static int nwatched = 0;
+static int cap = 0;
+
+
+
+// Documented in .h file
+bool LIM_is_limit(CList tokens)
+{
+    Token tok = TOK_next(tokens);
+    return TOK_next_type(tokens) == TOK_WORD && !strcmp(tok.value, "limit");
+}
+
+
+/*
+ * Parse a size, with an optional K, M or G suffix
+ */
+static bool parse_size(const char* s, rlim_t* value)
+{
+    char* end;
+    errno = 0;
+    unsigned long long n = strtoull(s, &end, 10);
+    if (errno || end == s || *s == '-') return false;
+    int shift = 0;
+    if (*end == 'K' || *end == 'k') shift = 10;
+    else if (*end == 'M' || *end == 'm') shift = 20;
+    else if (*end == 'G' || *end == 'g') shift = 30;
+    if (shift) end++;
+    if (*end || n > (RLIM_INFINITY - 1) >> shift) return false;
+    *value = (rlim_t) n << shift;
+    return true;
+}
+
+
+/*
+ * Parse the options up to the pipeline
+ *
+ * Returns:
+ *  bool        false on a usage error
+ */
+static bool parse_options(CList tokens, struct _limits* lim)
+{
+    while (TOK_next_type(tokens) == TOK_WORD) {
+        const char* opt = TOK_next(tokens).value;
+        if (!strcmp(opt, "--")) {
+            TOK_consume(tokens);
+            return true;
+        }
+        if (*opt != '-') return true;
+
+        int r = -1;
+        for (int i = 0; i < LIM_NRES; i++)
+            if (!strcmp(opt, resources[i].opt)) r = i;
+        if (r == -1 && strcmp(opt, "-t")) return false;
+
+        TOK_consume(tokens);
+        if (TOK_next_type(tokens) != TOK_WORD) return false;
+        const char* arg = TOK_next(tokens).value;
+        if (r == -1) {
+            char* end;
+            lim->timeout = strtod(arg, &end);
+            if (end == arg || *end || !(lim->timeout > 0)) return false;
+        }
+        else {
+            if (!parse_size(arg, &lim->value[r])) return false;
+            lim->set[r] = true;
+        }
+        TOK_consume(tokens);
+    }
+    return true;
+}
+
+
+/*
+ * Render a limit command line, with its options as parsed, for the
+ * command log
+ */
+static void limit2str(const struct _limits* lim, AST pipeline, char* buf,
+    size_t buf_sz)
+{
+    size_t len = snprintf(buf, buf_sz, "limit");
+    if (lim->timeout && len < buf_sz)
+        len += snprintf(buf + len, buf_sz - len, " -t %g", lim->timeout);
+    for (int i = 0; i < LIM_NRES && len < buf_sz; i++)
+        if (lim->set[i])
+            len += snprintf(buf + len, buf_sz - len, " %s %llu",
+                resources[i].opt, (unsigned long long) lim->value[i]);
+    if (len + 1 < buf_sz) {
+        buf[len++] = ' ';
+        AST_pipeline2str(pipeline, buf + len, buf_sz - len);
+    }
+}
+
+
+/*
+ * Make group the terminal's foreground process group, from a process
+ * that may itself be in the background
+ */
+static void set_foreground(pid_t group)
+{
+    sigset_t ttou, saved;
+    sigemptyset(&ttou);
+    sigaddset(&ttou, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &ttou, &saved);
+    tcsetpgrp(STDIN_FILENO, group);
+    sigprocmask(SIG_SETMASK, &saved, NULL);
+}
+
+
+// Documented in .h file
+int LIM_limit(CList tokens, char* errmsg, size_t errmsg_sz)
+{
+    struct _limits lim = {{false}};
+    TOK_consume(tokens);    // limit
+    if (!parse_options(tokens, &lim) || TOK_next_type(tokens) == TOK_END) {
+        snprintf(errmsg, errmsg_sz, "usage: limit [-t SECONDS] [-c SECONDS] "
+            "[-m SIZE] [-n FILES] [-u PROCS] [--] pipeline");
+        return -1;
+    }
+
+    AST pipeline = Parse(tokens, errmsg, errmsg_sz);
+    if (!pipeline) return -1;
+
+    limits = lim;
+    active = true;
+    timed_out = false;
+    deadline = lim.timeout? ST_now() + (uint64_t) (lim.timeout * 1e9): 0;
+    pgid = 0;
+    foreground = deadline && isatty(STDIN_FILENO) &&
+        tcgetpgrp(STDIN_FILENO) == getpgrp();
+
+    if (LOG_enabled()) {
+        char line[LIM_LINE_MAX];
+        limit2str(&lim, pipeline, line, sizeof(line));
+        LOG_begin_line(line);
+    }
+    int status = AST_execute(pipeline);
+
+    // anything left watched was not reaped, and is not ours to kill
+    while (nwatched)
+        LIM_unwatch(watched[0].pid);
+    if (foreground && pgid) set_foreground(getpgrp());
+    active = false;
+    deadline = 0;
+    pgid = 0;
+    foreground = false;
+    AST_free(pipeline);
+
+    if (timed_out) {
+        fprintf(stderr, "limit: timed out after %gs\n", lim.timeout);
+        status = LIM_TIMED_OUT;
+    }
+    LOG_end(status);
+    return status;
+}
+
+
+// Documented in .h file
+bool LIM_active()
+{   return active; }
+
+
+// Documented in .h file
+void LIM_apply()
+{
+    if (!active) return;
+    if (deadline && setpgid(0, pgid) == 0 && foreground)
+        set_foreground(getpgrp());
+    for (int i = 0; i < LIM_NRES; i++) {
+        if (!limits.set[i]) continue;
+        struct rlimit rl;
+        if (getrlimit(resources[i].resource, &rl)) rl.rlim_max = RLIM_INFINITY;
+        rlim_t value = limits.value[i];
+        if (rl.rlim_max != RLIM_INFINITY && value > rl.rlim_max)
+            value = rl.rlim_max;
+        rl.rlim_cur = rl.rlim_max = value;
+        if (setrlimit(resources[i].resource, &rl)) {
+            fprintf(stderr, "limit: %s: %s\n", resources[i].name,
+                strerror(errno));
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+// Documented in .h file
+void LIM_watch(pid_t pid)
+{
+    if (!deadline) return;
+
+    // set here as well as in the child, whichever runs first
+    setpgid(pid, pgid);
+    if (!pgid) {
+        pgid = pid;
+        if (foreground) set_foreground(pgid);
+    }
+
+    if (nwatched == cap) {
+        cap = cap? 2 * cap: 8;
+        watched = realloc(watched, cap * sizeof(struct _watched));
+        assert(watched);
+    }
+    watched[nwatched++] = (struct _watched) {pid, pidfd_open(pid, 0)};
+}
+
+
+// Documented in .h file
+void LIM_unwatch(pid_t pid)
+{
+    for (int i = 0; i < nwatched; i++) {
+        if (watched[i].pid != pid) continue;
+        if (watched[i].fd != -1) close(watched[i].fd);
+        watched[i] = watched[--nwatched];
+        return;
+    }
+}
+
+
+// Documented in .h file
+void LIM_wait()
+{
+    if (!nwatched || timed_out) return;
+
+    struct pollfd fds[nwatched];
+    for (int i = 0; i < nwatched; i++)
+        fds[i] = (struct pollfd) {watched[i].fd, POLLIN, 0};
+
+    for (;;) {
+        uint64_t now = ST_now();
+        if (now >= deadline) break;
+        int ms = (deadline - now + 999999) / 1000000;
+        int n = poll(fds, nwatched, ms);
+        if (n > 0) return;
+        if (n == -1 && errno != EINTR) return;
+    }
+
+    timed_out = true;
+    if (pgid) kill(-pgid, SIGKILL);
+    for (int i = 0; i < nwatched; i++) {
+        if (watched[i].fd != -1)
+            pidfd_send_signal(watched[i].fd, SIGKILL, NULL, 0);
+        else kill(watched[i].pid, SIGKILL);
+    }
+}
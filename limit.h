@@ -0,0 +1,107 @@
+/*
+ * limit.h
+ *
+ * The limit command: run a pipeline with resource limits on every stage
+ *
+ *   limit [-t SECONDS] [-c SECONDS] [-m SIZE] [-n FILES] [-u PROCS] [--]
+ *         pipeline
+ *
+ *   -t   wall clock time for the whole pipeline, which may be fractional;
+ *        the shell kills the stages still running when it is up, with
+ *        everything they started
+ *   -c   CPU time of each stage (RLIMIT_CPU)
+ *   -m   address space of each stage (RLIMIT_AS), in bytes or with a K,
+ *        M or G suffix
+ *   -n   open files of each stage (RLIMIT_NOFILE)
+ *   -u   processes of the stage's user (RLIMIT_NPROC)
+ *
+ * The rlimits are set soft and hard in each child before it execs, so
+ * the command cannot raise them again; a limit above the shell's own
+ * hard limit is lowered to it. Builtins run in the shell and are not
+ * limited. Like parallel, limit is recognized before parsing, since it
+ * takes a whole pipeline; as a parallel template it limits each job.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _LIMIT_H_
+#define _LIMIT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "clist.h"
+
+// the status of a pipeline that ran out of time, as timeout(1) uses
+#define LIM_TIMED_OUT       124
+
+
+/*
+ * Whether a tokenized line is a limit command
+ *
+ * Parameters:
+ *  tokens      The tokens of the line
+ *
+ * Returns:
+ *  bool        true if its first token is the unquoted word "limit"
+ */
+bool LIM_is_limit(CList tokens);
+
+
+/*
+ * Run a limit command
+ *
+ * Parameters:
+ *  tokens      The tokens of the line, consumed
+ *  errmsg      Return space for an error message
+ *  errmsg_sz   The size of errmsg
+ *
+ * Returns:
+ *  int         The pipeline's status, LIM_TIMED_OUT if it ran out of
+ *              time, or -1 on a usage or parse error, described in errmsg
+ */
+int LIM_limit(CList tokens, char* errmsg, size_t errmsg_sz);
+
+
+/*
+ * Whether a limit command is running
+ */
+bool LIM_active();
+
+
+/*
+ * Apply the running limit command's rlimits, and with a timeout move
+ * into the stages' process group, in a stage's child before exec. A
+ * stage whose limits cannot be set exits rather than run without them.
+ * Does nothing outside a limit command.
+ */
+void LIM_apply();
+
+
+/*
+ * Watch a stage for the running limit command's timeout. Does nothing
+ * outside a limit command, or without -t.
+ *
+ * Parameters:
+ *  pid         The stage's process
+ */
+void LIM_watch(pid_t pid);
+
+
+/*
+ * Stop watching a stage, once it has been reaped
+ */
+void LIM_unwatch(pid_t pid);
+
+
+/*
+ * Wait until a watched stage has exited and may be reaped without
+ * blocking, or the timeout is up, in which case every watched stage and
+ * the rest of their process group is killed. Returns at once if nothing
+ * is watched.
+ */
+void LIM_wait();
+
+#endif /* _LIMIT_H_ */
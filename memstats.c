@@ -0,0 +1,159 @@
+/*
+ * memstats.c
+ *
+ * Counting allocator for the command line path
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "memstats.h"
+
+static MemStats total;
+
+// total as it was when the current command began, and the most bytes
+// live since
+static MemStats base;
+static int64_t command_peak;
+
+static MemStats last;
+
+
+
+#ifndef MEM_NO_STATS
+
+/*
+ * Count a block coming into or going out of use
+ */
+static void count_live(int64_t delta)
+{
+    total.live += delta;
+    if (total.live > total.peak) total.peak = total.live;
+    if (total.live > command_peak) command_peak = total.live;
+}
+
+
+static void* count_alloc(void* ptr)
+{
+    if (!ptr) return NULL;
+    size_t size = malloc_usable_size(ptr);
+    total.allocs++;
+    total.bytes += size;
+    count_live(size);
+    return ptr;
+}
+
+
+// Documented in .h file
+void* MEM_malloc(size_t size)
+{   return count_alloc(malloc(size)); }
+
+
+// Documented in .h file
+void* MEM_calloc(size_t nmemb, size_t size)
+{   return count_alloc(calloc(nmemb, size)); }
+
+
+// Documented in .h file
+char* MEM_strdup(const char* s)
+{   return count_alloc(strdup(s)); }
+
+
+// Documented in .h file
+char* MEM_strndup(const char* s, size_t n)
+{   return count_alloc(strndup(s, n)); }
+
+
+// Documented in .h file
+void* MEM_realloc(void* ptr, size_t size)
+{
+    if (!ptr) return MEM_malloc(size);
+
+    size_t old_size = malloc_usable_size(ptr);
+    void* new = realloc(ptr, size);
+    if (!new) return NULL;
+
+    size_t new_size = malloc_usable_size(new);
+    total.reallocs++;
+    total.bytes += new_size;
+    count_live((int64_t) new_size - (int64_t) old_size);
+    return new;
+}
+
+
+// Documented in .h file
+void MEM_free(void* ptr)
+{
+    if (!ptr) return;
+    total.frees++;
+    count_live(-(int64_t) malloc_usable_size(ptr));
+    free(ptr);
+}
+
+#endif /* MEM_NO_STATS */
+
+
+// Documented in .h file
+void MEM_begin_command()
+{
+    base = total;
+    command_peak = total.live;
+}
+
+
+// Documented in .h file
+void MEM_end_command()
+{   last = MEM_command(); }
+
+
+// Documented in .h file
+MemStats MEM_command()
+{
+    return (MemStats) {
+        .allocs = total.allocs - base.allocs,
+        .reallocs = total.reallocs - base.reallocs,
+        .frees = total.frees - base.frees,
+        .bytes = total.bytes - base.bytes,
+        .live = total.live - base.live,
+        .peak = command_peak - base.live,
+    };
+}
+
+
+// Documented in .h file
+MemStats MEM_last_command()
+{   return last; }
+
+
+// Documented in .h file
+MemStats MEM_total()
+{   return total; }
+
+
+static void print_stats(FILE* out, const char* label, MemStats s)
+{
+    fprintf(out, "%-14s %10lu %10lu %10lu %12lu %12ld %12ld\n", label,
+        (unsigned long) s.allocs, (unsigned long) s.reallocs,
+        (unsigned long) s.frees, (unsigned long) s.bytes,
+        (long) s.live, (long) s.peak);
+}
+
+
+// Documented in .h file
+void MEM_print(FILE* out)
+{
+#ifdef MEM_NO_STATS
+    fprintf(out, "memstats: not counted in this build\n");
+    return;
+#endif
+    fprintf(out, "%-14s %10s %10s %10s %12s %12s %12s\n", "",
+        "allocs", "reallocs", "frees", "bytes", "live", "peak");
+    print_stats(out, "last command", last);
+    print_stats(out, "total", total);
+}
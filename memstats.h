@@ -0,0 +1,103 @@
+/*
+ * memstats.h
+ *
+ * Counting allocator for the command line path: tokenize.c, parse.c,
+ * pipeline.c, the CList implementations and the programs program.c
+ * compiles and runs allocate through these wrappers, which count
+ * allocations, frees and bytes in total and for each command line,
+ * along with the peak bytes a command had live.
+ * Build with -DMEM_NO_STATS to make them plain libc calls.
+ *
+ * The counters are not atomic: the wrapped modules only run on the
+ * shell's thread.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _MEMSTATS_H_
+#define _MEMSTATS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t allocs;        // successful malloc, calloc, strdup and strndup
+    uint64_t reallocs;
+    uint64_t frees;         // of non-NULL pointers
+    uint64_t bytes;         // allocated, counting each realloc's new size
+    int64_t live;           // bytes allocated and not yet freed
+    int64_t peak;           // the most bytes live at once
+} MemStats;
+
+#ifdef MEM_NO_STATS
+
+#define MEM_malloc      malloc
+#define MEM_calloc      calloc
+#define MEM_realloc     realloc
+#define MEM_strdup      strdup
+#define MEM_strndup     strndup
+#define MEM_free        free
+
+#else
+
+/*
+ * The libc allocation functions, counted. Sizes are those of the blocks
+ * the allocator actually hands out, from malloc_usable_size.
+ */
+void* MEM_malloc(size_t size);
+void* MEM_calloc(size_t nmemb, size_t size);
+void* MEM_realloc(void* ptr, size_t size);
+char* MEM_strdup(const char* s);
+char* MEM_strndup(const char* s, size_t n);
+void MEM_free(void* ptr);
+
+#endif /* MEM_NO_STATS */
+
+
+/*
+ * Start counting a new command line
+ */
+void MEM_begin_command();
+
+
+/*
+ * Finish counting the current command line, keeping its counts as those
+ * of the last command
+ */
+void MEM_end_command();
+
+
+/*
+ * The counts of the current command line so far. live is the change
+ * since the command began, and peak the most live bytes above what was
+ * live when it began.
+ */
+MemStats MEM_command();
+
+
+/*
+ * The counts of the last command line to finish, in the same form as
+ * MEM_command
+ */
+MemStats MEM_last_command();
+
+
+/*
+ * The counts since the shell started
+ */
+MemStats MEM_total();
+
+
+/*
+ * Print the counts of the last command line and the totals, for the
+ * memstats builtin
+ *
+ * Parameters:
+ *  out         The stream to print to
+ */
+void MEM_print(FILE* out);
+
+#endif /* _MEMSTATS_H_ */
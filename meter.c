@@ -0,0 +1,249 @@
+/*
+ * meter.c
+ *
+ * Pipe metering with a splice relay per pipeline edge
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "meter.h"
+#include "stats.h"
+
+#define RELAY_CHUNK     (1 << 16)
+#define NAME_MAX_LEN    32
+#define LIVE_INTERVAL   200000      // us between progress lines
+
+struct _edge {
+    pthread_t thread;
+    int in_fd;                      // read end of the writer's pipe
+    int out_fd;                     // write end of the reader's pipe
+    char from[NAME_MAX_LEN];
+    char to[NAME_MAX_LEN];
+
+    // written by the relay, read by the progress thread and MT_finish
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t read_wait;     // ns waiting on the writer
+    atomic_uint_fast64_t write_wait;    // ns waiting on the reader
+    uint64_t start, end;
+};
+
+// edges past this many are left as plain pipes
+#define MAX_EDGES       ST_MAX_STAGES
+
+struct _meter {
+    struct _edge* edges[MAX_EDGES];
+    atomic_int nedges;              // published after the edge is filled in
+
+    pthread_t progress;
+    bool has_progress;
+    atomic_bool done;
+};
+
+static MeterMode mode = MT_OFF;
+
+
+// Documented in .h file
+void MT_set_mode(MeterMode m)
+{   mode = m; }
+
+
+// Documented in .h file
+MeterMode MT_mode()
+{   return mode; }
+
+
+/*
+ * Wait for fd to become ready for events, returning the ns spent
+ */
+static uint64_t wait_for(int fd, short events, short* revents)
+{
+    struct pollfd p = {fd, events, 0};
+    uint64_t start = ST_now();
+    while (poll(&p, 1, -1) == -1 && errno == EINTR);
+    *revents = p.revents;
+    return ST_now() - start;
+}
+
+
+/*
+ * Relay thread: splice from the writer's pipe to the reader's until the
+ * writer closes its end or the reader goes away
+ */
+static void* relay(void* arg)
+{
+    struct _edge* e = arg;
+
+    // a reader that exits early must not take the shell down with SIGPIPE;
+    // blocked here, it surfaces as EPIPE from splice instead
+    sigset_t pipe_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, NULL);
+
+    for (;;) {
+        ssize_t n = splice(e->in_fd, NULL, e->out_fd, NULL, RELAY_CHUNK,
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            e->bytes += n;
+            continue;
+        }
+        if (n == 0) break;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) break;
+
+        // either there is nothing to read, or no room to write
+        short revents;
+        struct pollfd in = {e->in_fd, POLLIN, 0};
+        if (poll(&in, 1, 0) == 0) {
+            e->read_wait += wait_for(e->in_fd, POLLIN, &revents);
+            continue;
+        }
+        e->write_wait += wait_for(e->out_fd, POLLOUT, &revents);
+        if (revents & POLLERR) break;
+    }
+
+    e->end = ST_now();
+    close(e->in_fd);
+    close(e->out_fd);
+    return NULL;
+}
+
+
+/*
+ * Format a byte count or rate with a binary unit
+ */
+static const char* human(double n, char* buf, size_t buf_sz)
+{
+    const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    int u = 0;
+    while (n >= 1024 && u < 4) {
+        n /= 1024;
+        u++;
+    }
+    snprintf(buf, buf_sz, u? "%.1f%s": "%.0f%s", n, units[u]);
+    return buf;
+}
+
+
+/*
+ * Progress thread for MT_LIVE: one status line on stderr, redrawn in place
+ */
+static void* progress(void* arg)
+{
+    Meter meter = arg;
+    while (!meter->done) {
+        usleep(LIVE_INTERVAL);
+        if (meter->done) break;
+
+        uint64_t now = ST_now();
+        fprintf(stderr, "\r\033[K");
+        for (int i = 0; i < meter->nedges; i++) {
+            struct _edge* e = meter->edges[i];
+            char bytes[16], rate[16];
+            double secs = (now - e->start) / 1e9;
+            fprintf(stderr, "%s%s->%s %s %s/s", i? "  ": "", e->from, e->to,
+                human(e->bytes, bytes, sizeof(bytes)),
+                human(secs > 0? e->bytes / secs: 0, rate, sizeof(rate)));
+        }
+        fflush(stderr);
+    }
+    return NULL;
+}
+
+
+// Documented in .h file
+Meter MT_new()
+{
+    Meter meter = calloc(1, sizeof(struct _meter));
+    if (!meter) return NULL;
+    atomic_init(&meter->nedges, 0);
+    atomic_init(&meter->done, false);
+    return meter;
+}
+
+
+// Documented in .h file
+int MT_pipe(Meter meter, int fds[2], const char* from, const char* to)
+{
+    if (pipe2(fds, O_CLOEXEC) == -1) return -1;
+    if (!meter) return 0;
+
+    // the writer gets fds[1] and the reader a fresh pipe's read end; the
+    // relay sits between fds[0] and that pipe's write end
+    int out[2];
+    if (meter->nedges == MAX_EDGES) return 0;
+    struct _edge* e = calloc(1, sizeof(struct _edge));
+    if (!e) return 0;
+    if (pipe2(out, O_CLOEXEC) == -1) {
+        free(e);
+        return 0;
+    }
+
+    e->in_fd = fds[0];
+    e->out_fd = out[1];
+    snprintf(e->from, sizeof(e->from), "%s", from? from: "?");
+    snprintf(e->to, sizeof(e->to), "%s", to? to: "?");
+    atomic_init(&e->bytes, 0);
+    atomic_init(&e->read_wait, 0);
+    atomic_init(&e->write_wait, 0);
+    e->start = ST_now();
+    if (pthread_create(&e->thread, NULL, relay, e)) {
+        close(out[0]);
+        close(out[1]);
+        free(e);
+        return 0;
+    }
+    meter->edges[meter->nedges] = e;
+    meter->nedges++;
+    fds[0] = out[0];
+
+    if (mode == MT_LIVE && !meter->has_progress)
+        meter->has_progress = !pthread_create(&meter->progress, NULL,
+            progress, meter);
+    return 0;
+}
+
+
+// Documented in .h file
+void MT_finish(Meter meter, FILE* out)
+{
+    if (!meter) return;
+
+    for (int i = 0; i < meter->nedges; i++)
+        pthread_join(meter->edges[i]->thread, NULL);
+    meter->done = true;
+    if (meter->has_progress) {
+        pthread_join(meter->progress, NULL);
+        fprintf(stderr, "\r\033[K");
+    }
+
+    for (int i = 0; i < meter->nedges; i++) {
+        struct _edge* e = meter->edges[i];
+        uint64_t elapsed = e->end - e->start;
+        double secs = elapsed / 1e9;
+        char bytes[16], rate[16];
+        fprintf(out, "meter: %s -> %s: %s (%lu bytes) in %.3fms, %s/s, "
+            "starved %.1f%%, backpressure %.1f%%\n", e->from, e->to,
+            human(e->bytes, bytes, sizeof(bytes)), (unsigned long) e->bytes,
+            secs * 1e3, human(secs > 0? e->bytes / secs: 0, rate, sizeof(rate)),
+            elapsed? 100.0 * e->read_wait / elapsed: 0,
+            elapsed? 100.0 * e->write_wait / elapsed: 0);
+        free(e);
+    }
+    free(meter);
+}
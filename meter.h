@@ -0,0 +1,76 @@
+/*
+ * meter.h
+ *
+ * Pipe metering: in metered mode, each pipe of a pipeline is replaced by
+ * two, with a relay thread in the shell splicing from one to the other.
+ * The relay counts the bytes that cross the edge and the time it spends
+ * waiting on each side: waiting for input means the writer is the slow
+ * stage, waiting for output means the reader is applying backpressure.
+ * With the meter off, pipes are plain pipes and nothing is copied.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _METER_H_
+#define _METER_H_
+
+#include <stdio.h>
+
+typedef enum {
+    MT_OFF,
+    MT_ON,          // report each edge when the pipeline finishes
+    MT_LIVE         // and show progress on stderr while it runs
+} MeterMode;
+
+typedef struct _meter* Meter;
+
+
+/*
+ * Set the metering mode, for the meter builtin
+ */
+void MT_set_mode(MeterMode mode);
+
+
+/*
+ * The metering mode
+ */
+MeterMode MT_mode();
+
+
+/*
+ * Create a meter for the pipes of one pipeline
+ *
+ * Returns:
+ *  Meter       The new meter, released by MT_finish
+ */
+Meter MT_new();
+
+
+/*
+ * Create a metered pipe: like pipe2(fds, O_CLOEXEC), but with a relay
+ * thread between the two ends. Falls back to a plain pipe if the thread
+ * cannot be started.
+ *
+ * Parameters:
+ *  meter       The meter
+ *  fds         Return space for the read and write ends
+ *  from, to    The commands either side, for the report
+ *
+ * Returns:
+ *  int         0, or -1 with errno set if no pipe could be created
+ */
+int MT_pipe(Meter meter, int fds[2], const char* from, const char* to);
+
+
+/*
+ * Wait for every relay to drain, which they do once the commands either
+ * side have exited, print a line per edge, and free the meter
+ *
+ * Parameters:
+ *  meter       The meter
+ *  out         The stream to print the report to
+ */
+void MT_finish(Meter meter, FILE* out);
+
+#endif /* _METER_H_ */
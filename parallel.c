@@ -0,0 +1,717 @@
+/*
+ * parallel.c
+ *
+ * The parallel command
+ *
+ * Jobs are handed out from a single queue in input order: whenever one
+ * finishes, the next input starts, so the pool stays full however
+ * uneven the jobs are. Each job's stdout is a pipe back to the shell,
+ * which polls them all; output is only ever written a complete line at
+ * a time, or held per job until its turn with -k. Holding it in memory
+ * means a finished job never waits for an earlier one to be printed.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <glob.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "parallel.h"
+#include "tokenize.h"
+#include "parse.h"
+#include "globcache.h"
+#include "brace.h"
+#include "walk.h"
+#include "jobserver.h"
+#include "limit.h"
+#include "cmdlog.h"
+
+#define PAR_PLACEHOLDER     "{}"
+#define PAR_READ_BYTES      65536
+#define PAR_LINE_MAX        512
+
+struct _inputs {
+    char** items;
+    int n;
+    int cap;
+};
+
+struct _job {
+    pid_t pid;
+    int fd;                 // read end of its stdout, -1 once at EOF
+    char* out;              // output not yet written
+    size_t len;
+    size_t cap;
+    bool done;              // exited and its output all read
+    bool token;             // holds a jobserver token
+    int status;
+};
+
+struct _options {
+    int jobs;
+    bool keep_order;
+    const char* input_file;
+};
+
+// State for find_word, which CL_foreach walks over a line
+struct _find {
+    int pos;                // the command's word, or -1 while not found
+    bool command_start;     // whether the next token starts a command
+};
+
+// State for render_token, which CL_foreach walks over a line
+struct _render {
+    char* buf;
+    size_t size;
+    size_t len;
+};
+
+
+
+static void find_word(int pos, Token tok, void* cb_data)
+{
+    struct _find* find = cb_data;
+    if (find->pos == -1 && find->command_start && tok.type == TOK_WORD &&
+        !strcmp(tok.value, "parallel")) find->pos = pos;
+    find->command_start = tok.type == TOK_PIPE;
+}
+
+
+/*
+ * Find the parallel command of a line: its first word, or the first
+ * command after a pipe
+ *
+ * Returns:
+ *  int         The position of the word "parallel", or -1 if none
+ */
+static int find_parallel(CList tokens)
+{
+    struct _find find = {-1, true};
+    CL_foreach(tokens, find_word, &find);
+    return find.pos;
+}
+
+
+// Documented in .h file
+bool PAR_is_parallel(CList tokens)
+{   return find_parallel(tokens) != -1; }
+
+
+static void inputs_add(struct _inputs* in, const char* s)
+{
+    if (in->n == in->cap) {
+        in->cap = in->cap? 2 * in->cap: 64;
+        in->items = realloc(in->items, in->cap * sizeof(char*));
+        assert(in->items);
+    }
+    in->items[in->n] = strdup(s);
+    assert(in->items[in->n]);
+    in->n++;
+}
+
+
+static void inputs_free(struct _inputs* in)
+{
+    for (int i = 0; i < in->n; i++)
+        free(in->items[i]);
+    free(in->items);
+}
+
+
+/*
+ * Add the matches of one word, or the word itself if it matches nothing
+ */
+static void inputs_glob(struct _inputs* in, const char* word)
+{
+    if (WALK_is_globstar(word)) {
+        size_t count;
+        char** paths = WALK_glob(word, WALK_SORT, 0, &count);
+        for (size_t i = 0; i < count; i++)
+            inputs_add(in, paths[i]);
+        WALK_free(paths);
+        if (count) return;
+    }
+    if (!strpbrk(word, "*?[~")) {
+        inputs_add(in, word);
+        return;
+    }
+
+    glob_t pglob;
+    if (GC_glob(word, GLOB_TILDE_CHECK | GLOB_NOCHECK, &pglob))
+        inputs_add(in, word);
+    else
+        for (size_t i = 0; i < pglob.gl_pathc; i++)
+            inputs_add(in, pglob.gl_pathv[i]);
+    globfree(&pglob);
+}
+
+
+/*
+ * Add the inputs given by a word after :::, expanded as an argument of
+ * a command would be
+ */
+static void inputs_word(struct _inputs* in, Token tok)
+{
+    if (tok.type == TOK_QUOTED_WORD) {
+        inputs_add(in, tok.value);
+        return;
+    }
+
+    Brace br = BR_new(tok.value);
+    if (!br) {
+        inputs_glob(in, tok.value);
+        return;
+    }
+    for (const char* gen; (gen = BR_next(br)); )
+        inputs_glob(in, gen);
+    BR_free(br);
+}
+
+
+static void render_token(int pos, Token tok, void* cb_data)
+{
+    struct _render* r = cb_data;
+    if (r->len >= r->size) return;
+    const char* s = tok.value;
+    if (tok.type == TOK_PIPE) s = "|";
+    else if (tok.type == TOK_LESSTHAN) s = "<";
+    else if (tok.type == TOK_GREATERTHAN) s = ">";
+    const char* quote = tok.type == TOK_QUOTED_WORD? "\"": "";
+    r->len += snprintf(r->buf + r->len, r->size - r->len, "%s%s%s%s",
+        pos? " ": "", quote, s, quote);
+}
+
+
+/*
+ * Render the tokens of a line as text, for the command log
+ */
+static void tokens2str(CList tokens, char* buf, size_t buf_sz)
+{
+    struct _render r = {buf, buf_sz, 0};
+    buf[0] = 0;
+    CL_foreach(tokens, render_token, &r);
+}
+
+
+/*
+ * Add the lines of a stream
+ */
+static void inputs_lines(struct _inputs* in, FILE* fp)
+{
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, fp)) != -1) {
+        if (len && line[len - 1] == '\n') line[--len] = 0;
+        if (len) inputs_add(in, line);
+    }
+    free(line);
+}
+
+
+/*
+ * Add the lines of an fd, which is left open
+ *
+ * Returns:
+ *  bool        false if the fd could not be read
+ */
+static bool inputs_fd(struct _inputs* in, int fd)
+{
+    int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    FILE* fp = copy == -1? NULL: fdopen(copy, "r");
+    if (!fp) {
+        if (copy != -1) close(copy);
+        return false;
+    }
+    inputs_lines(in, fp);
+    fclose(fp);
+    return true;
+}
+
+
+/*
+ * Run the pipeline before parallel in a child, with its stdout piped
+ * back, and take its lines as inputs
+ */
+static void inputs_producer(struct _inputs* in, AST producer)
+{
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
+        perror("parallel");
+        return;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[1]);
+        int status = AST_execute(producer);
+        fflush(stdout);
+        _exit(status);
+    }
+    close(pipefd[1]);
+    if (pid == -1) perror("parallel");
+    else inputs_fd(in, pipefd[0]);
+    close(pipefd[0]);
+    if (pid != -1)
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+}
+
+
+/*
+ * Parse the options up to the template
+ *
+ * Returns:
+ *  bool        false on a usage error
+ */
+static bool parse_options(CList tokens, struct _options* opts)
+{
+    while (TOK_next_type(tokens) == TOK_WORD) {
+        const char* opt = TOK_next(tokens).value;
+        if (!strcmp(opt, "--")) {
+            TOK_consume(tokens);
+            return true;
+        }
+        if (!strcmp(opt, "-k")) {
+            opts->keep_order = true;
+            TOK_consume(tokens);
+        }
+        else if (!strcmp(opt, "-j")) {
+            TOK_consume(tokens);
+            if (TOK_next_type(tokens) != TOK_WORD) return false;
+            char* end;
+            errno = 0;
+            long n = strtol(TOK_next(tokens).value, &end, 10);
+            bool ok = !errno && !*end && n >= 1 && n <= PAR_MAX_JOBS;
+            TOK_consume(tokens);
+            if (!ok) return false;
+            opts->jobs = n;
+        }
+        else if (!strcmp(opt, "-a")) {
+            TOK_consume(tokens);
+            if (TOK_next_type(tokens) != TOK_WORD &&
+                TOK_next_type(tokens) != TOK_QUOTED_WORD) return false;
+            opts->input_file = strdup(TOK_next(tokens).value);
+            TOK_consume(tokens);
+        }
+        else if (*opt == '-') return false;
+        else return true;
+    }
+    return true;
+}
+
+
+/*
+ * A copy of a token, with its own value
+ */
+static Token copy_token(Token tok)
+{
+    if (tok.type == TOK_WORD || tok.type == TOK_QUOTED_WORD)
+        return TOK_new(tok.type, tok.value);
+    return (Token) {tok.type};
+}
+
+
+/*
+ * Copy a word with every placeholder replaced by input
+ */
+static char* substitute(const char* word, const char* input)
+{
+    size_t plen = strlen(PAR_PLACEHOLDER);
+    size_t n = 0;
+    for (const char* p = word; (p = strstr(p, PAR_PLACEHOLDER)); p += plen)
+        n++;
+
+    char* result = malloc(strlen(word) + n * strlen(input) + 1);
+    assert(result);
+    char* r = result;
+    for (const char* p = word; *p; ) {
+        if (!strncmp(p, PAR_PLACEHOLDER, plen)) {
+            r = stpcpy(r, input);
+            p += plen;
+        }
+        else *r++ = *p++;
+    }
+    *r = 0;
+    return result;
+}
+
+
+/*
+ * Whether any word of the template has a placeholder
+ */
+static bool has_placeholder(CList template)
+{
+    for (int i = 0; i < CL_length(template); i++) {
+        Token tok = CL_nth(template, i);
+        if ((tok.type == TOK_WORD || tok.type == TOK_QUOTED_WORD) &&
+            strstr(tok.value, PAR_PLACEHOLDER)) return true;
+    }
+    return false;
+}
+
+
+/*
+ * The tokens of one job. Words given an input become quoted, so that a
+ * file name is never globbed again.
+ */
+static CList instantiate(CList template, bool placeholder, const char* input)
+{
+    CList tokens = CL_new();
+    bool appended = placeholder;
+    for (int i = 0; i < CL_length(template); i++) {
+        Token tok = CL_nth(template, i);
+        bool word = tok.type == TOK_WORD || tok.type == TOK_QUOTED_WORD;
+
+        // no placeholder: the input ends the first command
+        if (!appended && !word) {
+            CL_append(tokens, TOK_new(TOK_QUOTED_WORD, input));
+            appended = true;
+        }
+        if (word && strstr(tok.value, PAR_PLACEHOLDER)) {
+            char* value = substitute(tok.value, input);
+            CL_append(tokens, TOK_new(TOK_QUOTED_WORD, value));
+            free(value);
+        }
+        else CL_append(tokens, copy_token(tok));
+    }
+    if (!appended) CL_append(tokens, TOK_new(TOK_QUOTED_WORD, input));
+    return tokens;
+}
+
+
+/*
+ * Child side of a job: run its pipeline and exit with its status
+ */
+static void job_run(CList template, bool placeholder, const char* input,
+    int out_fd)
+{
+    char errmsg[256];
+    int devnull = open("/dev/null", O_RDONLY);
+    if (devnull != -1) {
+        dup2(devnull, STDIN_FILENO);
+        close(devnull);
+    }
+    dup2(out_fd, STDOUT_FILENO);
+    close(out_fd);
+
+    CList tokens = instantiate(template, placeholder, input);
+    AST pipeline = NULL;
+    int status = -1;
+    if (LIM_is_limit(tokens)) status = LIM_limit(tokens, errmsg, sizeof(errmsg));
+    else if ((pipeline = Parse(tokens, errmsg, sizeof(errmsg))))
+        status = AST_execute(pipeline);
+    if (status == -1) {
+        fprintf(stderr, "parallel: %s: %s\n", input, errmsg);
+        _exit(2);
+    }
+    fflush(stdout);
+    _exit(status);
+}
+
+
+static void write_all(const char* buf, size_t len)
+{
+    while (len) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return;
+        buf += n;
+        len -= n;
+    }
+}
+
+
+/*
+ * Read what a job has written. Without -k, complete lines are passed on
+ * at once and only a partial line is kept.
+ *
+ * Returns:
+ *  bool        false once the job has closed its output
+ */
+static bool job_read(struct _job* job, bool keep_order)
+{
+    if (job->cap - job->len < PAR_READ_BYTES) {
+        job->cap = job->len + 2 * PAR_READ_BYTES;
+        job->out = realloc(job->out, job->cap);
+        assert(job->out);
+    }
+    ssize_t n = read(job->fd, job->out + job->len, PAR_READ_BYTES);
+    if (n == -1 && errno == EINTR) return true;
+    if (n <= 0) return false;
+    job->len += n;
+    if (keep_order) return true;
+
+    char* last = memrchr(job->out, '\n', job->len);
+    if (last) {
+        size_t lines = last + 1 - job->out;
+        write_all(job->out, lines);
+        memmove(job->out, job->out + lines, job->len - lines);
+        job->len -= lines;
+    }
+    return true;
+}
+
+
+/*
+ * Write whatever a finished job left, freeing its buffer
+ */
+static void job_flush(struct _job* job)
+{
+    write_all(job->out, job->len);
+    free(job->out);
+    job->out = NULL;
+    job->len = job->cap = 0;
+}
+
+
+/*
+ * Run every job, at most opts->jobs at a time
+ *
+ * Returns:
+ *  int         The number of jobs that failed
+ */
+static int run_jobs(CList template, struct _inputs* in, struct _options* opts)
+{
+    struct _job* jobs = calloc(in->n, sizeof(struct _job));
+    assert(jobs);
+    int running[PAR_MAX_JOBS];      // indexes into jobs
+    struct pollfd fds[PAR_MAX_JOBS + 1];
+    int nrunning = 0, next = 0, next_out = 0, failed = 0;
+    bool placeholder = has_placeholder(template);
+    bool implicit_in_use = false;   // a job runs on the free slot
+
+    fflush(stdout);
+    while (next < in->n || nrunning) {
+        while (nrunning < opts->jobs && next < in->n) {
+            // every job but the one on the free slot needs a jobserver token
+            struct _job* job = &jobs[next];
+            if (implicit_in_use && JS_active() &&
+                !(job->token = JS_try_acquire()))
+                break;
+            int pipefd[2];
+            if (pipe2(pipefd, O_CLOEXEC) == -1) {
+                perror("parallel");
+                if (job->token) JS_release();
+                break;
+            }
+            job->pid = fork();
+            if (job->pid == 0) {
+                close(pipefd[0]);
+                job_run(template, placeholder, in->items[next], pipefd[1]);
+            }
+            close(pipefd[1]);
+            if (job->pid == -1) {
+                perror("parallel");
+                close(pipefd[0]);
+                if (job->token) JS_release();
+                break;
+            }
+            job->fd = pipefd[0];
+            if (!job->token) implicit_in_use = true;
+            running[nrunning++] = next++;
+        }
+        if (!nrunning) {
+            // nothing could be started; count the rest as failed
+            for (; next < in->n; next++) {
+                jobs[next].done = true;
+                jobs[next].status = 1;
+                failed++;
+            }
+            break;
+        }
+
+        // with a slot free but no token, wait for one as well
+        int npoll = nrunning;
+        for (int i = 0; i < nrunning; i++)
+            fds[i] = (struct pollfd) {jobs[running[i]].fd, POLLIN, 0};
+        if (JS_active() && nrunning < opts->jobs && next < in->n)
+            fds[npoll++] = (struct pollfd) {JS_poll_fd(), POLLIN, 0};
+        if (poll(fds, npoll, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("parallel");
+            break;
+        }
+
+        for (int i = 0; i < nrunning; i++) {
+            struct _job* job = &jobs[running[i]];
+            if (!fds[i].revents || job_read(job, opts->keep_order)) continue;
+
+            // output closed: the job is finishing
+            close(job->fd);
+            job->fd = -1;
+            int status;
+            struct rusage usage;
+            while (wait4(job->pid, &status, 0, &usage) == -1 &&
+                errno == EINTR);
+            job->status = WIFEXITED(status)? WEXITSTATUS(status):
+                128 + WTERMSIG(status);
+            job->done = true;
+            LOG_stage(in->items[running[i]], job->pid, status, &usage);
+            if (job->token) JS_release();
+            else implicit_in_use = false;
+            if (job->status) {
+                failed++;
+                fprintf(stderr, "parallel: job %d (%s) exited with status %d\n",
+                    running[i] + 1, in->items[running[i]], job->status);
+            }
+            if (!opts->keep_order) job_flush(job);
+        }
+
+        // drop finished jobs from the pool, keeping fds in step
+        int kept = 0;
+        for (int i = 0; i < nrunning; i++)
+            if (!jobs[running[i]].done) running[kept++] = running[i];
+        nrunning = kept;
+
+        while (opts->keep_order && next_out < in->n && jobs[next_out].done)
+            job_flush(&jobs[next_out++]);
+    }
+
+    for (int i = 0; i < in->n; i++)
+        free(jobs[i].out);
+    free(jobs);
+    return failed;
+}
+
+
+/*
+ * Parse the pipeline before parallel, if there is one
+ *
+ * Parameters:
+ *  tokens      The tokens of the line, consumed up to the word parallel
+ *  producerp   Return space for the pipeline, NULL if there is none
+ *
+ * Returns:
+ *  bool        false on a parse error, described in errmsg
+ */
+static bool parse_producer(CList tokens, AST* producerp, char* errmsg,
+    size_t errmsg_sz)
+{
+    *producerp = NULL;
+    int pos = find_parallel(tokens);
+    if (pos <= 0) return true;
+
+    // all but the pipe into parallel
+    CList producer = CL_new();
+    for (int i = 0; i < pos; i++) {
+        if (i < pos - 1) CL_append(producer, copy_token(TOK_next(tokens)));
+        TOK_consume(tokens);
+    }
+    *producerp = Parse(producer, errmsg, errmsg_sz);
+    CL_free(producer);
+    return *producerp != NULL;
+}
+
+
+// Documented in .h file
+int PAR_parallel(CList tokens, int in_fd, char* errmsg, size_t errmsg_sz)
+{
+    struct _options opts = {sysconf(_SC_NPROCESSORS_ONLN), false, NULL};
+    if (opts.jobs < 1) opts.jobs = 1;
+    if (opts.jobs > PAR_MAX_JOBS) opts.jobs = PAR_MAX_JOBS;
+
+    // the line as typed, for the log, before the tokens are consumed
+    char line[PAR_LINE_MAX] = "";
+    if (LOG_enabled()) tokens2str(tokens, line, sizeof(line));
+
+    AST producer;
+    if (!parse_producer(tokens, &producer, errmsg, errmsg_sz)) return -1;
+
+    TOK_consume(tokens);    // parallel
+    if (!parse_options(tokens, &opts)) {
+        snprintf(errmsg, errmsg_sz, "usage: parallel [-j JOBS] [-k] [-a FILE] "
+            "[--] template [::: input ...]");
+        AST_free(producer);
+        free((char*) opts.input_file);
+        return -1;
+    }
+
+    // the template runs up to :::, and the inputs follow it
+    CList template = CL_new();
+    bool listed = false;
+    while (TOK_next_type(tokens) != TOK_END) {
+        Token tok = TOK_next(tokens);
+        if (tok.type == TOK_WORD && !strcmp(tok.value, ":::")) {
+            TOK_consume(tokens);
+            listed = true;
+            break;
+        }
+        CL_append(template, copy_token(tok));
+        TOK_consume(tokens);
+    }
+
+    // parse the template once, so a mistake is reported before any job
+    CList check = instantiate(template, true, PAR_PLACEHOLDER);
+    AST pipeline = Parse(check, errmsg, errmsg_sz);
+    CL_free(check);
+    bool ok = pipeline != NULL;
+    if (ok && producer && (listed || opts.input_file)) {
+        snprintf(errmsg, errmsg_sz, "parallel: inputs from both a pipe and %s",
+            listed? ":::": "-a");
+        ok = false;
+    }
+    else if (ok && !producer && !listed && !opts.input_file && in_fd == -1) {
+        snprintf(errmsg, errmsg_sz, "parallel: no inputs: give them after "
+            ":::, with -a, or through a pipe");
+        ok = false;
+    }
+    AST_free(pipeline);
+    if (!ok) {
+        AST_free(producer);
+        CL_free(template);
+        free((char*) opts.input_file);
+        return -1;
+    }
+
+    struct _inputs in = {NULL};
+    while (listed && TOK_next_type(tokens) != TOK_END) {
+        Token tok = TOK_next(tokens);
+        if (tok.type == TOK_WORD || tok.type == TOK_QUOTED_WORD)
+            inputs_word(&in, tok);
+        TOK_consume(tokens);
+    }
+    if (!listed && opts.input_file) {
+        FILE* fp = fopen(opts.input_file, "r");
+        if (!fp) {
+            snprintf(errmsg, errmsg_sz, "parallel: %s: %s", opts.input_file,
+                strerror(errno));
+            CL_free(template);
+            free((char*) opts.input_file);
+            return -1;
+        }
+        inputs_lines(&in, fp);
+        fclose(fp);
+    }
+    else if (producer) inputs_producer(&in, producer);
+    else if (!listed && !inputs_fd(&in, in_fd)) perror("parallel");
+    AST_free(producer);
+
+    // the jobs, and any make they run, share one budget; each is a stage
+    // of the line's record, named by its input
+    bool serving = JS_serve(opts.jobs);
+    LOG_begin_line(line);
+    int failed = run_jobs(template, &in, &opts);
+    LOG_end(failed? 1: 0);
+    if (serving) JS_stop_serving();
+    if (failed)
+        fprintf(stderr, "parallel: %d of %d jobs failed\n", failed, in.n);
+
+    inputs_free(&in);
+    CL_free(template);
+    free((char*) opts.input_file);
+    return failed? 1: 0;
+}
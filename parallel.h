@@ -0,0 +1,72 @@
+/*
+ * parallel.h
+ *
+ * The parallel command: run a pipeline template once per input, with up
+ * to JOBS instances at a time
+ *
+ *   [pipeline |] parallel [-j JOBS] [-k] [-a FILE] [--] template
+ *       [::: input ...]
+ *
+ * Each {} in the template is replaced by the input; a template without
+ * {} gets the input as the last argument of its first command, as with
+ * xargs. The inputs are the words after :::, globbed and brace expanded
+ * as arguments are, or else the lines of FILE, or else the lines the
+ * pipeline before parallel writes, or else the lines of standard input,
+ * unless the shell reads its commands from there. Like bench, parallel
+ * is recognized before parsing, since the template is a whole pipeline,
+ * which may be a limit command.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "clist.h"
+
+#define PAR_MAX_JOBS        1024
+
+
+/*
+ * Whether a tokenized line is a parallel command
+ *
+ * Parameters:
+ *  tokens      The tokens of the line
+ *
+ * Returns:
+ *  bool        true if its first token, or the first after a pipe, is
+ *              the unquoted word "parallel"
+ */
+bool PAR_is_parallel(CList tokens);
+
+
+/*
+ * Run a parallel command. Every job is a child of the shell running the
+ * substituted pipeline through AST_execute, with standard input from
+ * /dev/null. A new job starts as soon as any finishes, so long jobs do
+ * not hold up the rest. Output is passed on a line at a time as jobs
+ * produce it, never splitting a line, or with -k each job's output
+ * whole and in input order. Failed jobs are reported on stderr as they
+ * finish, and counted at the end. The command log gets one record for
+ * the line, with a stage for each job named by its input.
+ *
+ * Parameters:
+ *  tokens      The tokens of the line, consumed
+ *  in_fd       Where to read inputs given neither after ::: nor by -a
+ *              nor through a pipe, or -1 if the shell reads its own
+ *              commands from its standard input, which parallel must
+ *              then leave alone
+ *  errmsg      Return space for an error message
+ *  errmsg_sz   The size of errmsg
+ *
+ * Returns:
+ *  int         0 if every job succeeded, 1 if any failed; -1 on a usage
+ *              or parse error, described in errmsg
+ */
+int PAR_parallel(CList tokens, int in_fd, char* errmsg, size_t errmsg_sz);
+
+#endif /* _PARALLEL_H_ */
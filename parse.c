@@ -10,15 +10,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <glob.h>
 
 #include "parse.h"
 #include "tokenize.h"
+#include "walk.h"
+#include "globcache.h"
+#include "brace.h"
+#include "memstats.h"
 
 
 /*
- * Expands a string value of a WORD token using system glob
- * and appends the results to the pipeline
+ * Expands a string value of a WORD token using system glob over the
+ * directory listing cache, or the parallel directory walker for "**"
+ * patterns, and appends the results to the pipeline
  *
  * Parameters:
  *  pipelinep   The pointer to the pipeline to append to
@@ -28,16 +34,36 @@
  */
 static int glob_append(AST* pipelinep, const char* value)
 {
+    // recursive patterns; on no match fall back to glob, which applies
+    // GLOB_NOCHECK semantics to the pattern
+    if (WALK_is_globstar(value)) {
+        size_t count;
+        char** paths = WALK_glob(value, WALK_SORT, 0, &count);
+        for (size_t i = 0; i < count; i++) {
+            AST word = AST_word(WORD, 0, paths[i]);
+            AST_set_expanded(word);
+            AST_append(pipelinep, word);
+        }
+        WALK_free(paths);
+        if (count) return 0;
+    }
+
     glob_t pglob;
     int options = GLOB_TILDE_CHECK | GLOB_NOCHECK;
-    int globexit = glob(value, options, NULL, &pglob);
+    int globexit = GC_glob(value, options, &pglob);
     if (globexit) {
         globfree(&pglob);
         return globexit;
     }
 
-    for (int i = 0; i < pglob.gl_pathc; i++)
-        AST_append(pipelinep, AST_word(WORD, 0, pglob.gl_pathv[i]));
+    // a pattern that matched nothing stands for itself
+    bool matched = (pglob.gl_flags & GLOB_MAGCHAR) &&
+        (pglob.gl_pathc != 1 || strcmp(pglob.gl_pathv[0], value));
+    for (int i = 0; i < pglob.gl_pathc; i++) {
+        AST word = AST_word(WORD, 0, pglob.gl_pathv[i]);
+        if (matched) AST_set_expanded(word);
+        AST_append(pipelinep, word);
+    }
 
     globfree(&pglob);
 
@@ -45,6 +71,28 @@ static int glob_append(AST* pipelinep, const char* value)
 }
 
 
+/*
+ * Appends a WORD token to the pipeline. A word with brace expansions is
+ * kept whole as a BRACE_WORD, to be generated and globbed one word at a
+ * time when the command runs; any other word is globbed right away.
+ *
+ * Parameters:
+ *  pipelinep   The pointer to the pipeline to append to
+ *  value       The value of the WORD token
+ *
+ * Returns:     Glob error on unsuccessful glob call
+ */
+static int word_append(AST* pipelinep, const char* value)
+{
+    Brace br = BR_new(value);
+    if (!br) return glob_append(pipelinep, value);
+
+    BR_free(br);
+    AST_append(pipelinep, AST_word(BRACE_WORD, 0, value));
+    return 0;
+}
+
+
 // Documented in .h file
 AST Parse(CList tokens, char *errmsg, size_t errmsg_sz)
 {
@@ -55,16 +103,16 @@ AST Parse(CList tokens, char *errmsg, size_t errmsg_sz)
     TokenType tt;
     while ((tt = TOK_next_type(tokens)) != TOK_END) {
         Token token = TOK_next(tokens);
-        char* value = token.value? strdup(token.value): NULL;
+        char* value = token.value? MEM_strdup(token.value): NULL;
         TOK_consume(tokens);
 
         if (tt == TOK_QUOTED_WORD) AST_append(&ret, AST_word(tt, 0, value));
         else if (tt == TOK_WORD) {
-            int globexit = glob_append(&ret, value);
+            int globexit = word_append(&ret, value);
             if (globexit) {
                 snprintf(errmsg, errmsg_sz, "Glob encountered an error");
                 AST_free(ret);
-                free(value);
+                MEM_free(value);
                 return NULL;
             }
         }
@@ -87,11 +135,11 @@ AST Parse(CList tokens, char *errmsg, size_t errmsg_sz)
 
             if (*errmsg) {
                 AST_free(ret);
-                free(value);
+                MEM_free(value);
                 return NULL;
             }
 
-            value = strdup(TOK_next(tokens).value);
+            value = MEM_strdup(TOK_next(tokens).value);
             TOK_consume(tokens);
             AST tempfile = NULL;
             int globexit = glob_append(&tempfile, value);
@@ -99,7 +147,7 @@ AST Parse(CList tokens, char *errmsg, size_t errmsg_sz)
                 snprintf(errmsg, errmsg_sz, "Glob encountered an error");
                 AST_free(tempfile);
                 AST_free(ret);
-                free(value);
+                MEM_free(value);
                 return NULL;
             }
             AST_append(&ret, AST_redirect(tt, tempfile));
@@ -114,21 +162,21 @@ AST Parse(CList tokens, char *errmsg, size_t errmsg_sz)
 
             if (*errmsg) {
                 AST_free(ret);
-                free(value);
+                MEM_free(value);
                 return NULL;
             }
-            value = strdup(TOK_next(tokens).value);
+            value = MEM_strdup(TOK_next(tokens).value);
             TOK_consume(tokens);
             AST tempcmd = AST_word(next_tt, 0, value);
             if (next_tt == TOK_WORD) {
                 AST_free(tempcmd);
                 tempcmd = NULL;
-                int globexit = glob_append(&tempcmd, value);
+                int globexit = word_append(&tempcmd, value);
                 if (globexit) {
                     snprintf(errmsg, errmsg_sz, "Glob encountered an error");
                     AST_free(tempcmd);
                     AST_free(ret);
-                    free(value);
+                    MEM_free(value);
                     return NULL;
                 }
             }
@@ -137,10 +185,10 @@ AST Parse(CList tokens, char *errmsg, size_t errmsg_sz)
         else {
             snprintf(errmsg, errmsg_sz, "Unexpected token %s", TT_to_str(tt));
             AST_free(ret);
-            free(value);
+            MEM_free(value);
             return NULL;
         }
-        free(value);
+        MEM_free(value);
     }
     return ret;
 }
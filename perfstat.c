@@ -0,0 +1,162 @@
+/*
+ * perfstat.c
+ *
+ * Per-stage performance counters through perf_event_open(2)
+ *
+ * Each counter is its own event rather than part of a group, since an
+ * inherited group cannot be read as a whole and a hardware counter the
+ * machine lacks must not take the software ones down with it. All
+ * events exclude the kernel, which perf_event_paranoid 2 requires for
+ * unprivileged users.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfstat.h"
+
+struct _perf_stage {
+    pid_t pid;
+    int fds[PF_NCOUNTERS];  // -1 for counters that could not be opened
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} counters[PF_NCOUNTERS] = {
+    [PF_TASK_CLOCK] =       {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    [PF_CONTEXT_SWITCHES] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    [PF_CPU_MIGRATIONS] =   {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+    [PF_PAGE_FAULTS] =      {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    [PF_CYCLES] =           {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PF_INSTRUCTIONS] =     {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+};
+
+static bool enabled = false;
+
+// Set once perf_event_open has failed for every counter, so that the
+// reason is only reported once
+static bool warned = false;
+
+
+
+// Documented in .h file
+void PF_set_enabled(bool on)
+{   enabled = on; }
+
+
+// Documented in .h file
+bool PF_enabled()
+{   return enabled; }
+
+
+// Documented in .h file
+PerfStage PF_open(pid_t pid)
+{
+    PerfStage stage = malloc(sizeof(struct _perf_stage));
+    assert(stage);
+    stage->pid = pid;
+
+    int opened = 0, err = 0;
+    for (int i = 0; i < PF_NCOUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counters[i].type;
+        attr.config = counters[i].config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        stage->fds[i] = syscall(SYS_perf_event_open, &attr, pid, -1, -1,
+            PERF_FLAG_FD_CLOEXEC);
+        if (stage->fds[i] != -1) opened++;
+        else if (!err) err = errno;
+    }
+
+    if (!opened) {
+        if (!warned) fprintf(stderr, "perfstat: counters unavailable: %s\n",
+            strerror(err));
+        warned = true;
+        free(stage);
+        return NULL;
+    }
+    return stage;
+}
+
+
+// Documented in .h file
+void PF_read(PerfStage stage, uint64_t values[PF_NCOUNTERS])
+{
+    for (int i = 0; i < PF_NCOUNTERS; i++) {
+        uint64_t buf[3];   // value, time enabled, time running
+        values[i] = PF_UNAVAILABLE;
+        if (stage->fds[i] == -1 ||
+                read(stage->fds[i], buf, sizeof(buf)) != sizeof(buf))
+            continue;
+
+        if (buf[2] == 0) values[i] = 0;
+        else if (buf[2] < buf[1])
+            values[i] = (uint64_t) ((double) buf[0] * buf[1] / buf[2]);
+        else values[i] = buf[0];
+    }
+}
+
+
+/*
+ * Print a count with an SI suffix, or "-" if it is unavailable
+ */
+static void print_count(FILE* out, const char* label, uint64_t value)
+{
+    if (value == PF_UNAVAILABLE) fprintf(out, "  %s -", label);
+    else if (value < 10000) fprintf(out, "  %s %lu", label, (unsigned long) value);
+    else if (value < 10000000) fprintf(out, "  %s %.1fK", label, value / 1e3);
+    else if (value < 10000000000) fprintf(out, "  %s %.1fM", label, value / 1e6);
+    else fprintf(out, "  %s %.1fG", label, value / 1e9);
+}
+
+
+// Documented in .h file
+void PF_report(PerfStage stage, const char* name, FILE* out)
+{
+    uint64_t v[PF_NCOUNTERS];
+    PF_read(stage, v);
+
+    fprintf(out, "%s [%d]:", name, stage->pid);
+    if (v[PF_TASK_CLOCK] == PF_UNAVAILABLE) fprintf(out, "  task-clock -");
+    else fprintf(out, "  task-clock %.3fms", v[PF_TASK_CLOCK] / 1e6);
+    print_count(out, "cs", v[PF_CONTEXT_SWITCHES]);
+    print_count(out, "migrations", v[PF_CPU_MIGRATIONS]);
+    print_count(out, "faults", v[PF_PAGE_FAULTS]);
+    print_count(out, "cycles", v[PF_CYCLES]);
+    print_count(out, "instructions", v[PF_INSTRUCTIONS]);
+    if (v[PF_CYCLES] != PF_UNAVAILABLE && v[PF_CYCLES] &&
+            v[PF_INSTRUCTIONS] != PF_UNAVAILABLE)
+        fprintf(out, "  IPC %.2f", (double) v[PF_INSTRUCTIONS] / v[PF_CYCLES]);
+    fprintf(out, "\n");
+}
+
+
+// Documented in .h file
+void PF_close(PerfStage stage)
+{
+    if (!stage) return;
+    for (int i = 0; i < PF_NCOUNTERS; i++)
+        if (stage->fds[i] != -1) close(stage->fds[i]);
+    free(stage);
+}
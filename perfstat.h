@@ -0,0 +1,95 @@
+/*
+ * perfstat.h
+ *
+ * Per-stage performance counters through perf_event_open(2): the
+ * software counters the kernel keeps for every task, and hardware
+ * cycles and instructions where the machine and the perf_event_paranoid
+ * setting allow. Counting starts at the stage's exec and follows its
+ * children. Any counter that cannot be opened is left out, so the shell
+ * works the same in containers where perf events are restricted.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _PERFSTAT_H_
+#define _PERFSTAT_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// The value of a counter that is not available
+#define PF_UNAVAILABLE UINT64_MAX
+
+typedef enum {
+    PF_TASK_CLOCK,          // nanoseconds on a CPU
+    PF_CONTEXT_SWITCHES,
+    PF_CPU_MIGRATIONS,
+    PF_PAGE_FAULTS,
+    PF_CYCLES,
+    PF_INSTRUCTIONS,
+    PF_NCOUNTERS
+} PerfCounter;
+
+typedef struct _perf_stage* PerfStage;
+
+
+/*
+ * Turn counting of pipeline stages on or off, for the perfstat builtin
+ */
+void PF_set_enabled(bool enabled);
+
+
+/*
+ * Whether pipeline stages are to be counted
+ */
+bool PF_enabled();
+
+
+/*
+ * Open the counters on a process that has not yet called exec. They
+ * start counting at its exec and include the processes it creates.
+ *
+ * Parameters:
+ *  pid         The process, which must be held before its exec until
+ *              this returns
+ *
+ * Returns:
+ *  PerfStage   The counters, released with PF_close; NULL if none could
+ *              be opened
+ */
+PerfStage PF_open(pid_t pid);
+
+
+/*
+ * Read the counters, which are final once the process has been reaped.
+ * Counters that were multiplexed are scaled to the time they were
+ * enabled.
+ *
+ * Parameters:
+ *  stage       The counters
+ *  values      Return space for each counter, PF_UNAVAILABLE for those
+ *              that could not be opened or read
+ */
+void PF_read(PerfStage stage, uint64_t values[PF_NCOUNTERS]);
+
+
+/*
+ * Print one line summarizing the counters of a stage
+ *
+ * Parameters:
+ *  stage       The counters
+ *  name        The stage's command
+ *  out         The stream to print to
+ */
+void PF_report(PerfStage stage, const char* name, FILE* out);
+
+
+/*
+ * Close the counters
+ */
+void PF_close(PerfStage stage);
+
+#endif /* _PERFSTAT_H_ */
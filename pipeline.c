@@ -12,19 +12,13 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/wait.h>
 
 #include "token.h"
 #include "pipeline.h"
-
-
-#define   __builtin_cd "true"
-#define __builtin_auth "echo"
-#define         AUTHOR "Jean Baptiste Kwizera"
+#include "program.h"
+#include "stats.h"
+#include "trace.h"
+#include "memstats.h"
 
 
 struct _ast_node {
@@ -32,6 +26,7 @@ struct _ast_node {
     const char* value;
     struct _ast_node* left;
     struct _ast_node* right;
+    int expanded;           // produced by glob or brace expansion
 };
 
 /*
@@ -48,6 +43,7 @@ static char ASTNodeType_to_char(ASTNodeType ent)
     switch(ent) {
         case WORD:           return 'w';
         case QUOTED_WORD:    return 'W';
+        case BRACE_WORD:     return 'b';
         case OP_LESSTHAN:    return '<';
         case OP_GREATERTHAN: return '>';
         case OP_PIPE:        return '|';
@@ -56,32 +52,33 @@ static char ASTNodeType_to_char(ASTNodeType ent)
 }
 
 
-/* Check if a pipeline node type is WORD or QUOTED word
+/* Check if a pipeline node type is WORD, QUOTED_WORD or BRACE_WORD
  *
  * Parameters:
  *  ASTNodeType The type of a pipeline
  * 
  * Returns:
- *  int         0 if type is neither WORD nor QUOTED_WORD
+ *  int         0 if type is none of WORD, QUOTED_WORD or BRACE_WORD
  *              non-zero value otherwise.
  */
 static int isword(ASTNodeType type)
-{   return type == WORD || type == QUOTED_WORD; }
+{   return type == WORD || type == QUOTED_WORD || type == BRACE_WORD; }
 
 
 // Documented in .h file
 AST AST_word(ASTNodeType type, AST right, const char* value)
 {
-    assert(type == WORD || type == QUOTED_WORD);
+    assert(isword(type));
     assert(value);
 
-    AST ret = (AST) malloc(sizeof(struct _ast_node));
+    AST ret = (AST) MEM_malloc(sizeof(struct _ast_node));
     assert(ret);
 
     ret->type  = type;
-    ret->value = strdup(value);
+    ret->value = MEM_strdup(value);
     ret->left  = NULL;
     ret->right = right;
+    ret->expanded = 0;
 
     return ret;
 }
@@ -93,13 +90,14 @@ AST AST_redirect(ASTNodeType type, AST right)
     assert(type == OP_LESSTHAN || type == OP_GREATERTHAN);
     assert(right && right->type == WORD);
 
-    AST ret = (AST) malloc(sizeof(struct _ast_node));
+    AST ret = (AST) MEM_malloc(sizeof(struct _ast_node));
     assert(ret);
 
     ret->type  = type;
     ret->value = NULL;
     ret->left  = NULL;
     ret->right = right;
+    ret->expanded = 0;
 
     return ret;
 }
@@ -110,13 +108,14 @@ AST AST_pipe(AST left, AST right)
 {
     assert(left && right);
 
-    AST ret = (AST) malloc(sizeof(struct _ast_node));
+    AST ret = (AST) MEM_malloc(sizeof(struct _ast_node));
     assert(ret);
 
     ret->type  = OP_PIPE;
     ret->value = NULL;
     ret->left  = left;
     ret->right = right;
+    ret->expanded = 0;
 
     return ret;
 }
@@ -175,199 +174,70 @@ int AST_countcommands(AST pipeline)
 
 
 // Documented in .h file
-void AST_free(AST pipeline)
+const char* AST_value(AST pipeline)
 {
-    if (!pipeline) return;
+    assert(pipeline);
+    return isword(pipeline->type)? pipeline->value: NULL;
+}
 
-    ASTNodeType type = pipeline->type;
-    AST_free(pipeline->right);
-    if (type == OP_PIPE) AST_free(pipeline->left);
-    if (type == WORD || type == QUOTED_WORD) free((void *) pipeline->value);
-    free(pipeline);
+
+// Documented in .h file
+void AST_set_expanded(AST pipeline)
+{
+    assert(pipeline && isword(pipeline->type));
+    pipeline->expanded = 1;
 }
 
 
-static void setargs(AST pipeline, char*** argvs, int* argcs, int n)
+// Documented in .h file
+int AST_expanded(AST pipeline)
 {
-    // process children right to left, due to somewhat left-associative
-    // nature of the pipe operator
-    int i = n - 1;
-    while (pipeline) {
-        argcs[i] = 0;
-        AST curr = pipeline;
-        if (pipeline->type == OP_PIPE) curr = curr->right;
-
-        for (AST iter = curr; iter; iter = iter->right)
-            argcs[i]++;
-
-        int j = 0;
-        argvs[i] = (char**) malloc((argcs[i] + 1) * sizeof(char*));
-        for (AST iter = curr; iter; iter = iter->right) {
-            ASTNodeType type = iter->type;
-            if      (isword(type)) argvs[i][j++] = (char*) iter->value;
-            else if (type == OP_LESSTHAN) argvs[i][j++] = "<";
-            else if (type == OP_GREATERTHAN) argvs[i][j++] = ">";
-        }
-        argvs[i][j] = NULL;
-
-        if (pipeline->type != OP_PIPE) break;
-        pipeline = pipeline->left;
-        i--;
-    }
+    assert(pipeline);
+    return pipeline->expanded || pipeline->type == BRACE_WORD;
 }
 
 
 // Documented in .h file
-int AST_execute(AST pipeline)
+AST AST_left(AST pipeline)
 {
-    int num_pipes = AST_countpipes(pipeline);
-    int num_children = num_pipes + 1;
-    char*** argvs = (char***) malloc(num_children * sizeof(char**));
-    int argcs[num_children];
-    int pids[num_children];
-    int fds[num_pipes][2];
-
-    setargs(pipeline, argvs, argcs, num_children);
-
-    for (int i = 0; i < num_pipes; i++) {
-        if (pipe(fds[i]) == -1) {
-            perror("pipe");
-            _exit(EXIT_FAILURE);
-        }
-    }
+    assert(pipeline);
+    return pipeline->type == OP_PIPE? pipeline->left: NULL;
+}
 
-    for (int i = 0; i < num_children; i++) {
-        int argc = argcs[i];
-        char** argv = argvs[i];
-
-        // builtin commands - manipulating shell require no forking
-        if (!strcmp(argv[0], "exit") || !strcmp(argv[0], "quit")) {
-            free(argv);
-            _exit(0);
-        }
-        else if (!strcmp(argv[0], "cd")) {
-            char* dirpath = argv[1];
-            if (dirpath == NULL) dirpath = getenv("HOME");
-            if (chdir(dirpath)) perror("cd");
-            free(argv);
-            continue;
-        }
-
-        // fork-exec a child process for the command
-        pids[i] = fork();
-        if (pids[i] == -1)
-        {   perror("fork"); _exit(EXIT_FAILURE); }
-
-        if (pids[i] == 0) {
-            // close all fds before exec
-            // child[i] needs pipe[i-1][0] for reading
-            // child[i] needs pipe[i+0][1] for writing
-            // close all other fds before exec
-            for (int j = 0; j < num_pipes; j++) {
-                if (j != i-1) close(fds[j][0]);
-                if (j != i+0) close(fds[j][1]);
-            }
-
-            // check for any i/o redirection
-            int lessthan = -1;
-            int greaterthan = -1;
-            for (int j = 1; j < argc - 1; j++) {
-                if (strcmp(argv[j], "<") == 0) lessthan = j;
-                if (strcmp(argv[j], ">") == 0) greaterthan = j;
-            }
-
-            // input redirection
-            if (lessthan >= 0) {
-                char* infile = argv[lessthan+1];
-                int ifd = open(infile, O_RDONLY);
-                if (ifd == -1) {
-                    perror("open");
-                    printf("%s: Permission denied\n", infile);
-                    _exit(EXIT_FAILURE);
-                }
-
-                dup2(ifd, STDIN_FILENO);
-                close(ifd);
-
-                // shift argv values (including the NULL terminator)
-                // to the right of < by 2, overwritting the < and the filename
-                int offset = 2;
-                for (int j = lessthan; j+offset <= argc; j++)
-                    argv[j] = argv[j+offset];
-                argc -= offset;
-                if (lessthan < greaterthan) greaterthan -= offset;
-            }
-
-            // output redirection
-            if (greaterthan >= 0) {
-                char* outfile = argv[greaterthan+1];
-                int ofd = open(outfile, O_RDWR | O_CREAT | O_TRUNC,
-                    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-                if (ofd == -1) {
-                    printf("%s: Permission denied\n", outfile);
-                    _exit(EXIT_FAILURE);
-                }
-
-                dup2(ofd, STDOUT_FILENO);
-                close(ofd);
-
-                // shift argv values (including the NULL terminator)
-                // to the right of > by 2, overwritting the < and the filename
-                int offset = 2;
-                for (int j = greaterthan; j+offset <= argc; j++)
-                    argv[j] = argv[j+offset];
-                argc -= offset;
-            }
-
-
-            // piping: redirect stdin to previous pipe
-            if (i > 0) {
-                dup2(fds[i-1][0], STDIN_FILENO);
-                close(fds[i-1][0]);
-            }
-
-            // piping: redirect stdout to next pipe
-            if (i < num_children-1) {
-                dup2(fds[i][1], STDOUT_FILENO);
-                close(fds[i][1]);
-            }
-
-            // execute
-            if (!strcmp(argv[0], "author")) {
-                execlp(__builtin_auth, __builtin_auth, AUTHOR, NULL);
-                perror(__builtin_auth);
-                _exit(EXIT_FAILURE);
-            }
-
-            execvp(argv[0], argv);
-            if (!strcmp(strerror(errno), "No such file or directory"))
-                printf("%s: Command not found."
-                    "*Child.*exited with status %d\n", argv[0], errno);
-            else
-                perror(argv[0]);
-            _exit(EXIT_FAILURE);
-        }
-        free(argvs[i]);
-    }
-    free(argvs);
 
+// Documented in .h file
+AST AST_right(AST pipeline)
+{
+    assert(pipeline);
+    return pipeline->right;
+}
 
-    // close all fds in parent
-    for (int i = 0; i < num_pipes; i++)
-    {   close(fds[i][0]); close(fds[i][1]); }
 
-    // wait for all children to finish executing
-    int exit_val = 0;
-    for (int i = 0; i < num_children; i++) {
-        int exit_status;
-        int pid = wait(&exit_status);
+// Documented in .h file
+void AST_free(AST pipeline)
+{
+    if (!pipeline) return;
 
-        if (pid > 0 && WEXITSTATUS(exit_status) != 0) {
-            exit_val = WEXITSTATUS(exit_status);
-            printf("Child %d exited with status %d\n",
-                pid, WEXITSTATUS(exit_status));
-        }
-    }
+    ASTNodeType type = pipeline->type;
+    AST_free(pipeline->right);
+    if (type == OP_PIPE) AST_free(pipeline->left);
+    if (isword(type)) MEM_free((void *) pipeline->value);
+    MEM_free(pipeline);
+}
+
+
+// Documented in .h file
+int AST_execute(AST pipeline)
+{
+    uint64_t start = ST_now();
+    Program prog = PRG_compile(pipeline);
+    ST_since(ST_COMPILE, start);
+    TR_since("compile", start);
+
+    uint64_t exec_start = ST_now();
+    int exit_val = PRG_execute(prog);
+    TR_since("execute", exec_start);
+    PRG_free(prog);
 
     return exit_val;
 }
@@ -408,7 +278,7 @@ static void AST_sprint(AST pipeline, char* buf, size_t buf_sz)
                 snprintf(buf + size, buf_sz - size, "| "));
         AST_sprint(pipeline->right, buf, buf_sz);
     } else {
-        if (type == WORD || type == QUOTED_WORD)
+        if (isword(type))
             size += min(buf_sz - size,
                     snprintf(buf + size, buf_sz - size, "%s ", pipeline->value));
         else
@@ -21,15 +21,18 @@ typedef enum {
     QUOTED_WORD,
     OP_LESSTHAN,
     OP_GREATERTHAN,
-    OP_PIPE
+    OP_PIPE,
+    BRACE_WORD      // a WORD whose brace expansion is generated at exec time;
+                    // after OP_PIPE so the other types still match TokenType
 } ASTNodeType;
 
 
-/* Allocate memory and initialize a pipeline node of type WORD or QUOTED_WORD
+/* Allocate memory and initialize a pipeline node of type WORD, QUOTED_WORD
+ * or BRACE_WORD
  *
  * Parameters:
- *  ASTNodeType The type of the pipeline node to create, either of WORD or
- *              QUOTED_WORD
+ *  ASTNodeType The type of the pipeline node to create, one of WORD,
+ *              QUOTED_WORD or BRACE_WORD
  *  AST         The pipeline next link
  *  const char* The word value of the node
  *
@@ -120,6 +123,63 @@ int AST_countcommands(AST pipeline);
 ASTNodeType AST_type(AST pipeline);
 
 
+/* The word value of a pipeline node
+ *
+ * Parameters:
+ *  AST         The pipeline node
+ *
+ * Returns:
+ *  const char* The value of a WORD, QUOTED_WORD or BRACE_WORD node, NULL
+ *              otherwise
+ */
+const char* AST_value(AST pipeline);
+
+
+/* Mark a word node as the result of glob expansion, rather than a word
+ * the user typed
+ *
+ * Parameters:
+ *  AST         The pipeline node, one of the word types
+ */
+void AST_set_expanded(AST pipeline);
+
+
+/* Whether a word node came from glob or brace expansion
+ *
+ * Parameters:
+ *  AST         The pipeline node
+ *
+ * Returns:
+ *  int         non-zero for expanded WORD nodes and every BRACE_WORD node,
+ *              0 otherwise
+ */
+int AST_expanded(AST pipeline);
+
+
+/* The left link of a pipeline node: the pipeline to the left of an
+ * OP_PIPE node
+ *
+ * Parameters:
+ *  AST     The pipeline node
+ *
+ * Returns:
+ *  AST     The left link, NULL for nodes other than OP_PIPE
+ */
+AST AST_left(AST pipeline);
+
+
+/* The right link of a pipeline node: the next node of a command, or the
+ * command to the right of an OP_PIPE node
+ *
+ * Parameters:
+ *  AST     The pipeline node
+ *
+ * Returns:
+ *  AST     The right link, NULL at the end of a command
+ */
+AST AST_right(AST pipeline);
+
+
 /* Return to heap the malloc'ed memory of the nodes in the pipeline
  *
  * Parameters:
@@ -151,7 +211,8 @@ size_t AST_pipeline2str(AST pipeline, char* buf, size_t buf_sz);
 
 /*
  * Fork/exec child processes for each of the commands in the pipeline
- * to execute the provided abstract syntax tree.
+ * to execute the provided abstract syntax tree. The pipeline is compiled
+ * to a Program (see program.h) which is run once and discarded.
  *
  * Parameters:
  *  AST     The abstract syntax tree to process
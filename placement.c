@@ -0,0 +1,281 @@
+/*
+ * placement.c
+ *
+ * Per-stage CPU placement and scheduling
+ *
+ * The automatic order comes from sysfs topology, for the CPUs the shell
+ * may run on: grouped by package, then the first hardware thread of
+ * every core before the second, so that consecutive slots are separate
+ * cores sharing a package's cache until the package's cores run out.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE     // sched_setaffinity, CPU_SET
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "placement.h"
+#include "memstats.h"
+
+#define PL_SCHED_INHERIT    -1
+
+struct _stage_policy {
+    bool has_cpus;          // cpus is set
+    bool auto_cpu;          // @cpu=auto
+    cpu_set_t cpus;
+    bool has_nice;
+    int nice;
+    int sched;              // SCHED_*, or PL_SCHED_INHERIT
+};
+
+static bool auto_on = false;
+
+// the automatic placement order, loaded on first use
+static int order[CPU_SETSIZE];
+static int norder = 0;
+static bool loaded = false;
+static int next_slot = 0;
+
+struct _cpu_pos {
+    int cpu;
+    int package;
+    int thread;             // index among the threads of its core
+    int core;
+};
+
+
+
+/*
+ * Read an integer from a sysfs file
+ */
+static int read_int(const char* fmt, int cpu, int fallback)
+{
+    char path[128];
+    snprintf(path, sizeof(path), fmt, cpu);
+    FILE* fp = fopen(path, "r");
+    if (!fp) return fallback;
+    int value;
+    if (fscanf(fp, "%d", &value) != 1) value = fallback;
+    fclose(fp);
+    return value;
+}
+
+
+static int compare_pos(const void* a, const void* b)
+{
+    const struct _cpu_pos* x = a;
+    const struct _cpu_pos* y = b;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->thread != y->thread) return x->thread - y->thread;
+    if (x->core != y->core) return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+
+/*
+ * Work out the automatic placement order, once
+ */
+static void load_topology()
+{
+    if (loaded) return;
+    loaded = true;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) return;
+
+    static struct _cpu_pos pos[CPU_SETSIZE];
+    int n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        pos[n] = (struct _cpu_pos) {cpu,
+            read_int("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu, 0),
+            0,
+            read_int("/sys/devices/system/cpu/cpu%d/topology/core_id", cpu, cpu)};
+        for (int i = 0; i < n; i++)
+            if (pos[i].package == pos[n].package && pos[i].core == pos[n].core)
+                pos[n].thread++;
+        n++;
+    }
+
+    qsort(pos, n, sizeof(pos[0]), compare_pos);
+    for (int i = 0; i < n; i++)
+        order[i] = pos[i].cpu;
+    norder = n;
+}
+
+
+/*
+ * Parse a CPU list such as 0-3,8
+ *
+ * Returns:
+ *  bool        false if it is not one
+ */
+static bool parse_cpus(const char* list, cpu_set_t* cpus)
+{
+    CPU_ZERO(cpus);
+    const char* p = list;
+    do {
+        char* end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p) return false;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p) return false;
+        }
+        if (lo < 0 || hi >= CPU_SETSIZE || lo > hi) return false;
+        for (long cpu = lo; cpu <= hi; cpu++)
+            CPU_SET(cpu, cpus);
+        p = end;
+    } while (*p++ == ',');
+    return p[-1] == 0;
+}
+
+
+/*
+ * Add one placement word to a policy, clearing *ok if it is malformed
+ *
+ * Returns:
+ *  bool        false if the word is not a placement word at all
+ */
+static bool parse_word(const char* word, struct _stage_policy* policy,
+    bool* ok)
+{
+    if (!strncmp(word, "@cpu=", 5)) {
+        if (!strcmp(word + 5, "auto")) {
+            policy->auto_cpu = true;
+            load_topology();
+        }
+        else if (parse_cpus(word + 5, &policy->cpus)) policy->has_cpus = true;
+        else {
+            fprintf(stderr, "plaidsh: %s: not a CPU list\n", word);
+            *ok = false;
+        }
+    }
+    else if (!strncmp(word, "@nice=", 6)) {
+        char* end;
+        long n = strtol(word + 6, &end, 10);
+        if (end != word + 6 && !*end && n >= -40 && n <= 40) {
+            policy->has_nice = true;
+            policy->nice = n;
+        }
+        else {
+            fprintf(stderr, "plaidsh: %s: not a nice increment\n", word);
+            *ok = false;
+        }
+    }
+    else if (!strncmp(word, "@sched=", 7)) {
+        const char* name = word + 7;
+        if (!strcmp(name, "other")) policy->sched = SCHED_OTHER;
+        else if (!strcmp(name, "batch")) policy->sched = SCHED_BATCH;
+        else if (!strcmp(name, "idle")) policy->sched = SCHED_IDLE;
+        else {
+            fprintf(stderr, "plaidsh: %s: policy is other, batch or idle\n",
+                word);
+            *ok = false;
+        }
+    }
+    else return false;
+    return true;
+}
+
+
+// Documented in .h file
+bool PL_strip(int* argcp, char** argv, bool* lazy, StagePolicy* policyp)
+{
+    int argc = *argcp;
+    struct _stage_policy scratch = {.sched = PL_SCHED_INHERIT};
+    bool ok = true;
+    int prefix = 0;
+    *policyp = NULL;
+    while (prefix < argc && (!lazy || !lazy[prefix]) &&
+        parse_word(argv[prefix], &scratch, &ok))
+        prefix++;
+    if (!prefix) return true;
+
+    if (ok) {
+        *policyp = MEM_malloc(sizeof(struct _stage_policy));
+        assert(*policyp);
+        **policyp = scratch;
+    }
+
+    for (int i = 0; i < prefix; i++)
+        MEM_free(argv[i]);
+    memmove(argv, argv + prefix, (argc - prefix + 1) * sizeof(char*));
+    if (lazy) memmove(lazy, lazy + prefix, (argc - prefix) * sizeof(bool));
+    *argcp = argc - prefix;
+    return ok;
+}
+
+
+// Documented in .h file
+void PL_free(StagePolicy policy)
+{   MEM_free(policy); }
+
+
+// Documented in .h file
+void PL_set_auto(bool on)
+{
+    auto_on = on;
+    if (on) load_topology();
+}
+
+
+// Documented in .h file
+bool PL_auto()
+{   return auto_on; }
+
+
+// Documented in .h file
+int PL_reserve(int nstages)
+{
+    int base = next_slot;
+    next_slot = norder? (next_slot + nstages) % norder: 0;
+    return base;
+}
+
+
+// Documented in .h file
+int PL_cpu(int slot)
+{
+    load_topology();
+    return norder? order[slot % norder]: -1;
+}
+
+
+// Documented in .h file
+void PL_apply(StagePolicy policy, int slot)
+{
+    cpu_set_t cpus;
+    bool pin = false;
+    if (policy && policy->has_cpus) {
+        cpus = policy->cpus;
+        pin = true;
+    }
+    else if (slot >= 0 && (auto_on || (policy && policy->auto_cpu))) {
+        int cpu = PL_cpu(slot);
+        CPU_ZERO(&cpus);
+        if (cpu >= 0) CPU_SET(cpu, &cpus);
+        pin = cpu >= 0;
+    }
+    if (pin && sched_setaffinity(0, sizeof(cpus), &cpus))
+        perror("sched_setaffinity");
+
+    if (!policy) return;
+    errno = 0;
+    if (policy->has_nice && nice(policy->nice) == -1 && errno)
+        perror("nice");
+    struct sched_param param = {0};
+    if (policy->sched != PL_SCHED_INHERIT &&
+        sched_setscheduler(0, policy->sched, &param))
+        perror("sched_setscheduler");
+}
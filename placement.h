@@ -0,0 +1,103 @@
+/*
+ * placement.h
+ *
+ * Per-stage CPU placement and scheduling. A command may start with any
+ * of these words, which are removed before it runs:
+ *
+ *   @cpu=LIST      run on the CPUs in LIST, such as 0-3,8
+ *   @cpu=auto      run on the CPU automatic placement picks for it
+ *   @nice=N        add N to its nice value, as nice -n N does
+ *   @sched=POLICY  run under SCHED_OTHER, SCHED_BATCH or SCHED_IDLE,
+ *                  given as other, batch or idle
+ *
+ * A malformed placement word, or placement words with no command after
+ * them, fail the command instead of running it unplaced.
+ *
+ * Automatic placement, for every stage with the placement builtin or
+ * for one with @cpu=auto, pins the stages of a pipeline to consecutive
+ * CPUs of an order in which neighbours are distinct cores of the same
+ * package, so that a stage and the next one share the package's cache
+ * without competing for a core. Each pipeline starts where the last
+ * left off, so concurrent pipelines spread out.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _PLACEMENT_H_
+#define _PLACEMENT_H_
+
+#include <stdbool.h>
+
+typedef struct _stage_policy* StagePolicy;
+
+
+/*
+ * Remove the placement words at the start of a command
+ *
+ * Parameters:
+ *  argcp       The number of arguments, updated
+ *  argv        The arguments, shifted down over the words removed
+ *  lazy        The brace word markers of argv, shifted with it, or NULL
+ *  policyp     Return space for the stage's policy, released with
+ *              PL_free, or NULL if the command has no placement words or
+ *              a malformed one
+ *
+ * Returns:
+ *  bool        false if a placement word cannot be parsed, reported on
+ *              stderr; the words are removed all the same
+ */
+bool PL_strip(int* argcp, char** argv, bool* lazy, StagePolicy* policyp);
+
+
+/*
+ * Free a stage policy, which may be NULL
+ */
+void PL_free(StagePolicy policy);
+
+
+/*
+ * Turn automatic placement on or off for every stage
+ */
+void PL_set_auto(bool on);
+
+
+/*
+ * Whether automatic placement is on for every stage
+ */
+bool PL_auto();
+
+
+/*
+ * Reserve automatic placement slots for the stages of one pipeline
+ *
+ * Parameters:
+ *  nstages     The number of stages
+ *
+ * Returns:
+ *  int         The slot of the first stage; stage i takes this plus i
+ */
+int PL_reserve(int nstages);
+
+
+/*
+ * Apply a stage's placement and scheduling, in the child before exec.
+ * Failures are reported on stderr and do not stop the stage.
+ *
+ * Parameters:
+ *  policy      The stage's policy, or NULL
+ *  slot        The stage's automatic placement slot, or -1 to leave
+ *              it unpinned unless it has a CPU list
+ */
+void PL_apply(StagePolicy policy, int slot);
+
+
+/*
+ * The CPU of an automatic placement slot
+ *
+ * Returns:
+ *  int         The CPU, or -1 if none is known
+ */
+int PL_cpu(int slot);
+
+#endif /* _PLACEMENT_H_ */
@@ -1,19 +1,119 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <readline/readline.h>
-#include <readline/history.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
 
 #include "clist.h"
 #include "tokenize.h"
 #include "parse.h"
+#include "bench.h"
+#include "parallel.h"
+#include "limit.h"
+#include "stats.h"
+#include "trace.h"
+#include "memstats.h"
+#include "cmdlog.h"
+#include "jobserver.h"
+#include "server.h"
 
 
 #define KNRM    "\x1B[0m"
 #define KBLD    "\x1B[1m"
 #define KRED    "\x1B[31m"
 #define PROMPT  "#? "
+#define USAGE   "usage: %s [-c command | script | --serve socket | " \
+                "--connect socket command]\n"
 
+// readline is loaded on the first interactive prompt, so scripts and -c
+// commands never pay for linking it or for its terminal and locale setup
+static char* (*rl_readline)(const char* prompt);
+static void (*rl_add_history)(const char* line);
+
+
+/*
+ * Load readline and history support, once
+ *
+ * Returns:
+ *  bool        Whether readline is available; without it, lines are
+ *              read plainly after a prompt
+ */
+static bool load_readline()
+{
+    static bool tried = false;
+    if (tried) return rl_readline != NULL;
+    tried = true;
+
+    void* lib = dlopen("libreadline.so.8", RTLD_NOW | RTLD_LOCAL);
+    if (!lib) lib = dlopen("libreadline.so", RTLD_NOW | RTLD_LOCAL);
+    if (!lib) return false;
+    rl_readline = (char* (*)(const char*)) dlsym(lib, "readline");
+    rl_add_history = (void (*)(const char*)) dlsym(lib, "add_history");
+    return rl_readline != NULL;
+}
+
+
+/*
+ * Read the next command line: with readline and a prompt when
+ * interactive, otherwise a plain line of the script
+ *
+ * Parameters:
+ *  in          The script, when not interactive
+ *  interactive Whether the user is at a terminal
+ *
+ * Returns:
+ *  char*       The line, without its newline, to be freed by the
+ *              caller; NULL at the end of input
+ */
+static char* read_input(FILE* in, bool interactive)
+{
+    if (interactive && load_readline()) return rl_readline(KRED KBLD PROMPT KNRM);
+    if (interactive) {
+        printf(PROMPT);
+        fflush(stdout);
+    }
+
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len = getline(&line, &cap, in);
+    if (len == -1) {
+        free(line);
+        return NULL;
+    }
+    if (len && line[len - 1] == '\n') line[len - 1] = 0;
+    return line;
+}
+
+
+/*
+ * Start the trace and command log asked for by PSH_TRACE=FILE and
+ * PSH_LOG=FILE, which cover the whole session like "trace start FILE"
+ * and "cmdlog start FILE"
+ */
+static void start_logs()
+{
+    const char* trace_path = getenv("PSH_TRACE");
+    if (trace_path && *trace_path && !TR_start(trace_path))
+        perror(trace_path);
+
+    const char* log_path = getenv("PSH_LOG");
+    if (log_path && *log_path && !LOG_start(log_path))
+        perror(log_path);
+}
+
+
+/*
+ * Usage: plaidsh [-c command | script | --serve socket |
+ *                 --connect socket command]
+ *
+ * Without a script, commands are read from stdin: interactively with
+ * readline when it is a terminal, otherwise line by line without a
+ * prompt, so the shell can be driven by a pipe. -c runs the lines of
+ * command, as if they were a script. --serve runs commands for clients
+ * of a socket, and --connect is such a client, exiting with the status
+ * of its command.
+ */
 int main(int argc, char* argv[])
 {
     CList tokens = NULL;
@@ -22,23 +122,74 @@ int main(int argc, char* argv[])
     char* input = NULL;
     bool time_to_quit = false;
     AST pipeline = NULL;
+    uint64_t start = 0;
+    FILE* in = stdin;
+
+    if (argc > 1 && !strcmp(argv[1], "--serve")) {
+        if (argc != 3) {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+        JS_init();
+        start_logs();
+        int status = SRV_serve(argv[2]);
+        TR_stop();
+        LOG_stop();
+        return status;
+    }
+    if (argc > 1 && !strcmp(argv[1], "--connect")) {
+        if (argc != 4) {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+        int status = SRV_request(argv[2], argv[3]);
+        return status == -1? 2: status;
+    }
+
+    if (argc > 1 && !strcmp(argv[1], "-c")) {
+        if (argc != 3) {
+            fprintf(stderr, USAGE, argv[0]);
+            return 2;
+        }
+        in = fmemopen(argv[2], strlen(argv[2]), "r");
+        if (!in) {
+            perror("-c");
+            return 1;
+        }
+    }
+    else if (argc > 1 && !(in = fopen(argv[1], "r"))) {
+        perror(argv[1]);
+        return 1;
+    }
+    bool interactive = in == stdin && isatty(STDIN_FILENO);
+
+    // under make -j, parallel work takes its slots from make's jobserver
+    JS_init();
+    start_logs();
 
-    printf("Welcome to Plaid Shell!\n");
+    if (interactive) printf("Welcome to Plaid Shell!\n");
 
     while (!time_to_quit) {
-        input = readline(KRED KBLD PROMPT KNRM);
+        input = read_input(in, interactive);
 
         if (input == NULL || strcasecmp(input, "quit") == 0) {
             time_to_quit = true;
             goto loop_end;
         }
 
-        if (*input == 0)
+        // scripts may have comments, and so a #! line
+        const char* first = input + strspn(input, " \t");
+        if (*first == 0 || (!interactive && *first == '#'))
             goto loop_end;
 
-        add_history(input);
+        if (interactive && rl_add_history) rl_add_history(input);
 
+        // the command's time runs from here to the next prompt
+        start = ST_now();
+        MEM_begin_command();
         tokens = TOK_tokenize_input(input, buffer, buffer_sz);
+        ST_since(ST_TOKENIZE, start);
+        TR_since("tokenize", start);
 
         if (tokens == NULL) {
             fprintf(stderr, "%s\n", buffer);
@@ -51,14 +202,38 @@ int main(int argc, char* argv[])
         // uncomment for more debug info
         // TOK_print(tokens);
 
+        if (BN_is_bench(tokens)) {
+            if (BN_bench(tokens, stdout, buffer, buffer_sz))
+                fprintf(stderr, "%s\n", buffer);
+            goto loop_end;
+        }
+
+        if (LIM_is_limit(tokens)) {
+            if (LIM_limit(tokens, buffer, buffer_sz) == -1)
+                fprintf(stderr, "%s\n", buffer);
+            goto loop_end;
+        }
+
+        // parallel's own stdin is only free when it is not the script
+        if (PAR_is_parallel(tokens)) {
+            if (PAR_parallel(tokens, in == stdin? -1: STDIN_FILENO,
+                    buffer, buffer_sz) == -1)
+                fprintf(stderr, "%s\n", buffer);
+            goto loop_end;
+        }
+
+        uint64_t parse_start = ST_now();
         pipeline = Parse(tokens, buffer, buffer_sz);
+        ST_since(ST_PARSE, parse_start);
+        TR_since("parse", parse_start);
 
         if (pipeline == NULL) {
             fprintf(stderr, "%s\n", buffer);
             goto loop_end;
         }
 
-        AST_execute(pipeline);
+        LOG_begin(pipeline);
+        LOG_end(AST_execute(pipeline));
 
 loop_end:
         free(input);
@@ -67,7 +242,16 @@ loop_end:
         tokens = NULL;
         AST_free(pipeline);
         pipeline = NULL;
+        if (start) {
+            ST_since(ST_COMMAND, start);
+            TR_since("command", start);
+            MEM_end_command();
+        }
+        start = 0;
     }
 
+    if (in != stdin) fclose(in);
+    TR_stop();
+    LOG_stop();
     return 0;
 }
@@ -0,0 +1,302 @@
+#! /usr/bin/env python3
+#
+# End-to-end throughput benchmark for plaidsh: feeds generated workloads
+# to the shell's stdin and reports commands per second, with per-command
+# latency percentiles taken from the shell's own stats builtin
+#
+# The workloads run in the Plaid Shell Playground made by
+# setup_playground.sh, to which a synthetic tree of --files files is
+# added for the glob-heavy lines.
+#
+# With --startup, it instead times shell startup: exec to the first
+# interactive prompt on a pseudo terminal, and exec to exit for -c true.
+#
+# With --placement, it times producer/consumer pipelines with the placement
+# builtin off and on auto, to show what pinning adjacent stages to sibling
+# cores is worth on this machine.
+#
+# With --zygote, it compares stage launch latency with the zygote pool
+# off and on, from the shell's own fork and exec phase timings over -n
+# runs of true.
+#
+# With --server, it compares a fresh shell per command, as -c, against
+# a client of a --serve shell, over -n runs of a command.
+#
+# Author: Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+#
+#  Usage: ./plaidsh_bench.py [-n lines] [--files N]
+#                           [--startup | --placement | --zygote | --server]
+#                           [executable-name]
+
+import argparse
+import os
+import pty
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+playground = "Plaid Shell Playground"
+synthetic = "synthetic"
+
+# find the setup_playground script by searching these directories in order
+script_path = ['.', '/var/local/isse-12']
+for s in script_path:
+    setup_script = os.path.abspath(os.path.join(s, "setup_playground.sh"))
+    if os.path.exists(setup_script):
+        break
+
+
+# (name) (lines to cycle through)
+workloads = [
+    ("builtin", ["cd .", "hash", "cd synthetic", "cd ..", "globcache"]),
+    ("external", ["true", "echo hello", "ls README", "cat shells.txt"]),
+    ("pipeline", [
+        "cat shells.txt | sort | uniq | sort -r | head -3 | wc -l",
+        "cat \"best sitcoms.txt\" | grep The | sed -e s/The/A/ | sort | tail -2 | wc -c",
+        "ls -l | grep txt | cut -c 1-10 | sort | uniq -c | sort -rn | head -1 | wc -l",
+    ]),
+    ("glob", [
+        "echo synthetic/*/*.txt > /dev/null",
+        "echo synthetic/d1*/f*.c > /dev/null",
+        "echo synthetic/**/*.h > /dev/null",
+        "echo synthetic/{d1,d2,d3}/f1*.txt > /dev/null",
+    ]),
+]
+
+
+def make_tree(files):
+    """Add a synthetic tree of about files files to the playground"""
+    root = os.path.join(playground, synthetic)
+    shutil.rmtree(root, ignore_errors=True)
+    ndirs = max(1, files // 100)
+    exts = [".txt", ".c", ".h", ".md"]
+    for d in range(ndirs):
+        path = os.path.join(root, f"d{d}")
+        os.makedirs(path)
+        for f in range(min(100, files - d * 100)):
+            open(os.path.join(path, f"f{f}{exts[f % len(exts)]}"), "w").close()
+
+
+def parse_duration(text):
+    """Convert a stats builtin duration such as 12ns, 3.4us or 5.6ms to
+    seconds"""
+    m = re.fullmatch(r"([0-9.]+)(ns|us|ms)", text)
+    scale = {"ns": 1e-9, "us": 1e-6, "ms": 1e-3}[m.group(2)]
+    return float(m.group(1)) * scale
+
+
+def run_workload(shell, lines, n):
+    """Run n lines cycled from lines, then stats; return the wall time and
+    the command row of the stats table"""
+    script = "".join(lines[i % len(lines)] + "\n" for i in range(n))
+    script += "stats\n"
+
+    start = time.monotonic()
+    out = subprocess.run([shell], input=script.encode(), cwd=playground,
+                         stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    wall = time.monotonic() - start
+
+    row = re.search(rb"^command\s+(\d+)\s+(\S+)\s+(\S+)\s+(\S+)\s+(\S+)",
+                    out.stdout, re.M)
+    if not row:
+        sys.exit(f"{shell}: no stats in the output")
+    count = int(row.group(1))
+    p50, p99, p999, top = (parse_duration(g.decode()) for g in row.groups()[1:])
+    return wall, count, p50, p99, p999, top
+
+
+def ms(seconds):
+    return f"{seconds * 1e3:9.3f}"
+
+
+def time_to_prompt(shell):
+    """Start the shell on a pseudo terminal and return the seconds until
+    its first prompt"""
+    start = time.monotonic()
+    pid, fd = pty.fork()
+    if pid == 0:
+        os.execv(shell, [shell])
+
+    seen = b""
+    elapsed = None
+    try:
+        while elapsed is None:
+            data = os.read(fd, 4096)
+            if not data:
+                break
+            seen += data
+            if b"#? " in seen:
+                elapsed = time.monotonic() - start
+        os.write(fd, b"exit\n")
+        while os.read(fd, 4096):
+            pass
+    except OSError:
+        pass        # EIO once the shell has gone
+    os.close(fd)
+    os.waitpid(pid, 0)
+    if elapsed is None:
+        sys.exit(f"{shell}: no prompt")
+    return elapsed
+
+
+def time_to_exit(shell):
+    """Return the seconds to run plaidsh -c true"""
+    start = time.monotonic()
+    subprocess.run([shell, "-c", "true"], check=True,
+                   stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL)
+    return time.monotonic() - start
+
+
+def startup(shell, n):
+    """Time n launches of the shell each way"""
+    print(f"{'startup':22} {'runs':>5} {'min ms':>9} {'p50 ms':>9} "
+          f"{'p90 ms':>9} {'max ms':>9}")
+    for name, run in [("exec to first prompt", time_to_prompt),
+                      ("exec to exit, -c true", time_to_exit)]:
+        times = sorted(run(shell) for _ in range(n))
+        print(f"{name:22} {n:5} {ms(times[0])} {ms(times[n // 2])} "
+              f"{ms(times[n * 9 // 10])} {ms(times[-1])}")
+
+
+# producer/consumer pipelines for --placement, and the bytes each moves
+PLACEMENT_MB = 256
+placement_pipelines = [
+    ("copy", f"head -c {PLACEMENT_MB}M /dev/zero | cat | cat | wc -c"),
+    ("compress", f"head -c {PLACEMENT_MB}M /dev/zero | gzip -1 | gzip -d "
+                 f"| wc -c"),
+]
+
+
+def time_pipeline(shell, mode, line):
+    """Return the seconds to run one pipeline under a placement mode"""
+    start = time.monotonic()
+    out = subprocess.run([shell, "-c", f"placement {mode}\n{line}"],
+                         check=True, stdin=subprocess.DEVNULL,
+                         capture_output=True, text=True).stdout
+    elapsed = time.monotonic() - start
+    if out.split()[-1] != str(PLACEMENT_MB << 20):
+        sys.exit(f"{line}: unexpected output {out!r}")
+    return elapsed
+
+
+def placement(shell, n):
+    """Time n runs of each pipeline with and without placement"""
+    print(f"{'pipeline':10} {'placement':>9} {'runs':>5} {'min s':>8} "
+          f"{'p50 s':>8} {'MB/s':>8}")
+    for name, line in placement_pipelines:
+        for mode in ("off", "auto"):
+            times = sorted(time_pipeline(shell, mode, line) for _ in range(n))
+            p50 = times[n // 2]
+            print(f"{name:10} {mode:>9} {n:5} {times[0]:8.3f} {p50:8.3f} "
+                  f"{PLACEMENT_MB / p50:8.1f}")
+
+
+def launch_phases(shell, mode, n):
+    """Run true n times under a zygote mode and return the stats
+    builtin's p50 and p99 for the launch phases, in seconds"""
+    script = f"zygote {mode}\n" + "true\n" * n + "stats\n"
+    out = subprocess.run([shell], input=script, capture_output=True,
+                         text=True, check=True).stdout
+    phases = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 6 and fields[0] in ("fork", "exec", "command"):
+            phases[fields[0]] = (parse_duration(fields[2]),
+                                 parse_duration(fields[3]))
+    return phases
+
+
+def zygote(shell, n):
+    """Compare launch latency with the zygote pool off and on"""
+    print(f"{'zygote':6} {'runs':>6} {'phase':8} {'p50 ms':>9} {'p99 ms':>9}")
+    for mode in ("off", "on"):
+        phases = launch_phases(shell, mode, n)
+        for phase in ("fork", "exec", "command"):
+            p50, p99 = phases[phase]
+            print(f"{mode:6} {n:6} {phase:8} {ms(p50)} {ms(p99)}")
+
+
+SERVER_COMMAND = "ls /usr/bin | wc -l"
+
+
+def server(shell, n):
+    """Time n runs of a command in fresh shells and through a server"""
+    sock = os.path.join(tempfile.mkdtemp(), "plaidsh.sock")
+    srv = subprocess.Popen([shell, "--serve", sock], stderr=subprocess.PIPE)
+    srv.stderr.readline()       # serving on ...
+
+    print(f"{'mode':14} {'runs':>5} {'min ms':>9} {'p50 ms':>9} "
+          f"{'p90 ms':>9} {'max ms':>9}")
+    for name, argv in [("fresh -c", [shell, "-c", SERVER_COMMAND]),
+                       ("--connect", [shell, "--connect", sock,
+                                      SERVER_COMMAND])]:
+        times = []
+        for _ in range(n):
+            start = time.monotonic()
+            subprocess.run(argv, check=True, stdin=subprocess.DEVNULL,
+                           stdout=subprocess.DEVNULL)
+            times.append(time.monotonic() - start)
+        times.sort()
+        print(f"{name:14} {n:5} {ms(times[0])} {ms(times[n // 2])} "
+              f"{ms(times[n * 9 // 10])} {ms(times[-1])}")
+
+    srv.terminate()
+    srv.wait()
+    os.rmdir(os.path.dirname(sock))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="End-to-end throughput benchmark for plaidsh")
+    parser.add_argument("shell", nargs="?", default="./plaidsh")
+    parser.add_argument("-n", type=int, default=1000,
+                        help="command lines per workload")
+    parser.add_argument("--files", type=int, default=10000,
+                        help="files in the synthetic tree")
+    parser.add_argument("--startup", action="store_true",
+                        help="time startup instead, over -n launches")
+    parser.add_argument("--placement", action="store_true",
+                        help="time pipelines with and without placement "
+                             "instead, over -n runs")
+    parser.add_argument("--zygote", action="store_true",
+                        help="compare launch latency with and without the "
+                             "zygote pool instead, over -n runs")
+    parser.add_argument("--server", action="store_true",
+                        help="compare fresh shells with a server instead, "
+                             "over -n runs")
+    args = parser.parse_args()
+
+    shell = os.path.abspath(args.shell)
+    if args.startup:
+        startup(shell, args.n)
+        return
+    if args.placement:
+        placement(shell, args.n)
+        return
+    if args.zygote:
+        zygote(shell, args.n)
+        return
+    if args.server:
+        server(shell, args.n)
+        return
+
+    subprocess.run([setup_script], check=True, stdout=subprocess.DEVNULL)
+    make_tree(args.files)
+
+    print(f"{'workload':10} {'lines':>7} {'wall s':>8} {'cmds/s':>9} "
+          f"{'p50 ms':>9} {'p99 ms':>9} {'p99.9 ms':>9} {'max ms':>9}")
+    for name, lines in workloads:
+        wall, count, p50, p99, p999, top = run_workload(shell, lines, args.n)
+        if count != args.n:
+            print(f"{name}: stats counted {count} of {args.n} lines")
+        print(f"{name:10} {args.n:7} {wall:8.3f} {args.n / wall:9.1f} "
+              f"{ms(p50)} {ms(p99)} {ms(p999)} {ms(top)}")
+
+    shutil.rmtree(playground, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()
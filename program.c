@@ -0,0 +1,1458 @@
+/*
+ * program.c
+ *
+ * Pipelines compiled to a flat list of instructions, run by a single
+ * executor loop
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE     // pipe2, memfd_create
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "program.h"
+#include "globcache.h"
+#include "brace.h"
+#include "stats.h"
+#include "trace.h"
+#include "perfstat.h"
+#include "memstats.h"
+#include "meter.h"
+#include "cmdlog.h"
+#include "jobserver.h"
+#include "placement.h"
+#include "limit.h"
+#include "zygote.h"
+
+
+#define __builtin_auth "echo"
+#define         AUTHOR "Jean Baptiste Kwizera"
+#define   HASH_BUCKETS 64
+#define CHUNK_MAX_JOBS 1024
+
+
+typedef int (*builtin_fn)(int argc, char** argv);
+
+struct _instr {
+    Opcode op;
+    int argc;
+    char** argv;            // INS_SPAWN, INS_BUILTIN: NULL terminated
+    char* path;             // INS_OPEN_IN, INS_OPEN_OUT: the file
+                            // INS_SPAWN: resolved executable, or NULL
+    builtin_fn builtin;     // INS_BUILTIN
+    bool* lazy;             // INS_SPAWN, INS_BUILTIN: which argv entries are
+                            // brace words to expand at run time, or NULL
+    int chunk;              // INS_SPAWN: parallel execs to split an oversized
+                            // argv over, 0 to run a single exec
+    int chunk_lo;           // INS_SPAWN: argv[chunk_lo, chunk_hi) are the
+    int chunk_hi;           // arguments split between the execs
+    StagePolicy policy;     // INS_SPAWN: placement and scheduling, or NULL
+    bool report;            // INS_BUILTIN: only prints, so it may run in a
+                            // child when piped
+};
+
+struct _program {
+    struct _instr* code;
+    int len;
+    int cap;
+    int nspawn;             // number of INS_SPAWN instructions
+    bool failed;            // a command did not compile, so none run
+};
+
+// Executor state carried from one instruction to the next
+struct _regs {
+    int in_fd;              // stdin of the next stage, -1 to inherit
+    int out_fd;             // stdout of the next stage, -1 to inherit
+    int next_in;            // read end of the pipe the next stage writes
+    const char* infile;     // pending < redirection
+    const char* outfile;    // pending > redirection
+    uint64_t* exec_at;      // where the next stage records its exec, or NULL
+};
+
+
+/*
+ * The command hash: command names resolved against PATH, so that
+ * SPAWN can execv without searching. Cleared whenever PATH changes.
+ */
+struct _hash_entry {
+    char* name;
+    char* path;
+    unsigned long hits;
+    struct _hash_entry* next;
+};
+
+static struct {
+    char* pathvar;
+    struct _hash_entry* buckets[HASH_BUCKETS];
+} cmdhash;
+
+
+
+/*
+ * FNV-1a hash of a string, for the command hash
+ */
+static unsigned long hash_str(const char* s)
+{
+    unsigned long h = 14695981039346656037ul;
+    while (*s) h = (h ^ (unsigned char) *s++) * 1099511628211ul;
+    return h;
+}
+
+
+static void hash_clear()
+{
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        while (cmdhash.buckets[i]) {
+            struct _hash_entry* e = cmdhash.buckets[i];
+            cmdhash.buckets[i] = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+        }
+    }
+    free(cmdhash.pathvar);
+    cmdhash.pathvar = NULL;
+}
+
+
+/*
+ * Resolve a command name against PATH, through the command hash
+ *
+ * Parameters:
+ *  name        The command name, argv[0]
+ *
+ * Returns:
+ *  const char* The executable to run, or NULL if the name contains a
+ *              '/', is not found, or its resolution depends on the
+ *              working directory. In those cases execvp decides.
+ */
+static const char* hash_lookup(const char* name)
+{
+    const char* pathvar = getenv("PATH");
+    if (!pathvar || !*name || strchr(name, '/')) return NULL;
+
+    if (!cmdhash.pathvar || strcmp(cmdhash.pathvar, pathvar)) {
+        hash_clear();
+        cmdhash.pathvar = strdup(pathvar);
+    }
+
+    unsigned long bucket = hash_str(name) % HASH_BUCKETS;
+    for (struct _hash_entry* e = cmdhash.buckets[bucket]; e; e = e->next) {
+        if (!strcmp(e->name, name)) {
+            e->hits++;
+            return e->path;
+        }
+    }
+
+    size_t namelen = strlen(name);
+    for (const char* dir = pathvar; ; ) {
+        const char* end = strchr(dir, ':');
+        size_t dirlen = end? end - dir: strlen(dir);
+
+        // a relative entry makes the answer depend on the cwd
+        if (!dirlen || *dir != '/') return NULL;
+
+        char candidate[dirlen + namelen + 2];
+        memcpy(candidate, dir, dirlen);
+        candidate[dirlen] = '/';
+        strcpy(candidate + dirlen + 1, name);
+
+        struct stat st;
+        if (!access(candidate, X_OK) && !stat(candidate, &st) &&
+                S_ISREG(st.st_mode)) {
+            struct _hash_entry* e = malloc(sizeof(struct _hash_entry));
+            assert(e);
+            e->name = strdup(name);
+            e->path = strdup(candidate);
+            e->hits = 0;
+            e->next = cmdhash.buckets[bucket];
+            cmdhash.buckets[bucket] = e;
+            return e->path;
+        }
+
+        if (!end) return NULL;
+        dir = end + 1;
+    }
+}
+
+
+static int builtin_exit(int argc, char** argv)
+{
+    // a script's output may still be buffered
+    fflush(stdout);
+    TR_stop();
+    LOG_stop();
+    _exit(0);
+}
+
+
+static int builtin_cd(int argc, char** argv)
+{
+    char* dirpath = argv[1];
+    if (dirpath == NULL) dirpath = getenv("HOME");
+    if (chdir(dirpath)) {
+        perror("cd");
+        return 1;
+    }
+    GC_chdir();
+    ZY_flush();
+    return 0;
+}
+
+
+static int builtin_globcache(int argc, char** argv)
+{
+    if (argv[1] && !strcmp(argv[1], "flush")) GC_flush();
+    else GC_print_stats(stdout);
+    return 0;
+}
+
+
+static int builtin_hash(int argc, char** argv)
+{
+    if (argv[1] && !strcmp(argv[1], "-r")) {
+        hash_clear();
+        return 0;
+    }
+    for (int i = 0; i < HASH_BUCKETS; i++)
+        for (struct _hash_entry* e = cmdhash.buckets[i]; e; e = e->next)
+            printf("%4lu\t%s\n", e->hits, e->path);
+    return 0;
+}
+
+
+static int builtin_stats(int argc, char** argv)
+{
+    if (argv[1] && !strcmp(argv[1], "reset")) ST_reset();
+    else ST_print(stdout);
+    return 0;
+}
+
+
+static int builtin_trace(int argc, char** argv)
+{
+    if (argc == 3 && !strcmp(argv[1], "start")) {
+        if (!TR_start(argv[2])) {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+    else if (argc == 2 && !strcmp(argv[1], "stop")) TR_stop();
+    else {
+        printf("usage: trace start FILE | trace stop\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+static int builtin_cmdlog(int argc, char** argv)
+{
+    if (argc == 3 && !strcmp(argv[1], "start")) {
+        if (!LOG_start(argv[2])) {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+    else if (argc == 2 && !strcmp(argv[1], "stop")) LOG_stop();
+    else {
+        printf("usage: cmdlog start FILE | cmdlog stop\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+static int builtin_jobserver(int argc, char** argv)
+{
+    char* end = NULL;
+    long jobs = argc == 2? strtol(argv[1], &end, 10): 0;
+    if (argc == 1) {
+        if (JS_serving()) printf("serving %d jobs\n", JS_serving());
+        else printf("jobserver is %s\n", JS_active()? "inherited": "off");
+    }
+    else if (argc == 2 && !strcmp(argv[1], "off")) JS_stop_serving();
+    else if (argc == 2 && !*end && jobs >= 1 && jobs <= 4096) {
+        JS_stop_serving();
+        if (!JS_serve(jobs)) {
+            printf("jobserver: already a client of make's\n");
+            return 1;
+        }
+    }
+    else {
+        printf("usage: jobserver [JOBS | off]\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+static int builtin_perfstat(int argc, char** argv)
+{
+    if (argc == 2 && !strcmp(argv[1], "on")) PF_set_enabled(true);
+    else if (argc == 2 && !strcmp(argv[1], "off")) PF_set_enabled(false);
+    else if (argc == 1) printf("perfstat is %s\n", PF_enabled()? "on": "off");
+    else {
+        printf("usage: perfstat [on | off]\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+static int builtin_memstats(int argc, char** argv)
+{
+    MEM_print(stdout);
+    return 0;
+}
+
+
+static int builtin_meter(int argc, char** argv)
+{
+    static const char* modes[] = {"off", "on", "live"};
+    if (argc == 1) {
+        printf("meter is %s\n", modes[MT_mode()]);
+        return 0;
+    }
+    for (int m = MT_OFF; argc == 2 && m <= MT_LIVE; m++)
+        if (!strcmp(argv[1], modes[m])) {
+            MT_set_mode(m);
+            return 0;
+        }
+    printf("usage: meter [on | off | live]\n");
+    return 1;
+}
+
+
+static int builtin_placement(int argc, char** argv)
+{
+    if (argc == 2 && !strcmp(argv[1], "auto")) PL_set_auto(true);
+    else if (argc == 2 && !strcmp(argv[1], "off")) PL_set_auto(false);
+    else if (argc == 1) {
+        printf("placement is %s", PL_auto()? "auto": "off");
+        for (int i = 0; PL_auto() && i < 64 && PL_cpu(i) != -1; i++) {
+            if (i && PL_cpu(i) == PL_cpu(0)) break;
+            printf("%s%d", i? " ": ": cpus ", PL_cpu(i));
+        }
+        printf("\n");
+    }
+    else {
+        printf("usage: placement [auto | off]\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+static void zygote_stage(char* msg, size_t len, int* fds, int nfds);
+
+static int builtin_zygote(int argc, char** argv)
+{
+    char* end = NULL;
+    long size = argc == 2? strtol(argv[1], &end, 10): -1;
+    if (argc == 2 && !strcmp(argv[1], "on")) ZY_start(ZY_DEFAULT_SIZE, zygote_stage);
+    else if (argc == 2 && !strcmp(argv[1], "off")) ZY_stop();
+    else if (argc == 2 && !*end && size >= 0 && size <= ZY_MAX_SIZE)
+        ZY_start(size, zygote_stage);
+    else if (argc == 1) {
+        if (ZY_size()) printf("zygote is on: %d of %d workers ready\n",
+            ZY_ready(), ZY_size());
+        else printf("zygote is off\n");
+    }
+    else {
+        printf("usage: zygote [on | off | WORKERS]\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+// builtin commands - manipulating shell require no forking; those that
+// report only print when given no arguments
+static const struct {
+    const char* name;
+    builtin_fn fn;
+    bool report;
+} builtins[] = {
+    {"exit",      builtin_exit,      false},
+    {"quit",      builtin_exit,      false},
+    {"cd",        builtin_cd,        false},
+    {"globcache", builtin_globcache, true},
+    {"hash",      builtin_hash,      true},
+    {"stats",     builtin_stats,     true},
+    {"trace",     builtin_trace,     false},
+    {"cmdlog",    builtin_cmdlog,    false},
+    {"jobserver", builtin_jobserver, true},
+    {"perfstat",  builtin_perfstat,  true},
+    {"memstats",  builtin_memstats,  true},
+    {"meter",     builtin_meter,     true},
+    {"placement", builtin_placement, true},
+    {"zygote",    builtin_zygote,    true},
+};
+
+
+static void emit(Program prog, struct _instr ins)
+{
+    if (prog->len == prog->cap) {
+        prog->cap = prog->cap? 2 * prog->cap: 8;
+        prog->code = MEM_realloc(prog->code, prog->cap * sizeof(struct _instr));
+        assert(prog->code);
+    }
+    prog->code[prog->len++] = ins;
+}
+
+
+/*
+ * Remove a "chunk [-P N]" prefix from a command
+ *
+ * Parameters:
+ *  argcp       The number of arguments, updated
+ *  argv        The arguments, shifted down over the prefix
+ *  lazy        The brace word markers of argv, shifted with it, or NULL
+ *  chunkp      Return space for the number of parallel execs: 1 when
+ *              the prefix has no -P, the number of CPUs for -P 0, at
+ *              most CHUNK_MAX_JOBS, and left as is when there is no
+ *              prefix
+ *
+ * Returns:
+ *  bool        false if N is not a job count, reported on stderr
+ */
+static bool strip_chunk(int* argcp, char** argv, bool* lazy, int* chunkp)
+{
+    int argc = *argcp;
+    if (!argc || strcmp(argv[0], "chunk")) return true;
+
+    int prefix = 1;
+    *chunkp = 1;
+    if (argc >= 3 && !strcmp(argv[1], "-P")) {
+        char* end;
+        long n = strtol(argv[2], &end, 10);
+        if (end == argv[2] || *end || n < 0) {
+            fprintf(stderr, "plaidsh: -P %s: not a job count\n", argv[2]);
+            return false;
+        }
+        if (n == 0) n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n <= 0) n = 1;
+        *chunkp = n > CHUNK_MAX_JOBS? CHUNK_MAX_JOBS: n;
+        prefix = 3;
+    }
+
+    for (int i = 0; i < prefix; i++)
+        MEM_free(argv[i]);
+    memmove(argv, argv + prefix, (argc - prefix + 1) * sizeof(char*));
+    if (lazy) memmove(lazy, lazy + prefix, (argc - prefix) * sizeof(bool));
+    *argcp = argc - prefix;
+    return true;
+}
+
+
+/*
+ * Compile one command of a pipeline: its redirections, the pipe to the
+ * next command if there is one, then the SPAWN or BUILTIN itself
+ *
+ * Parameters:
+ *  prog        The program to append to
+ *  cmd         The first node of the command
+ *  piped       Whether another command follows this one
+ *
+ * Returns:
+ *  bool        false if the command is malformed, reported on stderr
+ */
+static bool compile_command(Program prog, AST cmd, bool piped)
+{
+    int n = 0;
+    for (AST node = cmd; node; node = AST_right(node))
+        n++;
+
+    int argc = 0;
+    char** argv = MEM_malloc((n + 1) * sizeof(char*));
+    assert(argv);
+    bool* lazy = NULL;
+    int first = -1, last = -1;  // the expanded arguments
+
+    for (AST node = cmd; node; node = AST_right(node)) {
+        ASTNodeType type = AST_type(node);
+        if (type == OP_LESSTHAN || type == OP_GREATERTHAN) {
+            node = AST_right(node);
+            emit(prog, (struct _instr) {
+                .op = type == OP_LESSTHAN? INS_OPEN_IN: INS_OPEN_OUT,
+                .path = MEM_strdup(AST_value(node))});
+        }
+        else {
+            if (AST_expanded(node)) {
+                if (first == -1) first = argc;
+                last = argc;
+            }
+            if (type == BRACE_WORD) {
+                if (!lazy) lazy = MEM_calloc(n, sizeof(bool));
+                assert(lazy);
+                lazy[argc] = true;
+            }
+            argv[argc++] = MEM_strdup(AST_value(node));
+        }
+    }
+    argv[argc] = NULL;
+
+    if (piped) emit(prog, (struct _instr) {.op = INS_PIPE});
+
+    int chunk = 0;
+    int typed = argc;
+    StagePolicy policy;
+    bool ok = PL_strip(&argc, argv, lazy, &policy) &&
+        strip_chunk(&argc, argv, lazy, &chunk);
+    int prefix = typed - argc;
+    if (ok && argc == 0) fprintf(stderr, "plaidsh: missing command\n");
+    if (!ok || argc == 0) {
+        for (int i = 0; i < argc; i++)
+            MEM_free(argv[i]);
+        MEM_free(argv);
+        MEM_free(lazy);
+        PL_free(policy);
+        return false;
+    }
+
+    // a command name that is itself a brace word is only known at run time
+    if (lazy && lazy[0]) {
+        emit(prog, (struct _instr) {INS_SPAWN, argc, argv, NULL, NULL, lazy,
+            .policy = policy});
+        prog->nspawn++;
+        return true;
+    }
+
+    // builtins run in the shell itself, which placement must not move
+    for (int i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (!strcmp(argv[0], builtins[i].name)) {
+            PL_free(policy);
+            emit(prog, (struct _instr) {INS_BUILTIN, argc, argv,
+                NULL, builtins[i].fn, lazy,
+                .report = builtins[i].report && argc == 1});
+            return true;
+        }
+    }
+
+    if (!strcmp(argv[0], "author")) {
+        MEM_free(lazy);
+        lazy = NULL;
+        for (int i = 0; i < argc; i++)
+            MEM_free(argv[i]);
+        argc = 2;
+        argv = MEM_realloc(argv, (argc + 1) * sizeof(char*));
+        assert(argv);
+        argv[0] = MEM_strdup(__builtin_auth);
+        argv[1] = MEM_strdup(AUTHOR);
+        argv[2] = NULL;
+    }
+
+    // split the expanded arguments, and any typed ones between them; the
+    // arguments before and after go into every exec, like xargs' initial
+    // arguments
+    int chunk_lo = 1, chunk_hi = argc;
+    if (chunk && first - prefix >= 1) {
+        chunk_lo = first - prefix;
+        chunk_hi = last - prefix + 1;
+    }
+
+    const char* path = hash_lookup(argv[0]);
+    emit(prog, (struct _instr) {INS_SPAWN, argc, argv,
+        path? MEM_strdup(path): NULL, NULL, lazy, chunk, chunk_lo, chunk_hi,
+        policy});
+    prog->nspawn++;
+    return true;
+}
+
+
+// Documented in .h file
+Program PRG_compile(AST pipeline)
+{
+    Program prog = MEM_calloc(1, sizeof(struct _program));
+    assert(prog);
+    if (!pipeline) return prog;
+
+    // commands hang off the left-associative pipe nodes, last one first
+    int n = AST_countcommands(pipeline);
+    AST cmds[n];
+    for (int i = n - 1; i >= 0; i--) {
+        if (AST_type(pipeline) == OP_PIPE) {
+            cmds[i] = AST_right(pipeline);
+            pipeline = AST_left(pipeline);
+        }
+        else cmds[i] = pipeline;
+    }
+
+    // a malformed command leaves nothing to run, not a broken pipeline
+    for (int i = 0; i < n; i++) {
+        if (!compile_command(prog, cmds[i], i < n - 1)) {
+            PRG_free(prog);
+            prog = MEM_calloc(1, sizeof(struct _program));
+            assert(prog);
+            prog->failed = true;
+            return prog;
+        }
+    }
+    emit(prog, (struct _instr) {.op = INS_WAIT});
+
+    return prog;
+}
+
+
+// Documented in .h file
+void PRG_free(Program prog)
+{
+    if (!prog) return;
+    for (int i = 0; i < prog->len; i++) {
+        struct _instr* ins = &prog->code[i];
+        for (int j = 0; j < ins->argc; j++)
+            MEM_free(ins->argv[j]);
+        MEM_free(ins->argv);
+        MEM_free(ins->path);
+        MEM_free(ins->lazy);
+        PL_free(ins->policy);
+    }
+    MEM_free(prog->code);
+    MEM_free(prog);
+}
+
+
+/*
+ * A growable argv, filled in by expand_args
+ */
+struct _args {
+    char** argv;
+    int argc;
+    int cap;
+    size_t bytes;           // space the strings and pointers take in exec
+    size_t limit;
+};
+
+
+/*
+ * Append a copy of one argument, unless it would take the argument list
+ * past the limit
+ *
+ * Returns:
+ *  bool        false if the argument did not fit
+ */
+static bool args_push(struct _args* args, const char* arg)
+{
+    size_t need = strlen(arg) + 1 + sizeof(char*);
+    if (args->bytes + need > args->limit) return false;
+    args->bytes += need;
+
+    if (args->argc + 1 >= args->cap) {
+        args->cap = args->cap? 2 * args->cap: 16;
+        args->argv = MEM_realloc(args->argv, args->cap * sizeof(char*));
+        assert(args->argv);
+    }
+    args->argv[args->argc++] = MEM_strdup(arg);
+    args->argv[args->argc] = NULL;
+    return true;
+}
+
+
+static void args_free(struct _args* args)
+{
+    for (int i = 0; i < args->argc; i++)
+        MEM_free(args->argv[i]);
+    MEM_free(args->argv);
+}
+
+
+/*
+ * The space exec leaves for arguments: ARG_MAX less what the
+ * environment already takes
+ */
+static size_t args_limit()
+{
+    extern char** environ;
+    long arg_max = sysconf(_SC_ARG_MAX);
+    size_t limit = arg_max > 0? arg_max: _POSIX_ARG_MAX;
+
+    // the headroom POSIX asks for, as xargs leaves
+    limit = limit > 2048? limit - 2048: 0;
+    for (char** env = environ; *env; env++) {
+        size_t need = strlen(*env) + 1 + sizeof(char*);
+        limit = limit > need? limit - need: 0;
+    }
+    return limit;
+}
+
+
+/*
+ * A source of arguments: a range of an instruction's argv, with brace
+ * words generated and globbed one word at a time, so that an expansion
+ * is never held in memory whole
+ */
+struct _argsrc {
+    struct _instr* ins;
+    int next;               // the next argv entry
+    int end;
+    Brace br;               // the brace word being generated, or NULL
+    glob_t pglob;           // matches of the last generated word
+    size_t nglob;           // matches handed out so far
+    bool globbed;
+};
+
+
+/*
+ * Produce the next argument of a source
+ *
+ * Returns:
+ *  const char* The argument, valid until the following call on src, or
+ *              NULL once the range is exhausted
+ */
+static const char* argsrc_next(struct _argsrc* src)
+{
+    for (;;) {
+        if (src->globbed) {
+            if (src->nglob < src->pglob.gl_pathc)
+                return src->pglob.gl_pathv[src->nglob++];
+            globfree(&src->pglob);
+            src->globbed = false;
+        }
+
+        if (src->br) {
+            const char* gen = BR_next(src->br);
+            if (!gen) {
+                BR_free(src->br);
+                src->br = NULL;
+                continue;
+            }
+            if (!strpbrk(gen, "*?[~")) return gen;
+
+            if (GC_glob(gen, GLOB_TILDE_CHECK | GLOB_NOCHECK, &src->pglob)) {
+                globfree(&src->pglob);
+                return gen;
+            }
+            src->nglob = 0;
+            src->globbed = true;
+            continue;
+        }
+
+        if (src->next == src->end) return NULL;
+        int i = src->next++;
+        if (!src->ins->lazy || !src->ins->lazy[i]) return src->ins->argv[i];
+        src->br = BR_new(src->ins->argv[i]);
+        assert(src->br);
+    }
+}
+
+
+static void argsrc_free(struct _argsrc* src)
+{
+    if (src->globbed) globfree(&src->pglob);
+    BR_free(src->br);
+}
+
+
+/*
+ * Build the argv of an instruction with brace words, expanding them
+ *
+ * Parameters:
+ *  ins         The SPAWN or BUILTIN instruction
+ *  args        Return space for the argv, to be released with args_free
+ *
+ * Returns:
+ *  bool        false if the expanded arguments exceed what exec accepts
+ */
+static bool expand_args(struct _instr* ins, struct _args* args)
+{
+    *args = (struct _args) {.limit = args_limit()};
+    struct _argsrc src = {ins, 0, ins->argc};
+
+    bool fits = true;
+    const char* arg;
+    while (fits && (arg = argsrc_next(&src)))
+        fits = args_push(args, arg);
+
+    argsrc_free(&src);
+    return fits;
+}
+
+
+/*
+ * Child side of a stage: wire up stdin/stdout from the pipes and the
+ * pending redirections. Exits on failure.
+ *
+ * Parameters:
+ *  regs        The executor state for this stage
+ */
+static void stage_wire(struct _regs* regs)
+{
+    // pipe fds are close-on-exec; only the dup2'd copies survive exec
+    if (regs->in_fd != -1) dup2(regs->in_fd, STDIN_FILENO);
+    if (regs->out_fd != -1) dup2(regs->out_fd, STDOUT_FILENO);
+
+    // input redirection
+    if (regs->infile) {
+        int ifd = open(regs->infile, O_RDONLY);
+        if (ifd == -1) {
+            perror("open");
+            printf("%s: Permission denied\n", regs->infile);
+            fflush(stdout);
+            _exit(EXIT_FAILURE);
+        }
+        dup2(ifd, STDIN_FILENO);
+        close(ifd);
+    }
+
+    // output redirection
+    if (regs->outfile) {
+        int ofd = open(regs->outfile, O_RDWR | O_CREAT | O_TRUNC,
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        if (ofd == -1) {
+            printf("%s: Permission denied\n", regs->outfile);
+            fflush(stdout);
+            _exit(EXIT_FAILURE);
+        }
+        dup2(ofd, STDOUT_FILENO);
+        close(ofd);
+    }
+}
+
+
+/*
+ * Exec a command in a child process. Does not return.
+ *
+ * Parameters:
+ *  path        The executable resolved through the command hash, or NULL
+ *  argv        The arguments, NULL terminated
+ */
+static void exec_argv(const char* path, char** argv)
+{
+    // a stale hash entry falls back to a PATH search
+    if (path) execv(path, argv);
+    execvp(argv[0], argv);
+    if (errno == ENOENT)
+        printf("%s: Command not found."
+            "*Child.*exited with status %d\n", argv[0], errno);
+    else
+        perror(argv[0]);
+    fflush(stdout);
+    _exit(EXIT_FAILURE);
+}
+
+
+/*
+ * Child side of INS_SPAWN: wire up stdin/stdout and exec. Does not
+ * return.
+ *
+ * Parameters:
+ *  ins         The SPAWN instruction
+ *  regs        The executor state for this stage
+ */
+static void stage_exec(struct _instr* ins, struct _regs* regs)
+{
+    stage_wire(regs);
+    if (regs->exec_at) *regs->exec_at = ST_now();
+    exec_argv(ins->path, ins->argv);
+}
+
+
+/*
+ * A stage as sent to a zygote worker: this header, then the strings
+ * that are present, NUL terminated, in the order path, infile, outfile,
+ * argv, environment. The worker's fds are stdin, stdout and stderr.
+ */
+struct _stage_msg {
+    int argc;
+    int envc;
+    int exec_slot;          // index into ST_exec_slots, or -1
+    bool has_path;
+    bool has_infile;
+    bool has_outfile;
+};
+
+
+/*
+ * Whether a SPAWN can go to a zygote worker, which knows nothing of the
+ * shell's state since it was forked beyond what the message carries,
+ * and holds none of its fds: not even the jobserver's, which MAKEFLAGS
+ * would still name
+ */
+static bool zygote_ok(struct _instr* ins)
+{
+    return ZY_ready() && !ins->chunk && !ins->policy && !PL_auto() &&
+        !LIM_active() && !JS_active();
+}
+
+
+/*
+ * Worker side of a zygote SPAWN: unpack the stage and exec it like a
+ * forked child would. Does not return.
+ */
+static void zygote_stage(char* msg, size_t len, int* fds, int nfds)
+{
+    struct _stage_msg hdr;
+    if (nfds != 3 || len < sizeof(hdr)) _exit(EXIT_FAILURE);
+    for (int fd = 0; fd < 3; fd++) {
+        dup2(fds[fd], fd);
+        close(fds[fd]);
+    }
+
+    memcpy(&hdr, msg, sizeof(hdr));
+    char* p = msg + sizeof(hdr);
+    char* argv[hdr.argc + 1];
+    char** envp = malloc((hdr.envc + 1) * sizeof(char*));
+    if (!envp) _exit(EXIT_FAILURE);
+    char* path = NULL;
+    struct _regs regs = {-1, -1, -1, NULL, NULL, NULL};
+    if (hdr.has_path) p += strlen(path = p) + 1;
+    if (hdr.has_infile) p += strlen(regs.infile = p) + 1;
+    if (hdr.has_outfile) p += strlen(regs.outfile = p) + 1;
+    for (int i = 0; i < hdr.argc; i++)
+        p += strlen(argv[i] = p) + 1;
+    argv[hdr.argc] = NULL;
+    for (int i = 0; i < hdr.envc; i++)
+        p += strlen(envp[i] = p) + 1;
+    envp[hdr.envc] = NULL;
+    environ = envp;
+
+    if (hdr.exec_slot >= 0) regs.exec_at = ST_exec_slots() + hdr.exec_slot;
+    struct _instr ins = {INS_SPAWN, hdr.argc, argv, path};
+    stage_exec(&ins, &regs);
+}
+
+
+/*
+ * Parent side of a zygote SPAWN: hand the stage to an idle worker
+ *
+ * Returns:
+ *  pid_t       The worker, now the stage's process, or -1 to fork
+ *              instead
+ */
+static pid_t zygote_spawn(struct _instr* ins, struct _regs* regs)
+{
+    int envc = 0;
+    size_t len = sizeof(struct _stage_msg);
+    for (char** e = environ; *e; e++, envc++)
+        len += strlen(*e) + 1;
+    const char* strs[] = {ins->path, regs->infile, regs->outfile};
+    for (int i = 0; i < 3; i++)
+        if (strs[i]) len += strlen(strs[i]) + 1;
+    for (int i = 0; i < ins->argc; i++)
+        len += strlen(ins->argv[i]) + 1;
+
+    char* msg = malloc(len);
+    assert(msg);
+    struct _stage_msg hdr = {ins->argc, envc,
+        regs->exec_at? regs->exec_at - ST_exec_slots(): -1,
+        ins->path != NULL, regs->infile != NULL, regs->outfile != NULL};
+    memcpy(msg, &hdr, sizeof(hdr));
+    char* p = msg + sizeof(hdr);
+    for (int i = 0; i < 3; i++)
+        if (strs[i]) p = stpcpy(p, strs[i]) + 1;
+    for (int i = 0; i < ins->argc; i++)
+        p = stpcpy(p, ins->argv[i]) + 1;
+    for (char** e = environ; *e; e++)
+        p = stpcpy(p, *e) + 1;
+
+    int fds[3] = {regs->in_fd != -1? regs->in_fd: STDIN_FILENO,
+        regs->out_fd != -1? regs->out_fd: STDOUT_FILENO, STDERR_FILENO};
+    pid_t pid = ZY_spawn(msg, len, fds, 3);
+    free(msg);
+    return pid;
+}
+
+
+/*
+ * Fill the argv of the next chunk: the arguments before chunk_lo, as
+ * many of the split arguments as fit, then the arguments from chunk_hi
+ *
+ * Parameters:
+ *  ins         The chunked SPAWN instruction
+ *  src         The source of the split arguments
+ *  pendingp    The argument that did not fit in the previous chunk, or
+ *              NULL; updated with the one that does not fit in this one
+ *  args        Return space for the argv, to be released with args_free
+ *
+ * Returns:
+ *  int         The number of split arguments in the chunk, or -1 if a
+ *              single argument is too long for exec
+ */
+static int chunk_fill(struct _instr* ins, struct _argsrc* src,
+        const char** pendingp, struct _args* args)
+{
+    size_t limit = args_limit();
+    *args = (struct _args) {.limit = limit};
+
+    // reserve room for the fixed arguments after the split ones
+    size_t reserve = 0;
+    for (int i = ins->chunk_hi; i < ins->argc; i++)
+        reserve += strlen(ins->argv[i]) + 1 + sizeof(char*);
+    args->limit = reserve < limit? limit - reserve: 0;
+
+    for (int i = 0; i < ins->chunk_lo; i++)
+        if (!args_push(args, ins->argv[i])) return -1;
+
+    int n = 0;
+    const char* arg = *pendingp? *pendingp: argsrc_next(src);
+    for (; arg; arg = argsrc_next(src), n++)
+        if (!args_push(args, arg)) break;
+    if (arg && !n) return -1;
+    *pendingp = arg;
+
+    args->limit = limit;
+    for (int i = ins->chunk_hi; i < ins->argc; i++)
+        args_push(args, ins->argv[i]);
+    return n;
+}
+
+
+/*
+ * Copy what a finished chunk wrote into its buffer to stdout
+ */
+static void chunk_flush(int fd)
+{
+    char buf[BUFSIZ];
+    ssize_t n;
+    lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        for (ssize_t off = 0, w; off < n; off += w)
+            if ((w = write(STDOUT_FILENO, buf + off, n - off)) <= 0) return;
+}
+
+
+/*
+ * Child side of a chunked INS_SPAWN: split the arguments into as many
+ * execs as the kernel's argument limit requires, xargs style. With one
+ * job the execs run one after another straight into the stage's stdout;
+ * with more, up to ins->chunk run at once, each into a buffer of its
+ * own, and the buffers are copied out in argument order. Chunks are
+ * expanded only as they are started. Does not return.
+ *
+ * Parameters:
+ *  ins         The SPAWN instruction
+ *  regs        The executor state for this stage
+ */
+static void stage_chunked(struct _instr* ins, struct _regs* regs)
+{
+    stage_wire(regs);
+
+    struct _chunk_job {
+        pid_t pid;
+        int fd;             // output buffer, -1 when writing to stdout
+        int status;
+        bool done;
+        bool token;         // holds a jobserver token
+    }* jobs = malloc(ins->chunk * sizeof(struct _chunk_job));
+    if (!jobs) {
+        perror("malloc");
+        _exit(EXIT_FAILURE);
+    }
+    int head = 0, running = 0;
+    bool implicit_in_use = false;   // a chunk runs on the free slot
+
+    struct _argsrc src = {ins, ins->chunk_lo, ins->chunk_hi};
+    const char* pending = NULL;
+    bool more = true, first = true;
+    int exit_val = 0;
+
+    while (more || running) {
+        // while a chunk holds the free slot, each other one needs a
+        // jobserver token; without one, wait for a running chunk instead
+        bool token = false;
+        bool start = more && running < ins->chunk;
+        if (start && implicit_in_use && JS_active())
+            start = token = JS_try_acquire();
+
+        if (start) {
+            struct _args args;
+            int n = chunk_fill(ins, &src, &pending, &args);
+            if (n == -1) {
+                printf("%s: Argument too long\n", ins->argv[0]);
+                exit_val = EXIT_FAILURE;
+            }
+            more = pending != NULL;
+            if (n == -1 || (n == 0 && !first)) {
+                args_free(&args);
+                if (token) JS_release();
+                more = false;
+                continue;
+            }
+            first = false;
+
+            int fd = -1;
+            if (ins->chunk > 1) {
+                fd = memfd_create("chunk", MFD_CLOEXEC);
+                if (fd == -1) {
+                    perror("memfd_create");
+                    _exit(EXIT_FAILURE);
+                }
+            }
+
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == -1) {
+                perror("fork");
+                _exit(EXIT_FAILURE);
+            }
+            if (pid == 0) {
+                if (fd != -1) dup2(fd, STDOUT_FILENO);
+                exec_argv(ins->path, args.argv);
+            }
+            args_free(&args);
+
+            int slot = (head + running++) % ins->chunk;
+            jobs[slot].pid = pid;
+            jobs[slot].fd = fd;
+            jobs[slot].done = false;
+            jobs[slot].token = token;
+            if (!token) implicit_in_use = true;
+            continue;
+        }
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < running; i++) {
+            int slot = (head + i) % ins->chunk;
+            if (jobs[slot].pid != pid) continue;
+            jobs[slot].status = status;
+            jobs[slot].done = true;
+            if (jobs[slot].token) JS_release();
+            else implicit_in_use = false;
+        }
+
+        // hand on output in order, as soon as the oldest chunk is done
+        while (running && jobs[head].done) {
+            if (jobs[head].fd != -1) {
+                chunk_flush(jobs[head].fd);
+                close(jobs[head].fd);
+            }
+            if (WEXITSTATUS(jobs[head].status))
+                exit_val = WEXITSTATUS(jobs[head].status);
+            head = (head + 1) % ins->chunk;
+            running--;
+        }
+    }
+
+    argsrc_free(&src);
+    free(jobs);
+    fflush(stdout);
+    _exit(exit_val);
+}
+
+
+/*
+ * INS_BUILTIN: run a builtin in the shell, with its stdout sent to the
+ * pending redirection or pipe, if any
+ *
+ * Returns:
+ *  int         The builtin's exit status
+ */
+static int stage_builtin(struct _instr* ins, struct _regs* regs)
+{
+    int saved = -1;
+    int out_fd = regs->out_fd;
+    if (regs->outfile)
+        out_fd = open(regs->outfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+
+    if (out_fd != -1) {
+        fflush(stdout);
+        saved = dup(STDOUT_FILENO);
+        dup2(out_fd, STDOUT_FILENO);
+    }
+
+    int status = ins->builtin(ins->argc, ins->argv);
+
+    if (saved != -1) {
+        fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+    if (regs->outfile && out_fd != -1) close(out_fd);
+    return status;
+}
+
+
+/*
+ * The command of the n-th stage to start after code, for naming pipeline
+ * edges; NULL if there is no such stage
+ */
+static const char* stage_name(Program prog, struct _instr* code, int n)
+{
+    for (code++; code < prog->code + prog->len; code++) {
+        if (code->op == INS_WAIT) break;
+        if (code->op != INS_SPAWN && code->op != INS_BUILTIN) continue;
+        if (n-- == 0) return code->argv[0];
+    }
+    return NULL;
+}
+
+
+/*
+ * Release the fds of the stage just started and move on to the next
+ */
+static void stage_done(struct _regs* regs)
+{
+    if (regs->in_fd != -1) close(regs->in_fd);
+    if (regs->out_fd != -1) close(regs->out_fd);
+    regs->in_fd = regs->next_in;
+    regs->out_fd = regs->next_in = -1;
+    regs->infile = regs->outfile = NULL;
+}
+
+
+// Documented in .h file
+int PRG_execute(Program prog)
+{
+    if (prog->failed) return 1;
+
+    struct _regs regs = {-1, -1, -1, NULL, NULL, NULL};
+    // a piped builtin may take a child too
+    pid_t pids[prog->len + 1];
+    const char* names[prog->len + 1];
+    PerfStage perf[prog->len + 1];
+    uint64_t forked_at[prog->len + 1];
+    uint64_t* exec_at = ST_exec_slots();
+    Meter meter = NULL;
+    int place_base = PL_reserve(prog->nspawn);
+    int npids = 0;
+    int exit_val = 0;
+
+    for (struct _instr* code = prog->code; code < prog->code + prog->len; code++) {
+        // expand brace words into a copy of the instruction
+        struct _instr* ins = code;
+        struct _instr expanded;
+        struct _args args = {NULL};
+        if (ins->lazy && !ins->chunk) {
+            if (!expand_args(ins, &args)) {
+                printf("%s: Argument list too long\n", ins->argv[0]);
+                args_free(&args);
+                exit_val = 1;
+                stage_done(&regs);
+                continue;
+            }
+            expanded = *ins;
+            expanded.argc = args.argc;
+            expanded.argv = args.argv;
+            if (ins->lazy[0]) expanded.path = (char*) hash_lookup(args.argv[0]);
+            ins = &expanded;
+        }
+
+        switch (ins->op) {
+            case INS_OPEN_IN:
+                regs.infile = ins->path;
+                break;
+
+            case INS_OPEN_OUT:
+                regs.outfile = ins->path;
+                break;
+
+            case INS_PIPE: {
+                // the pipe feeds the next stage's output to the one after
+                int fds[2];
+                uint64_t start = ST_now();
+                if (MT_mode() != MT_OFF && !meter) meter = MT_new();
+                if (MT_pipe(meter, fds, stage_name(prog, code, 0),
+                        stage_name(prog, code, 1)) == -1) {
+                    perror("pipe");
+                    _exit(EXIT_FAILURE);
+                }
+                ST_since(ST_PIPE, start);
+                regs.out_fd = fds[1];
+                regs.next_in = fds[0];
+                break;
+            }
+
+            case INS_SPAWN: {
+                // unflushed output would otherwise be duplicated
+                fflush(stdout);
+                regs.exec_at = exec_at && npids < ST_MAX_STAGES?
+                    &exec_at[npids]: NULL;
+                if (regs.exec_at) *regs.exec_at = 0;
+
+                // with counters on, the child waits for them to be opened
+                // before it can exec
+                int go[2] = {-1, -1};
+                if (PF_enabled() && pipe2(go, O_CLOEXEC) == -1)
+                    go[0] = go[1] = -1;
+
+                // a ready zygote worker takes the stage without a fork
+                forked_at[npids] = ST_now();
+                pid_t pid = go[0] == -1 && zygote_ok(ins)?
+                    zygote_spawn(ins, &regs): -1;
+                if (pid == -1) pid = fork();
+                if (pid == -1) {
+                    perror("fork");
+                    _exit(EXIT_FAILURE);
+                }
+                if (pid == 0 && go[0] != -1) {
+                    char c;
+                    close(go[1]);
+                    while (read(go[0], &c, 1) == -1 && errno == EINTR);
+                    close(go[0]);
+                }
+                // a chunked stage's execs spread over the CPUs themselves
+                if (pid == 0) LIM_apply();
+                if (pid == 0) PL_apply(ins->policy,
+                    ins->chunk? -1: place_base + npids);
+                if (pid == 0 && ins->chunk) stage_chunked(ins, &regs);
+                if (pid == 0) stage_exec(ins, &regs);
+                ST_since(ST_FORK, forked_at[npids]);
+                LIM_watch(pid);
+
+                perf[npids] = NULL;
+                if (go[0] != -1) {
+                    close(go[0]);
+                    perf[npids] = PF_open(pid);
+                    close(go[1]);
+                }
+                names[npids] = code->argv[0];
+                pids[npids++] = pid;
+                stage_done(&regs);
+                break;
+            }
+
+            case INS_BUILTIN: {
+                // a report fills the pipe before its reader is started, so
+                // it is written from a child of its own
+                if (ins->report && regs.out_fd != -1) {
+                    fflush(stdout);
+                    if (exec_at && npids < ST_MAX_STAGES) exec_at[npids] = 0;
+                    forked_at[npids] = ST_now();
+                    pid_t pid = fork();
+                    if (pid == -1) {
+                        perror("fork");
+                        _exit(EXIT_FAILURE);
+                    }
+                    if (pid == 0) {
+                        if (regs.next_in != -1) close(regs.next_in);
+                        int status = stage_builtin(ins, &regs);
+                        fflush(stdout);
+                        _exit(status);
+                    }
+                    ST_since(ST_FORK, forked_at[npids]);
+                    perf[npids] = NULL;
+                    names[npids] = code->argv[0];
+                    pids[npids++] = pid;
+                    stage_done(&regs);
+                    break;
+                }
+
+                int status = stage_builtin(ins, &regs);
+                if (status) exit_val = status;
+                LOG_stage(ins->argv[0], 0, W_EXITCODE(status, 0), NULL);
+                stage_done(&regs);
+                break;
+            }
+
+            case INS_WAIT: {
+                // wait for all children to finish executing
+                uint64_t start = ST_now();
+                for (int reaped = 0; reaped < npids; ) {
+                    int exit_status;
+                    struct rusage usage;
+                    LIM_wait();
+                    pid_t pid = wait4(-1, &exit_status, 0, &usage);
+                    if (pid == -1) {
+                        if (errno == EINTR) continue;
+                        break;
+                    }
+
+                    int stage = -1;
+                    for (int i = 0; i < npids; i++)
+                        if (pids[i] == pid) stage = i;
+                    if (stage == -1) continue;
+                    reaped++;
+                    LIM_unwatch(pid);
+
+                    if (TR_enabled()) {
+                        uint64_t execed = exec_at && stage < ST_MAX_STAGES?
+                            exec_at[stage]: 0;
+                        TR_stage(names[stage], pid, forked_at[stage], execed,
+                            ST_now(), &usage);
+                    }
+                    LOG_stage(names[stage], pid, exit_status, &usage);
+
+                    if (WEXITSTATUS(exit_status) != 0) {
+                        exit_val = WEXITSTATUS(exit_status);
+                        printf("Child %d exited with status %d\n",
+                            pid, WEXITSTATUS(exit_status));
+                    }
+                }
+                if (npids) ST_since(ST_WAIT, start);
+
+                for (int i = 0; i < npids; i++) {
+                    if (!perf[i]) continue;
+                    PF_report(perf[i], names[i], stderr);
+                    PF_close(perf[i]);
+                }
+
+                // stages that reached exec left the time in their slot
+                for (int i = 0; exec_at && i < npids && i < ST_MAX_STAGES; i++)
+                    if (exec_at[i]) ST_record(ST_EXEC, exec_at[i] - forked_at[i]);
+                npids = 0;
+
+                // with every stage gone, the relays have drained
+                MT_finish(meter, stderr);
+                meter = NULL;
+
+                // replace the workers the stages took, off their launch path
+                ZY_refill();
+                break;
+            }
+        }
+        args_free(&args);
+    }
+
+    return exit_val;
+}
+
+
+/*
+ * Helper for PRG_disassemble: append prefix and s to buf, never writing
+ * past buf_sz
+ */
+static void dis_append(char* buf, size_t buf_sz, size_t* size,
+        const char* prefix, const char* s)
+{
+    if (*size >= buf_sz) return;
+    size_t n = snprintf(buf + *size, buf_sz - *size, "%s%s", prefix, s);
+    *size += n < buf_sz - *size? n: buf_sz - *size;
+}
+
+
+// Documented in .h file
+size_t PRG_disassemble(Program prog, char* buf, size_t buf_sz)
+{
+    static const char* names[] = {
+        [INS_OPEN_IN] = "OPEN_IN", [INS_OPEN_OUT] = "OPEN_OUT",
+        [INS_PIPE] = "PIPE", [INS_SPAWN] = "SPAWN",
+        [INS_BUILTIN] = "BUILTIN", [INS_WAIT] = "WAIT"
+    };
+
+    size_t size = 0;
+    if (buf_sz) *buf = 0;
+    for (int i = 0; i < prog->len; i++) {
+        struct _instr* ins = &prog->code[i];
+        dis_append(buf, buf_sz, &size, "", names[ins->op]);
+        if (ins->op == INS_OPEN_IN || ins->op == INS_OPEN_OUT)
+            dis_append(buf, buf_sz, &size, " ", ins->path);
+        for (int j = 0; j < ins->argc; j++)
+            dis_append(buf, buf_sz, &size, " ", ins->argv[j]);
+        dis_append(buf, buf_sz, &size, "\n", "");
+    }
+    if (size >= buf_sz) size = buf_sz? buf_sz - 1: 0;
+    return size;
+}
@@ -0,0 +1,88 @@
+/*
+ * program.h
+ *
+ * Pipelines compiled to a flat list of instructions, run by a single
+ * executor loop
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _PROGRAM_H_
+#define _PROGRAM_H_
+
+#include <stddef.h>
+
+#include "pipeline.h"
+
+typedef struct _program* Program;
+
+typedef enum {
+    INS_OPEN_IN,    // the next stage reads its stdin from a file
+    INS_OPEN_OUT,   // the next stage writes its stdout to a file
+    INS_PIPE,       // the next stage writes into a pipe read by the stage after
+    INS_SPAWN,      // fork/exec a stage
+    INS_BUILTIN,    // run a builtin in the shell process, or a piped report
+                    // in a child
+    INS_WAIT        // wait for every spawned stage
+} Opcode;
+
+
+/*
+ * Compile a pipeline AST into a program. Every argv array is built
+ * ahead of time, redirections become instructions of their own, and
+ * command names are resolved against PATH through the shell's command
+ * hash. The program keeps its own copies of all strings, so the AST may
+ * be freed and the program stored and run any number of times. A
+ * command left without a name once its prefix words are removed, or
+ * with a malformed prefix, is reported on stderr; the program then
+ * runs nothing and fails.
+ *
+ * Parameters:
+ *  pipeline    The pipeline to compile
+ *
+ * Returns:
+ *  Program     The newly-malloc'd program, to be released with PRG_free
+ */
+Program PRG_compile(AST pipeline);
+
+
+/*
+ * Run a compiled program
+ *
+ * Parameters:
+ *  prog        The program
+ *
+ * Returns:
+ *  int         The exit status of execution. Non-zero if any child process
+ *              exited with a non-zero wait status or the program did not
+ *              compile, otherwise 0.
+ */
+int PRG_execute(Program prog);
+
+
+/*
+ * Return to heap the memory of a compiled program
+ *
+ * Parameters:
+ *  prog        The program, may be NULL
+ */
+void PRG_free(Program prog);
+
+
+/*
+ * For diagnostics: write a listing of the program into buf, one
+ * instruction per line
+ *
+ * Parameters:
+ *  prog        The program
+ *  buf         The buffer
+ *  buf_sz      The size of the buffer, in bytes
+ *
+ * Returns:
+ *  size_t      The number of characters written to buf, not counting
+ *              the \0 terminator. The listing is truncated to fit.
+ */
+size_t PRG_disassemble(Program prog, char* buf, size_t buf_sz);
+
+#endif /* _PROGRAM_H_ */
@@ -0,0 +1,306 @@
+/*
+ * psh_bench.c
+ *
+ * Microbenchmarks for the Plaid Shell data structures. Built without
+ * sanitizers and with optimization by "make bench", which runs each
+ * variant of the code under test.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clist.h"
+#include "tokenize.h"
+#include "parse.h"
+#include "program.h"
+#include "memstats.h"
+
+// The build under test, named after the executable: psh_bench_nopool
+// runs as "nopool"
+static const char* variant = "linked";
+
+
+/*
+ * Monotonic time, in nanoseconds
+ */
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/*
+ * Print one result line
+ *
+ * Parameters:
+ *  name        The benchmark
+ *  ops         The number of operations timed
+ *  ns          The time they took
+ */
+static void report(const char* name, long ops, double ns)
+{
+    printf("%-12s %-36s %10ld ops %8.2f ns/op\n",
+        variant, name, ops, ns / ops);
+}
+
+
+/*
+ * Allocation churn at the head: push then pop, at a steady length
+ */
+static void bench_push_pop(long ops)
+{
+    CList list = CL_new();
+    for (int i = 0; i < 64; i++)
+        CL_push(list, (Token) {TOK_WORD});
+
+    double start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        CL_push(list, (Token) {TOK_WORD});
+        CL_pop(list);
+    }
+    report("push/pop head, length 64", ops, now_ns() - start);
+    CL_free(list);
+}
+
+
+/*
+ * A queue: append at the tail, remove from the head
+ */
+static void bench_append_remove(long ops, int length)
+{
+    CList list = CL_new();
+    for (int i = 0; i < length; i++)
+        CL_append(list, (Token) {TOK_WORD});
+
+    double start = now_ns();
+    for (long i = 0; i < ops; i++) {
+        CL_append(list, (Token) {TOK_WORD});
+        CL_remove(list, 0);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "append/remove head, length %d", length);
+    report(name, ops, now_ns() - start);
+    CL_free(list);
+}
+
+
+/*
+ * Build a long list at the head, then free it whole
+ */
+static void bench_build_free(long ops)
+{
+    double start = now_ns();
+    CList list = CL_new();
+    for (long i = 0; i < ops; i++)
+        CL_push(list, (Token) {TOK_WORD});
+    CL_free(list);
+    report("push then free", ops, now_ns() - start);
+}
+
+
+/*
+ * Tokenize a line of n words; the time per token should stay flat as
+ * the line grows
+ */
+static void bench_tokenize(long n)
+{
+    char* line = malloc(n * 8 + 1);
+    size_t len = 0;
+    for (long i = 0; i < n; i++)
+        len += sprintf(line + len, "w%ld ", i % 100000);
+
+    char errmsg[128];
+    double start = now_ns();
+    CList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+    double ns = now_ns() - start;
+
+    char name[64];
+    snprintf(name, sizeof(name), "tokenize %ld words", n);
+    report(name, n, ns);
+    CL_free(tokens);
+    free(line);
+}
+
+
+static void sum_element(int pos, CListElementType element, void* cb_data)
+{   *(long*) cb_data += element.type; }
+
+
+/*
+ * Build, traverse, index and drain a list of n elements
+ */
+static void bench_size(long n)
+{
+    char name[64];
+    CList list = CL_new();
+
+    double start = now_ns();
+    for (long i = 0; i < n; i++)
+        CL_append(list, (Token) {i & 1});
+    snprintf(name, sizeof(name), "append, %ld elements", n);
+    report(name, n, now_ns() - start);
+
+    long sum = 0;
+    start = now_ns();
+    CL_foreach(list, sum_element, &sum);
+    snprintf(name, sizeof(name), "foreach, %ld elements", n);
+    report(name, n, now_ns() - start);
+
+    // random positions, fewer of them on the longer lists
+    long lookups = 200000000 / n;
+    if (lookups > 100000) lookups = 100000;
+    if (lookups < 20) lookups = 20;
+    unsigned seed = 1;
+    start = now_ns();
+    for (long i = 0; i < lookups; i++)
+        sum += CL_nth(list, rand_r(&seed) % n).type;
+    snprintf(name, sizeof(name), "nth, %ld elements", n);
+    report(name, lookups, now_ns() - start);
+
+    start = now_ns();
+    // not CL_length, which walks the list in DEBUG builds
+    for (long i = 0; i < n; i++)
+        CL_pop(list);
+    snprintf(name, sizeof(name), "pop, %ld elements", n);
+    report(name, n, now_ns() - start);
+
+    CL_free(list);
+    if (sum == -1) printf("\n");     // keep the traversals
+}
+
+
+static void sum_batch(int pos, const CListElementType* batch, int n, void* cb_data)
+{
+    for (int i = 0; i < n; i++)
+        *(long*) cb_data += batch[i].type;
+}
+
+
+/*
+ * The bulk operations against their element at a time equivalents, on
+ * a list of n elements
+ */
+static void bench_bulk(long n)
+{
+    Token* arr = calloc(n, sizeof(Token));
+    for (long i = 0; i < n; i++)
+        arr[i].type = i & 1;
+
+    CList list = CL_new();
+    double start = now_ns();
+    for (long i = 0; i < n; i++)
+        CL_append(list, arr[i]);
+    report("append loop", n, now_ns() - start);
+    CL_free(list);
+
+    list = CL_new();
+    start = now_ns();
+    CL_extend(list, arr, n);
+    report("extend", n, now_ns() - start);
+
+    long sum = 0;
+    start = now_ns();
+    CL_foreach(list, sum_element, &sum);
+    report("foreach", n, now_ns() - start);
+
+    start = now_ns();
+    CL_foreach_batch(list, sum_batch, &sum);
+    report("foreach_batch", n, now_ns() - start);
+
+    start = now_ns();
+    for (long i = 0; i < n; i++)
+        arr[i] = CL_nth(list, 0), CL_pop(list);
+    report("nth(0)+pop loop", n, now_ns() - start);
+
+    CL_extend(list, arr, n);
+    start = now_ns();
+    CL_drain(list, arr, n);
+    report("drain", n, now_ns() - start);
+
+    CL_free(list);
+    free(arr);
+    if (sum == -1) printf("\n");
+}
+
+
+// Command lines whose allocations are checked, and the most each may
+// make being tokenized, parsed, compiled and freed; "make bench" fails
+// if one goes over. The budgets are those of the nopool variant, which
+// mallocs every list node.
+static const struct {
+    const char* line;
+    uint64_t budget;
+} alloc_lines[] = {
+    {"ls", 11},
+    {"ls -l /tmp | grep x > /dev/null", 49},
+    {"cat < in | sort | uniq -c | sort -rn | head -5 > out", 94},
+};
+
+
+/*
+ * Allocations made for each command line in alloc_lines, once the node
+ * pool is warm
+ *
+ * Returns:
+ *  int         The number of lines over budget
+ */
+static int bench_alloc()
+{
+    char errmsg[128];
+    int over = 0;
+
+    for (int i = 0; i < sizeof(alloc_lines) / sizeof(alloc_lines[0]); i++) {
+        const char* line = alloc_lines[i].line;
+        for (int pass = 0; pass < 2; pass++) {
+            MEM_begin_command();
+            CList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+            AST pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+            PRG_free(PRG_compile(pipeline));
+            AST_free(pipeline);
+            CL_free(tokens);
+            MEM_end_command();
+        }
+
+        MemStats s = MEM_last_command();
+        bool ok = s.allocs + s.reallocs <= alloc_lines[i].budget;
+        printf("%-12s %-52s %4lu allocs %6lu bytes %6ld peak%s\n", variant, line,
+            (unsigned long) (s.allocs + s.reallocs), (unsigned long) s.bytes,
+            (long) s.peak, ok? "": "  OVER BUDGET");
+        over += !ok;
+    }
+    return over;
+}
+
+
+int main(int argc, char* argv[])
+{
+    const char* base = strrchr(argv[0], '/');
+    base = base? base + 1: argv[0];
+    if (!strncmp(base, "psh_bench_", 10)) variant = base + 10;
+
+    // warm up the allocator, and the node pool when there is one
+    bench_build_free(1000000);
+
+    bench_push_pop(10000000);
+    bench_append_remove(1000000, 4);
+    bench_append_remove(200000, 64);
+    bench_build_free(1000000);
+
+    for (long n = 1000; n <= 1000000; n *= 10)
+        bench_tokenize(n);
+
+    for (long n = 10; n <= 10000000; n *= 10)
+        bench_size(n);
+
+    bench_bulk(1000000);
+
+    return bench_alloc()? EXIT_FAILURE: 0;
+}
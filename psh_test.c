@@ -14,14 +14,40 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #include "token.h"
 #include "tokenize.h"
 #include "pipeline.h"
 #include "parse.h"
+#include "walk.h"
+#include "globcache.h"
+#include "program.h"
+#include "brace.h"
+#include "stats.h"
+#include "ring.h"
+#include "trace.h"
+#include "perfstat.h"
+#include "bench.h"
+#include "memstats.h"
+#include "meter.h"
+#include "cmdlog.h"
+#include "parallel.h"
+#include "jobserver.h"
+#include "placement.h"
+#include "limit.h"
+#include "zygote.h"
+#include "server.h"
 
 #define HOMEDIR "/home/jkwizera"
 
+// A list of plain ints, instantiated from the generic CList
+DECLARE_CLIST(Int, int)
+DEFINE_CLIST(Int, int, CLIST_NO_DTOR, -1)
+
 
 // Checks that value is true; if not, prints a failure message and
 // returns 0 from this function
@@ -177,11 +203,12 @@ int test_tok_tokenize_input()
     char errmsg[errmsg_sz];
 
     CList list;
+    int i, t = 0;
 
-    for (int i = 0; i < num_tests; i++) {
+    for (i = 0; i < num_tests; i++) {
         list = TOK_tokenize_input(tests[i].input, errmsg, errmsg_sz);
         test_assert(!strcmp(errmsg, tests[i].errmsg));
-        for (int t = 0; tests[i].exp_tokens[t].type != TOK_END; t++) {
+        for (t = 0; tests[i].exp_tokens[t].type != TOK_END; t++) {
             test_assert(test_tok_eq(TOK_next(list), tests[i].exp_tokens[t]));
             free((void *) tests[i].exp_tokens[t].value);
             TOK_consume(list);
@@ -189,13 +216,15 @@ int test_tok_tokenize_input()
         test_assert((!list || TOK_next(list).type == TOK_END));
         CL_free(list);
         list = NULL;
+        t = 0;
     }
     return 1;
 
 test_error:
     CL_free(list);
-    for (int i = 0; i < num_tests; i++)
-        for (int t = 0; tests[i].exp_tokens[t].type != TOK_END; t++)
+    // values before tests[i].exp_tokens[t] were already freed
+    for (; i < num_tests; i++, t = 0)
+        for (; tests[i].exp_tokens[t].type != TOK_END; t++)
             free((void *) tests[i].exp_tokens[t].value);
 
     return 0;
@@ -556,16 +585,2068 @@ test_error:
 }
 
 
+/*
+ * Tests WALK_glob and the expansion of "**" patterns by Parse, on a
+ * scratch tree under /tmp
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_walk()
+{
+    char root[] = "/tmp/psh_walkXXXXXX";
+    char cmd[256];
+    char pattern[128];
+    char buffer[512];
+    size_t count = 0;
+    char** paths = NULL;
+    CList tokens = NULL;
+    AST pipeline = NULL;
+
+    test_assert(mkdtemp(root));
+    snprintf(cmd, sizeof(cmd), "cd %s && mkdir -p x/y .hidden && "
+        "touch a.log x/b.log x/y/c.log x/y/c.txt .hidden/h.log", root);
+    test_assert(system(cmd) == 0);
+
+    test_assert(WALK_is_globstar("x/**/*.log"));
+    test_assert(WALK_is_globstar("**"));
+    test_assert(!WALK_is_globstar("x/**.log"));
+    test_assert(!WALK_is_globstar("*.log"));
+
+    // ** matches zero or more directories, but not hidden ones
+    snprintf(pattern, sizeof(pattern), "%s/**/*.log", root);
+    for (int nthreads = 1; nthreads <= 4; nthreads++) {
+        paths = WALK_glob(pattern, WALK_SORT, nthreads, &count);
+        test_assert(count == 3);
+        snprintf(buffer, sizeof(buffer), "%s/a.log", root);
+        test_assert(!strcmp(paths[0], buffer));
+        snprintf(buffer, sizeof(buffer), "%s/x/b.log", root);
+        test_assert(!strcmp(paths[1], buffer));
+        snprintf(buffer, sizeof(buffer), "%s/x/y/c.log", root);
+        test_assert(!strcmp(paths[2], buffer));
+        test_assert(paths[3] == NULL);
+        WALK_free(paths);
+        paths = NULL;
+    }
+
+    // a trailing ** matches files and directories alike
+    snprintf(pattern, sizeof(pattern), "%s/x/**", root);
+    paths = WALK_glob(pattern, WALK_SORT, 2, &count);
+    test_assert(count == 4);
+    WALK_free(paths);
+    paths = NULL;
+
+    // Parse expands globstar words in sorted order
+    snprintf(pattern, sizeof(pattern), "%s/**/c.*", root);
+    tokens = CL_new();
+    CL_append(tokens, TOK_new(TOK_WORD, "ls"));
+    CL_append(tokens, TOK_new(TOK_WORD, pattern));
+    pipeline = Parse(tokens, buffer, sizeof(buffer));
+    test_assert(pipeline);
+    test_assert(AST_countnodes(pipeline) == 3);
+    AST_pipeline2str(pipeline, buffer, sizeof(buffer));
+    snprintf(cmd, sizeof(cmd), "ls %s/x/y/c.log %s/x/y/c.txt", root, root);
+    test_assert(!strcmp(buffer, cmd));
+    CL_free(tokens);
+    tokens = NULL;
+    AST_free(pipeline);
+    pipeline = NULL;
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+    system(cmd);
+    return 1;
+
+test_error:
+    WALK_free(paths);
+    CL_free(tokens);
+    AST_free(pipeline);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+    system(cmd);
+    return 0;
+}
+
+
+/*
+ * Tests that GC_glob serves repeated globs from the listing cache and
+ * sees directory changes made in between
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_globcache()
+{
+    char root[] = "/tmp/psh_gcXXXXXX";
+    char path[128];
+    char pattern[128];
+    glob_t pglob = {0};
+
+    test_assert(mkdtemp(root));
+    snprintf(pattern, sizeof(pattern), "%s/*.txt", root);
+    for (int i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/%d.txt", root, i);
+        fclose(fopen(path, "w"));
+    }
+
+    // the second glob is served from the cache
+    test_assert(GC_glob(pattern, 0, &pglob) == 0);
+    test_assert(pglob.gl_pathc == 3);
+    globfree(&pglob);
+    test_assert(GC_glob(pattern, 0, &pglob) == 0);
+    test_assert(pglob.gl_pathc == 3);
+    globfree(&pglob);
+
+    // creations and deletions are applied as deltas
+    snprintf(path, sizeof(path), "%s/3.txt", root);
+    fclose(fopen(path, "w"));
+    snprintf(path, sizeof(path), "%s/0.txt", root);
+    unlink(path);
+    test_assert(GC_glob(pattern, 0, &pglob) == 0);
+    test_assert(pglob.gl_pathc == 3);
+    snprintf(path, sizeof(path), "%s/1.txt", root);
+    test_assert(!strcmp(pglob.gl_pathv[0], path));
+    snprintf(path, sizeof(path), "%s/3.txt", root);
+    test_assert(!strcmp(pglob.gl_pathv[2], path));
+    globfree(&pglob);
+
+    // literal words that do not exist are kept with GLOB_NOCHECK
+    snprintf(path, sizeof(path), "%s/nothere", root);
+    test_assert(GC_glob(path, GLOB_NOCHECK, &pglob) == 0);
+    test_assert(pglob.gl_pathc == 1 && !strcmp(pglob.gl_pathv[0], path));
+    globfree(&pglob);
+
+    GC_flush();
+    snprintf(path, sizeof(path), "rm -rf %s", root);
+    system(path);
+    return 1;
+
+test_error:
+    globfree(&pglob);
+    GC_flush();
+    snprintf(path, sizeof(path), "rm -rf %s", root);
+    system(path);
+    return 0;
+}
+
+
+/*
+ * Tests PRG_compile, PRG_disassemble, and that a compiled program can
+ * be run more than once
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_program()
+{
+    char errmsg[128];
+    char buffer[512];
+    char outfile[] = "/tmp/psh_prgXXXXXX";
+    char bindir[] = "/tmp/psh_binXXXXXX";
+    char* path = NULL;
+    CList tokens = NULL;
+    AST pipeline = NULL;
+    Program prog = NULL;
+    FILE* fp = NULL;
+
+    close(mkstemp(outfile));
+    snprintf(buffer, sizeof(buffer),
+        "printf \"a\\nb\\n\" | cat < /dev/null | wc -l > %s", outfile);
+    tokens = TOK_tokenize_input(buffer, errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    prog = PRG_compile(pipeline);
+
+    // the program no longer depends on the AST
+    AST_free(pipeline);
+    pipeline = NULL;
+
+    PRG_disassemble(prog, buffer, sizeof(buffer));
+    char expected[512];
+    snprintf(expected, sizeof(expected),
+        "PIPE\nSPAWN printf a\\nb\\n\n"
+        "OPEN_IN /dev/null\nPIPE\nSPAWN cat\n"
+        "OPEN_OUT %s\nSPAWN wc -l\nWAIT\n", outfile);
+    test_assert(!strcmp(buffer, expected));
+
+    for (int run = 0; run < 2; run++) {
+        test_assert(PRG_execute(prog) == 0);
+        fp = fopen(outfile, "r");
+        test_assert(fp && fgets(buffer, sizeof(buffer), fp));
+        test_assert(atoi(buffer) == 0);
+        fclose(fp);
+        fp = NULL;
+    }
+
+    // truncation keeps the buffer terminated
+    test_assert(PRG_disassemble(prog, buffer, 8) == 7);
+    test_assert(!strcmp(buffer, "PIPE\nSP"));
+    PRG_free(prog);
+    prog = NULL;
+    CL_free(tokens);
+    tokens = NULL;
+
+    // a builtin's report larger than a pipe holds still reaches its reader
+    test_assert(mkdtemp(bindir));
+    test_assert(getenv("PATH"));
+    path = strdup(getenv("PATH"));
+    snprintf(buffer, sizeof(buffer), "%s:%s", bindir, path);
+    setenv("PATH", buffer, 1);
+    for (int i = 0; i < 300; i++) {
+        char name[256];
+        memset(name, 'x', 240);
+        snprintf(name + 240, sizeof(name) - 240, "%d", i);
+        snprintf(buffer, sizeof(buffer), "%s/%s", bindir, name);
+        test_assert(symlink("/bin/true", buffer) == 0);
+        tokens = CL_new();
+        CL_append(tokens, TOK_new(TOK_WORD, name));
+        pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+        test_assert(pipeline);
+        prog = PRG_compile(pipeline);
+        PRG_free(prog);
+        prog = NULL;
+        AST_free(pipeline);
+        pipeline = NULL;
+        CL_free(tokens);
+        tokens = NULL;
+    }
+    snprintf(buffer, sizeof(buffer), "hash | wc -c > %s", outfile);
+    tokens = TOK_tokenize_input(buffer, errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    prog = PRG_compile(pipeline);
+    test_assert(PRG_execute(prog) == 0);
+    fp = fopen(outfile, "r");
+    test_assert(fp && fgets(buffer, sizeof(buffer), fp));
+    test_assert(atoi(buffer) > 65536);
+    fclose(fp);
+    fp = NULL;
+
+    setenv("PATH", path, 1);
+    free(path);
+    PRG_free(prog);
+    AST_free(pipeline);
+    CL_free(tokens);
+    unlink(outfile);
+    snprintf(buffer, sizeof(buffer), "rm -rf %s", bindir);
+    system(buffer);
+    return 1;
+
+test_error:
+    if (path) {
+        setenv("PATH", path, 1);
+        free(path);
+    }
+    if (fp) fclose(fp);
+    PRG_free(prog);
+    AST_free(pipeline);
+    CL_free(tokens);
+    unlink(outfile);
+    snprintf(buffer, sizeof(buffer), "rm -rf %s", bindir);
+    system(buffer);
+    return 0;
+}
+
+
+/*
+ * Tests BR_new, BR_next, BR_reset and BR_count, and that brace words
+ * are kept whole by Parse and expanded when the program runs
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_brace()
+{
+    static const struct {
+        const char* word;
+        const char* expansion;  // words separated by spaces, NULL if none
+    } cases[] = {
+        {"a{b,c}d",         "abd acd"},
+        {"{1..3}{x,y}",     "1x 1y 2x 2y 3x 3y"},
+        {"{01..10..3}",     "01 04 07 10"},
+        {"{5..1..2}",       "5 3 1"},
+        {"{a..c}",          "a b c"},
+        {"{a{1,2}}",        "{a1} {a2}"},
+        {"x{,y}",           "x xy"},
+        {"{}",              NULL},
+        {"{a}",             NULL},
+        {"a\\{b,c}",        NULL},
+        {"{1..x}",          NULL},
+    };
+
+    char buffer[256];
+    char errmsg[128];
+    CList tokens = NULL;
+    AST pipeline = NULL;
+    Program prog = NULL;
+    Brace br = NULL;
+
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        br = BR_new(cases[i].word);
+        if (!cases[i].expansion) {
+            test_assert(!br);
+            continue;
+        }
+        test_assert(br);
+
+        // generated twice, to check BR_reset
+        for (int pass = 0; pass < 2; pass++) {
+            size_t size = 0, count = 0;
+            const char* word;
+            while ((word = BR_next(br)) && size < sizeof(buffer)) {
+                size += snprintf(buffer + size, sizeof(buffer) - size,
+                    "%s%s", count++? " ": "", word);
+            }
+            test_assert(!strcmp(buffer, cases[i].expansion));
+            test_assert(count == BR_count(br));
+            BR_reset(br);
+        }
+        BR_free(br);
+        br = NULL;
+    }
+
+    // large ranges are counted without being generated
+    br = BR_new("{1..10000000}{a,b}");
+    test_assert(br && BR_count(br) == 20000000);
+    BR_free(br);
+    br = NULL;
+
+    // brace words stay whole in the AST, and are expanded when run
+    tokens = TOK_tokenize_input("true {1..3} | true x{a,b}", errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    AST_pipeline2str(pipeline, buffer, sizeof(buffer));
+    test_assert(!strcmp(buffer, "true {1..3} | true x{a,b}"));
+    prog = PRG_compile(pipeline);
+    test_assert(PRG_execute(prog) == 0);
+    PRG_free(prog);
+    AST_free(pipeline);
+    CL_free(tokens);
+    prog = NULL;
+    pipeline = NULL;
+    tokens = NULL;
+
+    // an expansion past ARG_MAX fails without running the command
+    tokens = TOK_tokenize_input("true {1..100000000}", errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    prog = PRG_compile(pipeline);
+    test_assert(PRG_execute(prog) == 1);
+
+    PRG_free(prog);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 1;
+
+test_error:
+    BR_free(br);
+    PRG_free(prog);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 0;
+}
+
+
+/*
+ * Tests that the chunk prefix splits an argument list too long for one
+ * exec, sequentially and in parallel, keeping the output in order
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_chunk()
+{
+    static const char* cmds[] = {
+        "chunk printf %%s\\n {1..300000} > %s",
+        "chunk -P 3 printf %%s\\n {1..300000} > %s",
+        // more jobs than can ever run is clamped, not a crash
+        "chunk -P 100000000 printf %%s\\n {1..300000} > %s",
+    };
+
+    char errmsg[128];
+    char buffer[256];
+    char outfile[] = "/tmp/psh_chunkXXXXXX";
+    CList tokens = NULL;
+    AST pipeline = NULL;
+    Program prog = NULL;
+    FILE* fp = NULL;
+
+    close(mkstemp(outfile));
+    for (int i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        snprintf(buffer, sizeof(buffer), cmds[i], outfile);
+        tokens = TOK_tokenize_input(buffer, errmsg, sizeof(errmsg));
+        pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+        test_assert(pipeline);
+        prog = PRG_compile(pipeline);
+        test_assert(PRG_execute(prog) == 0);
+
+        // every argument once, in order, over several execs
+        fp = fopen(outfile, "r");
+        test_assert(fp);
+        int n = 0;
+        while (fgets(buffer, sizeof(buffer), fp))
+            test_assert(atoi(buffer) == ++n);
+        test_assert(n == 300000);
+        fclose(fp);
+        fp = NULL;
+
+        PRG_free(prog);
+        AST_free(pipeline);
+        CL_free(tokens);
+        prog = NULL;
+        pipeline = NULL;
+        tokens = NULL;
+    }
+
+    // a prefix with no command after it, or a bad job count, runs nothing
+    static const char* bad[] = {
+        "chunk", "chunk -P 2", "echo hi | chunk", "chunk > %s",
+        "chunk -P x echo hi > %s",
+    };
+    unlink(outfile);
+    for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        snprintf(buffer, sizeof(buffer), bad[i], outfile);
+        tokens = TOK_tokenize_input(buffer, errmsg, sizeof(errmsg));
+        pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+        test_assert(pipeline);
+        prog = PRG_compile(pipeline);
+        test_assert(PRG_disassemble(prog, buffer, sizeof(buffer)) == 0);
+        test_assert(PRG_execute(prog) == 1);
+        test_assert(access(outfile, F_OK) == -1);
+
+        PRG_free(prog);
+        AST_free(pipeline);
+        CL_free(tokens);
+        prog = NULL;
+        pipeline = NULL;
+        tokens = NULL;
+    }
+
+    return 1;
+
+test_error:
+    if (fp) fclose(fp);
+    PRG_free(prog);
+    AST_free(pipeline);
+    CL_free(tokens);
+    unlink(outfile);
+    return 0;
+}
+
+
+/*
+ * Tests the latency histograms, and that running a pipeline records
+ * its pipe, fork, exec and wait phases
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_stats()
+{
+    char errmsg[128];
+    CList tokens = NULL;
+    AST pipeline = NULL;
+    Program prog = NULL;
+
+    // exact below 128ns, within 1/64 above
+    ST_reset();
+    test_assert(ST_percentile(ST_TOKENIZE, 50) == 0);
+    for (uint64_t ns = 1; ns <= 100; ns++)
+        ST_record(ST_TOKENIZE, ns);
+    test_assert(ST_count(ST_TOKENIZE) == 100);
+    test_assert(ST_percentile(ST_TOKENIZE, 50) == 50);
+    test_assert(ST_percentile(ST_TOKENIZE, 99) == 99);
+    test_assert(ST_percentile(ST_TOKENIZE, 100) == 100);
+
+    for (int i = 0; i < 1000; i++)
+        ST_record(ST_PARSE, 1000000 + 1000 * i);
+    uint64_t p50 = ST_percentile(ST_PARSE, 50);
+    uint64_t p999 = ST_percentile(ST_PARSE, 99.9);
+    test_assert(p50 > 1500000 - 1500000 / 64 && p50 <= 1500000);
+    test_assert(p999 > 1999000 - 1999000 / 64 && p999 <= 1999000);
+    test_assert(ST_percentile(ST_PARSE, 100) == 1999000);
+
+    // durations past the top of the histogram still count
+    ST_record(ST_COMMAND, (uint64_t) 1 << 50);
+    test_assert(ST_percentile(ST_COMMAND, 50) == (uint64_t) 1 << 50);
+
+    // two stages: one pipe, two forks, two execs, one wait
+    ST_reset();
+    tokens = TOK_tokenize_input("echo hi | true", errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    prog = PRG_compile(pipeline);
+    test_assert(PRG_execute(prog) == 0);
+    test_assert(ST_count(ST_PIPE) == 1);
+    test_assert(ST_count(ST_FORK) == 2);
+    test_assert(ST_count(ST_EXEC) == 2);
+    test_assert(ST_count(ST_WAIT) == 1);
+    test_assert(ST_percentile(ST_EXEC, 50) > 0);
+
+    ST_reset();
+    test_assert(ST_count(ST_EXEC) == 0);
+
+    PRG_free(prog);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 1;
+
+test_error:
+    PRG_free(prog);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 0;
+}
+
+
+/*
+ * Tests the record ring: order, wrapping, dropping when full, and the
+ * writer thread
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_ring()
+{
+    char record[64];
+    struct iovec iov[8];
+    char path[] = "/tmp/psh_ringXXXXXX";
+    int fd = mkstemp(path);
+    FILE* fp = NULL;
+    Ring ring = RING_new(256);
+
+    test_assert(RING_peek(ring, iov, 8) == 0);
+
+    // records of every length, many times around the ring
+    for (int i = 0; i < 1000; i++) {
+        int len = i % 40 + 1;
+        memset(record, 'a' + i % 26, len);
+        test_assert(RING_push(ring, record, len));
+        test_assert(RING_peek(ring, iov, 8) == 1);
+        test_assert(iov[0].iov_len == len);
+        test_assert(!memcmp(iov[0].iov_base, record, len));
+        RING_consume(ring, 1);
+    }
+
+    // a full ring drops records rather than overwriting them
+    int pushed = 0;
+    for (int i = 0; i < 100; i++)
+        pushed += RING_push(ring, &i, sizeof(i));
+    test_assert(pushed > 0 && pushed < 100);
+    test_assert(RING_dropped(ring) == 100 - pushed);
+    for (int i = 0; i < pushed; ) {
+        int n = RING_peek(ring, iov, 8);
+        test_assert(n > 0);
+        for (int j = 0; j < n; j++, i++)
+            test_assert(*(int*) iov[j].iov_base == i);
+        RING_consume(ring, n);
+    }
+    test_assert(RING_peek(ring, iov, 8) == 0);
+
+    // the writer has written everything pushed before it is stopped
+    RingWriter writer = RING_writer_start(ring, fd);
+    test_assert(writer);
+    int expected = 0;
+    for (int i = 0; i < 10000; i++) {
+        int len = snprintf(record, sizeof(record), "%d\n", i);
+        while (!RING_push(ring, record, len))
+            usleep(100);
+        expected++;
+    }
+    RING_writer_stop(writer);
+
+    fp = fopen(path, "r");
+    test_assert(fp);
+    int n = 0;
+    while (fgets(record, sizeof(record), fp))
+        test_assert(atoi(record) == n++);
+    test_assert(n == expected);
+
+    fclose(fp);
+    close(fd);
+    unlink(path);
+    RING_free(ring);
+    return 1;
+
+test_error:
+    if (fp) fclose(fp);
+    close(fd);
+    unlink(path);
+    RING_free(ring);
+    return 0;
+}
+
+
+/*
+ * Tests that tracing a pipeline writes a span and rusage counters for
+ * each stage, in a complete JSON array
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_trace()
+{
+    char errmsg[128];
+    char path[] = "/tmp/psh_traceXXXXXX";
+    char* json = NULL;
+    CList tokens = NULL;
+    AST pipeline = NULL;
+    FILE* fp = NULL;
+
+    close(mkstemp(path));
+    test_assert(!TR_enabled());
+    test_assert(TR_start(path));
+    test_assert(TR_enabled());
+
+    tokens = TOK_tokenize_input("echo hi | tr a-z A-Z | cat > /dev/null", errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    test_assert(AST_execute(pipeline) == 0);
+    TR_stop();
+    test_assert(!TR_enabled());
+
+    fp = fopen(path, "r");
+    test_assert(fp);
+    json = calloc(1, 65536);
+    size_t len = fread(json, 1, 65535, fp);
+    test_assert(len > 0);
+    test_assert(!strncmp(json, "[\n", 2));
+    test_assert(!strcmp(json + len - 3, "\n]\n"));
+    test_assert(strstr(json, "\"name\":\"compile\""));
+    test_assert(strstr(json, "\"name\":\"tr\",\"cat\":\"stage\",\"ph\":\"X\""));
+    test_assert(strstr(json, "\"name\":\"rusage cat ["));
+    test_assert(!strstr(json, ",\n]"));
+
+    int spans = 0;
+    for (char* p = json; (p = strstr(p, "\"name\":\"fork to exec\"")); p++)
+        spans++;
+    test_assert(spans == 3);
+
+    free(json);
+    fclose(fp);
+    unlink(path);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 1;
+
+test_error:
+    TR_stop();
+    free(json);
+    if (fp) fclose(fp);
+    unlink(path);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 0;
+}
+
+
+/*
+ * Tests the per-stage counters on a child held before its exec, and
+ * that pipelines still run with counting on whether or not the kernel
+ * allows perf events
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_perfstat()
+{
+    char errmsg[128];
+    CList tokens = NULL;
+    AST pipeline = NULL;
+    PerfStage stage = NULL;
+    int go[2];
+
+    test_assert(pipe(go) == 0);
+    pid_t pid = fork();
+    test_assert(pid != -1);
+    if (pid == 0) {
+        char c;
+        close(go[1]);
+        if (read(go[0], &c, 1) != 0) _exit(1);
+        execlp("true", "true", NULL);
+        _exit(1);
+    }
+    close(go[0]);
+    stage = PF_open(pid);
+    close(go[1]);
+    test_assert(waitpid(pid, NULL, 0) == pid);
+
+    // in a container without perf events there is nothing to check
+    if (stage) {
+        uint64_t values[PF_NCOUNTERS];
+        PF_read(stage, values);
+        test_assert(values[PF_TASK_CLOCK] != PF_UNAVAILABLE);
+        test_assert(values[PF_TASK_CLOCK] > 0);
+        test_assert(values[PF_PAGE_FAULTS] > 0);
+    }
+
+    PF_set_enabled(true);
+    tokens = TOK_tokenize_input("echo hi | cat > /dev/null", errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    test_assert(AST_execute(pipeline) == 0);
+    PF_set_enabled(false);
+
+    PF_close(stage);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 1;
+
+test_error:
+    PF_set_enabled(false);
+    PF_close(stage);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 0;
+}
+
+
+/*
+ * Tests the bench command: its statistics, its option parsing and a run
+ * of a pipeline
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_bench()
+{
+    char errmsg[128];
+    char report[1024];
+    CList tokens = NULL;
+    FILE* out = NULL;
+    BenchSummary s;
+
+    // ten close samples and one far above them, in no order
+    double samples[] = {5, 3, 100, 1, 8, 2, 10, 4, 7, 6, 9};
+    BN_summarize(samples, 11, &s);
+    test_assert(samples[0] == 1 && samples[10] == 100);
+    test_assert(s.n == 11);
+    test_assert(s.min == 1 && s.max == 100);
+    test_assert(s.mean == 155.0 / 11);
+    test_assert(s.p50 == 6);
+    test_assert(s.q1 == 3.5 && s.q3 == 8.5);
+    test_assert(s.low_outliers == 0 && s.high_outliers == 1);
+
+    double one = 42;
+    BN_summarize(&one, 1, &s);
+    test_assert(s.mean == 42 && s.stddev == 0 && s.p99 == 42);
+
+    tokens = TOK_tokenize_input("echo bench", errmsg, sizeof(errmsg));
+    test_assert(!BN_is_bench(tokens));
+    CL_free(tokens);
+    tokens = TOK_tokenize_input("\"bench\" true", errmsg, sizeof(errmsg));
+    test_assert(!BN_is_bench(tokens));
+    CL_free(tokens);
+
+    tokens = TOK_tokenize_input("bench -n 0 true", errmsg, sizeof(errmsg));
+    test_assert(BN_is_bench(tokens));
+    test_assert(BN_bench(tokens, stdout, errmsg, sizeof(errmsg)) == -1);
+    test_assert(!strncmp(errmsg, "usage: bench", 12));
+    CL_free(tokens);
+
+    out = tmpfile();
+    test_assert(out);
+    tokens = TOK_tokenize_input("bench -n 3 -w 0 -- echo hi | cat", errmsg, sizeof(errmsg));
+    test_assert(BN_is_bench(tokens));
+    test_assert(BN_bench(tokens, out, errmsg, sizeof(errmsg)) == 0);
+    rewind(out);
+    test_assert(fgets(report, sizeof(report), out));
+    test_assert(!strcmp(report, "3 runs after 0 warmup\n"));
+    test_assert(fgets(report, sizeof(report), out));
+    test_assert(fgets(report, sizeof(report), out));
+    test_assert(!strncmp(report, "wall ", 5));
+
+    fclose(out);
+    CL_free(tokens);
+    return 1;
+
+test_error:
+    if (out) fclose(out);
+    CL_free(tokens);
+    return 0;
+}
+
+
+/*
+ * Tests the counting allocator, and that tokenizing, parsing, compiling
+ * and freeing a command line gives back everything it allocates
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_memstats()
+{
+    char errmsg[128];
+    CList tokens = NULL;
+    AST pipeline = NULL;
+    Program prog = NULL;
+
+    MEM_begin_command();
+    char* p = MEM_malloc(100);
+    char* q = MEM_strdup("hello");
+    p = MEM_realloc(p, 1000);
+    MemStats s = MEM_command();
+    test_assert(s.allocs == 2 && s.reallocs == 1 && s.frees == 0);
+    test_assert(s.live >= 1000 + 6 && s.peak >= s.live);
+    MEM_free(p);
+    MEM_free(q);
+    MEM_free(NULL);
+    s = MEM_command();
+    test_assert(s.frees == 2);
+    test_assert(s.live == 0);
+    test_assert(s.peak >= 1006);
+    MEM_end_command();
+    test_assert(MEM_last_command().allocs == 2);
+    test_assert(MEM_total().allocs >= 2);
+
+    // the second pass runs with the node pool warm
+    for (int pass = 0; pass < 2; pass++) {
+        MEM_begin_command();
+        tokens = TOK_tokenize_input("ls -l /tmp | grep x > /dev/null",
+            errmsg, sizeof(errmsg));
+        pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+        test_assert(pipeline);
+        test_assert(MEM_command().live > 0);
+
+        // the compiled program's argvs and instructions are counted too
+        uint64_t parsed = MEM_command().allocs;
+        prog = PRG_compile(pipeline);
+        test_assert(MEM_command().allocs > parsed);
+        PRG_free(prog);
+        prog = NULL;
+        AST_free(pipeline);
+        CL_free(tokens);
+        pipeline = NULL;
+        tokens = NULL;
+        MEM_end_command();
+    }
+    s = MEM_last_command();
+    test_assert(s.allocs > 0);
+    test_assert(s.allocs == s.frees);
+    test_assert(s.live == 0);
+    test_assert(s.peak > 0);
+    return 1;
+
+test_error:
+    PRG_free(prog);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 0;
+}
+
+
+/*
+ * Tests that a metered pipe delivers everything written to it and
+ * reports the edge, and that metered pipelines behave as plain ones,
+ * including a reader that exits early
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_meter()
+{
+    char errmsg[128];
+    char path[] = "/tmp/psh_meterXXXXXX";
+    char buf[4096];
+    CList tokens = NULL;
+    AST pipeline = NULL;
+    FILE* report = NULL;
+    int saved_stderr = -1;
+
+    test_assert(MT_mode() == MT_OFF);
+
+    Meter meter = MT_new();
+    int fds[2];
+    test_assert(MT_pipe(meter, fds, "writer", "reader") == 0);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        memset(buf, 'x', sizeof(buf));
+        for (int i = 0; i < 25; i++)
+            if (write(fds[1], buf, sizeof(buf)) != sizeof(buf)) _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0) total += n;
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    test_assert(total == 25 * sizeof(buf));
+
+    report = tmpfile();
+    test_assert(report);
+    MT_finish(meter, report);
+    rewind(report);
+    size_t len = fread(buf, 1, sizeof(buf) - 1, report);
+    buf[len] = 0;
+    test_assert(!strncmp(buf, "meter: writer -> reader: ", 25));
+    test_assert(strstr(buf, "(102400 bytes)"));
+    test_assert(strstr(buf, "backpressure"));
+
+    // the pipelines' reports go to stderr
+    close(mkstemp(path));
+    MT_set_mode(MT_ON);
+    fflush(stderr);
+    saved_stderr = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+
+    snprintf(buf, sizeof(buf), "head -c 1000000 /dev/zero | cat | wc -c > %s", path);
+    tokens = TOK_tokenize_input(buf, errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    test_assert(AST_execute(pipeline) == 0);
+    AST_free(pipeline);
+    CL_free(tokens);
+    pipeline = NULL;
+
+    FILE* fp = fopen(path, "r");
+    test_assert(fp);
+    long count = 0;
+    int matched = fscanf(fp, "%ld", &count);
+    fclose(fp);
+    test_assert(matched == 1 && count == 1000000);
+
+    tokens = TOK_tokenize_input("yes | head -1 > /dev/null", errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    test_assert(AST_execute(pipeline) == 0);
+
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+    MT_set_mode(MT_OFF);
+    fclose(report);
+    unlink(path);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 1;
+
+test_error:
+    if (saved_stderr != -1) {
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stderr);
+    }
+    MT_set_mode(MT_OFF);
+    if (report) fclose(report);
+    unlink(path);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 0;
+}
+
+
+/*
+ * Tests that the command log writes a line of JSON per pipeline, with
+ * a description of each stage, and appends to an existing log
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cmdlog()
+{
+    char errmsg[128];
+    char path[] = "/tmp/psh_cmdlogXXXXXX";
+    char buf[8192];
+    CList tokens = NULL;
+    AST pipeline = NULL;
+    FILE* fp = NULL;
+
+    close(mkstemp(path));
+    test_assert(!LOG_enabled());
+    test_assert(LOG_start(path));
+    test_assert(LOG_enabled());
+
+    const char* lines[] = {"echo hi | tr a-z A-Z > /dev/null", "false"};
+    for (int i = 0; i < 2; i++) {
+        tokens = TOK_tokenize_input(lines[i], errmsg, sizeof(errmsg));
+        pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+        test_assert(pipeline);
+        LOG_begin(pipeline);
+        LOG_end(AST_execute(pipeline));
+        AST_free(pipeline);
+        CL_free(tokens);
+        pipeline = NULL;
+        tokens = NULL;
+    }
+    LOG_stop();
+    test_assert(!LOG_enabled());
+
+    // a second session appends
+    test_assert(LOG_start(path));
+    tokens = TOK_tokenize_input("true", errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    LOG_begin(pipeline);
+    LOG_end(AST_execute(pipeline));
+    AST_free(pipeline);
+    CL_free(tokens);
+    pipeline = NULL;
+
+    // limit logs the pipeline it wraps, with its limits
+    tokens = TOK_tokenize_input("limit -t 5 -n 64 true", errmsg, sizeof(errmsg));
+    test_assert(LIM_limit(tokens, errmsg, sizeof(errmsg)) == 0);
+    CL_free(tokens);
+
+    // bench logs each of its runs
+    tokens = TOK_tokenize_input("bench -n 2 -w 1 true", errmsg, sizeof(errmsg));
+    FILE* report = fopen("/dev/null", "w");
+    test_assert(report);
+    int benched = BN_bench(tokens, report, errmsg, sizeof(errmsg));
+    fclose(report);
+    test_assert(benched == 0);
+    LOG_stop();
+
+    fp = fopen(path, "r");
+    test_assert(fp);
+    test_assert(fgets(buf, sizeof(buf), fp));
+    test_assert(!strncmp(buf, "{\"start\":\"", 10));
+    test_assert(!strcmp(buf + strlen(buf) - 3, "]}\n"));
+    test_assert(strstr(buf, "\"pipeline\":\"echo hi | tr a-z A-Z > /dev/null\""));
+    test_assert(strstr(buf, "\"status\":0,\"stages\":[{\"name\":\"echo\""));
+    test_assert(strstr(buf, "},{\"name\":\"tr\",\"pid\":"));
+    test_assert(strstr(buf, "\"utime_us\":"));
+
+    test_assert(fgets(buf, sizeof(buf), fp));
+    test_assert(strstr(buf, "\"status\":1,"));
+    test_assert(strstr(buf, "\"name\":\"false\""));
+    test_assert(strstr(buf, "\"exit\":1,"));
+
+    test_assert(fgets(buf, sizeof(buf), fp));
+    test_assert(strstr(buf, "\"pipeline\":\"true\""));
+
+    test_assert(fgets(buf, sizeof(buf), fp));
+    test_assert(strstr(buf, "\"pipeline\":\"limit -t 5 -n 64 true\""));
+    test_assert(strstr(buf, "\"status\":0,\"stages\":[{\"name\":\"true\""));
+
+    for (int i = 0; i < 3; i++) {
+        test_assert(fgets(buf, sizeof(buf), fp));
+        test_assert(strstr(buf, "\"pipeline\":\"bench -n 2 -w 1 true\""));
+        test_assert(strstr(buf, "\"stages\":[{\"name\":\"true\""));
+    }
+    test_assert(!fgets(buf, sizeof(buf), fp));
+
+    fclose(fp);
+    unlink(path);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 1;
+
+test_error:
+    LOG_stop();
+    if (fp) fclose(fp);
+    unlink(path);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 0;
+}
+
+
+/*
+ * Runs a parallel command line, with in_fd for inputs from stdin and
+ * stdout and stderr sent to a file, returning PAR_parallel's result
+ * and the output in out
+ */
+static int run_parallel_from(const char* line, int in_fd, char* out,
+    size_t out_sz)
+{
+    char errmsg[128];
+    char path[] = "/tmp/psh_parallelXXXXXX";
+    int fd = mkstemp(path);
+    unlink(path);
+
+    fflush(stdout);
+    fflush(stderr);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int saved_stderr = dup(STDERR_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+
+    CList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+    int result = PAR_parallel(tokens, in_fd, errmsg, sizeof(errmsg));
+    CL_free(tokens);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_stdout, STDOUT_FILENO);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stdout);
+    close(saved_stderr);
+
+    ssize_t len = pread(fd, out, out_sz - 1, 0);
+    out[len > 0? len: 0] = 0;
+    close(fd);
+    if (result == -1) snprintf(out, out_sz, "%s", errmsg);
+    return result;
+}
+
+
+/*
+ * As run_parallel_from, for a shell reading its commands from stdin
+ */
+static int run_parallel(const char* line, char* out, size_t out_sz)
+{   return run_parallel_from(line, -1, out, out_sz); }
+
+
+/*
+ * Tests the parallel command: placeholders, ordered and line-interleaved
+ * output, expanded inputs, inputs from a pipe or a free stdin, and
+ * failure reports
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_parallel()
+{
+    char out[4096];
+    char errmsg[128];
+    CList tokens = TOK_tokenize_input("parallel echo", errmsg, sizeof(errmsg));
+    test_assert(PAR_is_parallel(tokens));
+    CL_free(tokens);
+    tokens = TOK_tokenize_input("\"parallel\" echo", errmsg, sizeof(errmsg));
+    test_assert(!PAR_is_parallel(tokens));
+    CL_free(tokens);
+    tokens = TOK_tokenize_input("seq 3 | parallel echo", errmsg, sizeof(errmsg));
+    test_assert(PAR_is_parallel(tokens));
+    CL_free(tokens);
+    tokens = TOK_tokenize_input("echo parallel | wc", errmsg, sizeof(errmsg));
+    test_assert(!PAR_is_parallel(tokens));
+    CL_free(tokens);
+    tokens = NULL;
+
+    // inputs from the pipeline before parallel, and from a free stdin
+    test_assert(run_parallel("printf \"a\\nb\\n\" | parallel -k echo X | "
+        "tr a-z A-Z", out, sizeof(out)) == 0);
+    test_assert(!strcmp(out, "X A\nX B\n"));
+    int fds[2];
+    test_assert(pipe(fds) == 0);
+    test_assert(write(fds[1], "p\nq\n", 4) == 4);
+    close(fds[1]);
+    test_assert(run_parallel_from("parallel -k echo Y", fds[0], out,
+        sizeof(out)) == 0);
+    close(fds[0]);
+    test_assert(!strcmp(out, "Y p\nY q\n"));
+
+    // never the stdin a shell reads its commands from
+    test_assert(run_parallel("parallel echo", out, sizeof(out)) == -1);
+    test_assert(!strncmp(out, "parallel: no inputs", 19));
+    test_assert(run_parallel("seq 2 | parallel echo ::: a", out,
+        sizeof(out)) == -1);
+
+    // one record for the line, with a stage per job
+    char path[] = "/tmp/psh_parlogXXXXXX";
+    close(mkstemp(path));
+    test_assert(LOG_start(path));
+    test_assert(run_parallel("parallel -j 1 sh -c \"exit {}\" ::: 0 4", out,
+        sizeof(out)) == 1);
+    LOG_stop();
+    FILE* fp = fopen(path, "r");
+    unlink(path);
+    test_assert(fp);
+    test_assert(fgets(out, sizeof(out), fp));
+    fclose(fp);
+    test_assert(strstr(out, "\"pipeline\":\"parallel -j 1 sh -c \\\"exit {}\\\" "
+        "::: 0 4\",\"status\":1,"));
+    test_assert(strstr(out, "{\"name\":\"0\",") && strstr(out, "\"exit\":4,"));
+
+    // -k keeps input order whatever order the jobs finish in
+    test_assert(run_parallel("parallel -j 3 -k sh -c \"sleep 0.{}; echo {}\" "
+        "::: 3 1 2", out, sizeof(out)) == 0);
+    test_assert(!strcmp(out, "3\n1\n2\n"));
+
+    // without a placeholder, the input ends the first command
+    test_assert(run_parallel("parallel -k echo in | tr a-z A-Z ::: x y",
+        out, sizeof(out)) == 0);
+    test_assert(!strcmp(out, "IN X\nIN Y\n"));
+
+    test_assert(run_parallel("parallel -k echo {}.txt ::: {a,b}{1,2}",
+        out, sizeof(out)) == 0);
+    test_assert(!strcmp(out, "a1.txt\na2.txt\nb1.txt\nb2.txt\n"));
+
+    // interleaved output is whole lines, in any order
+    test_assert(run_parallel("parallel -j 4 echo line ::: 1 2 3 4 5 6 7 8",
+        out, sizeof(out)) == 0);
+    int lines = 0;
+    for (char* p = out; (p = strstr(p, "line ")); p++) {
+        test_assert(p[5] >= '1' && p[5] <= '8' && p[6] == '\n');
+        lines++;
+    }
+    test_assert(lines == 8);
+
+    test_assert(run_parallel("parallel -j 2 sh -c \"exit {}\" ::: 0 3 0",
+        out, sizeof(out)) == 1);
+    test_assert(strstr(out, "parallel: job 2 (3) exited with status 3\n"));
+    test_assert(strstr(out, "parallel: 1 of 3 jobs failed\n"));
+
+    test_assert(run_parallel("parallel -j 0 echo ::: a", out, sizeof(out)) == -1);
+    test_assert(!strncmp(out, "usage: parallel", 15));
+    test_assert(run_parallel("parallel echo | ::: a", out, sizeof(out)) == -1);
+    return 1;
+
+test_error:
+    CL_free(tokens);
+    return 0;
+}
+
+
+/*
+ * Tests the jobserver: a served pool hands out one token fewer than its
+ * jobs and is advertised in MAKEFLAGS, parallel keeps within it and
+ * reuses its free slot, and a client finds make's fds in MAKEFLAGS
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_jobserver()
+{
+    char out[4096];
+    const char* old = getenv("MAKEFLAGS");
+    char* saved = old? strdup(old): NULL;
+
+    test_assert(!JS_active());
+    test_assert(!JS_try_acquire());
+    test_assert(JS_serve(3));
+    test_assert(JS_active() && JS_serving() == 3);
+    test_assert(!JS_serve(3));
+    test_assert(strstr(getenv("MAKEFLAGS"), "-j3 --jobserver-auth="));
+    test_assert(JS_try_acquire());
+    test_assert(JS_try_acquire());
+    test_assert(!JS_try_acquire());
+    JS_release();
+    test_assert(JS_try_acquire());
+    JS_release();
+    JS_release();
+    JS_stop_serving();
+    test_assert(!JS_active() && !JS_serving());
+    test_assert(saved? !strcmp(getenv("MAKEFLAGS"), saved): !getenv("MAKEFLAGS"));
+
+    // two slots for four jobs of 0.2s take at least two rounds
+    test_assert(JS_serve(2));
+    uint64_t start = ST_now();
+    test_assert(run_parallel("parallel -j 8 sleep 0.2 ::: 1 2 3 4",
+        out, sizeof(out)) == 0);
+    test_assert(ST_now() - start >= 400000000);
+
+    // the free slot passes on as soon as its job ends: the short jobs run
+    // there one after another while the long one holds the only token
+    start = ST_now();
+    test_assert(run_parallel("parallel -j 8 sleep ::: 0.1 1 0.1 0.1 0.1 0.1 0.1",
+        out, sizeof(out)) == 0);
+    test_assert(ST_now() - start < 1200000000);
+    JS_stop_serving();
+
+    // a client of make, in a child so the shell stays out of it
+    int fds[2];
+    test_assert(pipe(fds) == 0);
+    test_assert(write(fds[1], "x", 1) == 1);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char flags[64];
+        snprintf(flags, sizeof(flags), "w -j2 --jobserver-auth=%d,%d",
+            fds[0], fds[1]);
+        setenv("MAKEFLAGS", flags, 1);
+        bool ok = JS_init() && JS_try_acquire() && !JS_try_acquire();
+        JS_release();
+        _exit(ok? 0: 1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    char c = 0;
+    test_assert(read(fds[0], &c, 1) == 1 && c == 'x');
+    close(fds[0]);
+    close(fds[1]);
+
+    free(saved);
+    return 1;
+
+test_error:
+    JS_stop_serving();
+    free(saved);
+    return 0;
+}
+
+
+/*
+ * Tests placement words: they are stripped from the command, bad ones
+ * fail it, and a stage runs with its CPUs, nice value and policy
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_placement()
+{
+    char errmsg[128];
+    char path[] = "/tmp/psh_placementXXXXXX";
+    char buf[4096];
+    CList tokens = NULL;
+    AST pipeline = NULL;
+    Program prog = NULL;
+    int saved_stderr = -1;
+
+    char* words[] = {"@cpu=0,2-3", "@nice=5", "@sched=idle", "echo", "@cpu=1"};
+    char* argv[6];
+    for (int i = 0; i < 5; i++)
+        argv[i] = strdup(words[i]);
+    argv[5] = NULL;
+    int argc = 5;
+    StagePolicy policy;
+    test_assert(PL_strip(&argc, argv, NULL, &policy));
+    test_assert(policy && argc == 2);
+    test_assert(!strcmp(argv[0], "echo") && !strcmp(argv[1], "@cpu=1"));
+    test_assert(!argv[2]);
+    PL_free(policy);
+    test_assert(PL_strip(&argc, argv, NULL, &policy));
+    test_assert(!policy && argc == 2);
+    for (int i = 0; i < argc; i++)
+        free(argv[i]);
+
+    // bad words, or no command after the words, fail the stage
+    fflush(stderr);
+    saved_stderr = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+
+    close(mkstemp(path));
+    unlink(path);
+    const char* bad[] = {"@cpu=3-1 echo hi > %s", "@nice=x echo hi > %s",
+        "@sched=fifo echo hi > %s", "@cpu=0 > %s", "echo hi | @nice=1 > %s"};
+    for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        snprintf(buf, sizeof(buf), bad[i], path);
+        tokens = TOK_tokenize_input(buf, errmsg, sizeof(errmsg));
+        pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+        test_assert(pipeline);
+        prog = PRG_compile(pipeline);
+        test_assert(PRG_disassemble(prog, buf, sizeof(buf)) == 0);
+        test_assert(PRG_execute(prog) == 1);
+        test_assert(access(path, F_OK) == -1);
+        PRG_free(prog);
+        prog = NULL;
+        AST_free(pipeline);
+        CL_free(tokens);
+        pipeline = NULL;
+        tokens = NULL;
+    }
+
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+    saved_stderr = -1;
+
+    snprintf(buf, sizeof(buf), "@cpu=0 @nice=5 @sched=batch sh -c "
+        "\"nice; grep Cpus_allowed_list /proc/self/status; chrt -p 0\" "
+        "| cat > %s", path);
+    tokens = TOK_tokenize_input(buf, errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    test_assert(AST_execute(pipeline) == 0);
+
+    FILE* fp = fopen(path, "r");
+    test_assert(fp);
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    buf[len] = 0;
+    fclose(fp);
+    test_assert(!strncmp(buf, "5\nCpus_allowed_list:\t0\n", 23));
+    test_assert(strstr(buf, "SCHED_BATCH"));
+
+    // automatic placement pins every stage to one CPU
+    PL_set_auto(true);
+    test_assert(PL_auto() && PL_cpu(0) >= 0);
+    int base = PL_reserve(2);
+    test_assert(PL_cpu(PL_reserve(0)) == PL_cpu(base + 2));
+    AST_free(pipeline);
+    CL_free(tokens);
+    snprintf(buf, sizeof(buf),
+        "grep Cpus_allowed_list /proc/self/status | cat > %s", path);
+    tokens = TOK_tokenize_input(buf, errmsg, sizeof(errmsg));
+    pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    test_assert(AST_execute(pipeline) == 0);
+    PL_set_auto(false);
+    test_assert(!PL_auto());
+
+    fp = fopen(path, "r");
+    test_assert(fp);
+    int cpu = -1;
+    test_assert(fscanf(fp, "Cpus_allowed_list: %d", &cpu) == 1);
+    test_assert(fgetc(fp) == '\n');
+    fclose(fp);
+    test_assert(cpu >= 0);
+
+    unlink(path);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 1;
+
+test_error:
+    if (saved_stderr != -1) {
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stderr);
+    }
+    PL_set_auto(false);
+    unlink(path);
+    PRG_free(prog);
+    AST_free(pipeline);
+    CL_free(tokens);
+    return 0;
+}
+
+
+/*
+ * Tests the limit command: rlimits reach the stages, the timeout kills
+ * a pipeline that overruns it, and bad options are a usage error
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_limit()
+{
+    char errmsg[128];
+    char path[] = "/tmp/psh_limitXXXXXX";
+    char buf[512];
+    CList tokens = NULL;
+    int saved_stderr = -1;
+
+    tokens = TOK_tokenize_input("limit ls", errmsg, sizeof(errmsg));
+    test_assert(LIM_is_limit(tokens));
+    CL_free(tokens);
+    tokens = TOK_tokenize_input("\"limit\" ls", errmsg, sizeof(errmsg));
+    test_assert(!LIM_is_limit(tokens));
+    CL_free(tokens);
+
+    close(mkstemp(path));
+    snprintf(buf, sizeof(buf), "limit -n 7 -m 64M -c 3 -- sh -c "
+        "\"ulimit -n; ulimit -v; ulimit -t\" > %s", path);
+    tokens = TOK_tokenize_input(buf, errmsg, sizeof(errmsg));
+    test_assert(LIM_limit(tokens, errmsg, sizeof(errmsg)) == 0);
+    CL_free(tokens);
+    FILE* fp = fopen(path, "r");
+    test_assert(fp);
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    buf[len] = 0;
+    fclose(fp);
+    test_assert(!strcmp(buf, "7\n65536\n3\n"));
+
+    // limits end with the command
+    snprintf(buf, sizeof(buf), "sh -c \"ulimit -t\" > %s", path);
+    tokens = TOK_tokenize_input(buf, errmsg, sizeof(errmsg));
+    AST pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(pipeline);
+    test_assert(AST_execute(pipeline) == 0);
+    AST_free(pipeline);
+    CL_free(tokens);
+    fp = fopen(path, "r");
+    test_assert(fp);
+    test_assert(fgets(buf, sizeof(buf), fp));
+    fclose(fp);
+    test_assert(strcmp(buf, "3\n"));
+
+    fflush(stderr);
+    saved_stderr = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+
+    uint64_t start = ST_now();
+    tokens = TOK_tokenize_input("limit -t 0.2 sleep 5 | cat", errmsg, sizeof(errmsg));
+    test_assert(LIM_limit(tokens, errmsg, sizeof(errmsg)) == LIM_TIMED_OUT);
+    test_assert(ST_now() - start < 2000000000);
+    CL_free(tokens);
+
+    // a stage's background descendants die with it
+    unlink(path);
+    snprintf(buf, sizeof(buf), "limit -t 0.3 sh -c \"(sleep 1; touch %s) & "
+        "wait\"", path);
+    tokens = TOK_tokenize_input(buf, errmsg, sizeof(errmsg));
+    test_assert(LIM_limit(tokens, errmsg, sizeof(errmsg)) == LIM_TIMED_OUT);
+    CL_free(tokens);
+    usleep(1500000);
+    test_assert(access(path, F_OK) == -1);
+
+    tokens = TOK_tokenize_input("limit -t 5 false", errmsg, sizeof(errmsg));
+    test_assert(LIM_limit(tokens, errmsg, sizeof(errmsg)) == 1);
+    CL_free(tokens);
+
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+    saved_stderr = -1;
+
+    const char* bad[] = {"limit -t 0 ls", "limit -m 1X ls", "limit -q 1 ls",
+        "limit -n 5", "limit -c"};
+    for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        tokens = TOK_tokenize_input(bad[i], errmsg, sizeof(errmsg));
+        test_assert(LIM_limit(tokens, errmsg, sizeof(errmsg)) == -1);
+        test_assert(!strncmp(errmsg, "usage: limit", 12));
+        CL_free(tokens);
+    }
+    tokens = NULL;
+
+    unlink(path);
+    return 1;
+
+test_error:
+    if (saved_stderr != -1) {
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stderr);
+    }
+    unlink(path);
+    CL_free(tokens);
+    return 0;
+}
+
+
+/*
+ * A zygote handler for test_zygote: writes the message to the first fd
+ * and exits with the number of fds
+ */
+static void test_zygote_main(char* msg, size_t len, int* fds, int nfds)
+{
+    if (write(fds[0], msg, len) != len) _exit(100);
+    _exit(nfds);
+}
+
+
+/*
+ * Runs a command line through Parse and AST_execute, returning its
+ * status, or -1 if it does not parse
+ */
+static int run_line(const char* line)
+{
+    char errmsg[128];
+    CList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+    AST pipeline = tokens? Parse(tokens, errmsg, sizeof(errmsg)): NULL;
+    int status = pipeline? AST_execute(pipeline): -1;
+    AST_free(pipeline);
+    CL_free(tokens);
+    return status;
+}
+
+
+/*
+ * Tests the zygote pool: workers take a message and fds, are refilled
+ * and flushed, and run stages as a fork would, with the shell's current
+ * environment and directory
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_zygote()
+{
+    char path[] = "/tmp/psh_zygoteXXXXXX";
+    char buf[PATH_MAX + 64];
+    char cwd[PATH_MAX];
+    test_assert(getcwd(cwd, sizeof(cwd)));
+
+    test_assert(ZY_size() == 0 && ZY_ready() == 0);
+    test_assert(ZY_spawn("x", 1, NULL, 0) == -1);
+    ZY_start(2, test_zygote_main);
+    test_assert(ZY_size() == 2 && ZY_ready() == 2);
+
+    int fds[2];
+    test_assert(pipe(fds) == 0);
+    pid_t pid = ZY_spawn("hello", 5, fds + 1, 1);
+    close(fds[1]);
+    test_assert(pid > 0 && ZY_ready() == 1);
+    int status;
+    test_assert(waitpid(pid, &status, 0) == pid);
+    test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+    ssize_t n = read(fds[0], buf, sizeof(buf));
+    close(fds[0]);
+    test_assert(n == 5 && !memcmp(buf, "hello", 5));
+
+    ZY_refill();
+    test_assert(ZY_ready() == 2);
+    ZY_flush();
+    test_assert(ZY_size() == 2 && ZY_ready() == 0);
+    ZY_stop();
+    test_assert(ZY_size() == 0);
+
+    // stages, through the builtin
+    close(mkstemp(path));
+    test_assert(run_line("zygote 2") == 0);
+    test_assert(ZY_ready() == 2);
+    snprintf(buf, sizeof(buf), "echo hi | tr a-z A-Z > %s", path);
+    test_assert(run_line(buf) == 0);
+    test_assert(ZY_ready() == 2);
+    FILE* fp = fopen(path, "r");
+    test_assert(fp);
+    test_assert(fgets(buf, sizeof(buf), fp) && !strcmp(buf, "HI\n"));
+    fclose(fp);
+
+    // workers forked before a change still see it
+    setenv("PSH_ZYGOTE_TEST", "yes", 1);
+    snprintf(buf, sizeof(buf), "printenv PSH_ZYGOTE_TEST > %s", path);
+    test_assert(run_line(buf) == 0);
+    unsetenv("PSH_ZYGOTE_TEST");
+    fp = fopen(path, "r");
+    test_assert(fp);
+    test_assert(fgets(buf, sizeof(buf), fp) && !strcmp(buf, "yes\n"));
+    fclose(fp);
+
+    test_assert(run_line("cd /") == 0);
+    snprintf(buf, sizeof(buf), "pwd > %s", path);
+    test_assert(run_line(buf) == 0);
+    test_assert(chdir(cwd) == 0);
+    fp = fopen(path, "r");
+    test_assert(fp);
+    test_assert(fgets(buf, sizeof(buf), fp) && !strcmp(buf, "/\n"));
+    fclose(fp);
+
+    // stages keep the jobserver fds that MAKEFLAGS names
+    test_assert(JS_serve(2));
+    int jsfd = -1;
+    const char* auth = strstr(getenv("MAKEFLAGS"), "--jobserver-auth=");
+    test_assert(auth && sscanf(auth, "--jobserver-auth=%d", &jsfd) == 1);
+    snprintf(buf, sizeof(buf), "ls /proc/self/fd > %s", path);
+    test_assert(run_line(buf) == 0);
+    JS_stop_serving();
+    fp = fopen(path, "r");
+    test_assert(fp);
+    bool found = false;
+    while (fgets(buf, sizeof(buf), fp))
+        found |= atoi(buf) == jsfd;
+    fclose(fp);
+    test_assert(found);
+
+    test_assert(run_line("zygote off") == 0);
+    test_assert(ZY_size() == 0 && ZY_ready() == 0);
+    unlink(path);
+    return 1;
+
+test_error:
+    ZY_stop();
+    JS_stop_serving();
+    if (chdir(cwd)) perror("chdir");
+    unlink(path);
+    return 0;
+}
+
+
+/*
+ * Runs a command line on a server with stdout and stderr sent to a
+ * file, returning its status and the output in out
+ */
+static int run_request(const char* sock, const char* line, char* out,
+    size_t out_sz)
+{
+    char path[] = "/tmp/psh_requestXXXXXX";
+    int fd = mkstemp(path);
+    unlink(path);
+
+    fflush(stdout);
+    fflush(stderr);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int saved_stderr = dup(STDERR_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+
+    int status = SRV_request(sock, line);
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stdout);
+    close(saved_stderr);
+
+    ssize_t len = pread(fd, out, out_sz - 1, 0);
+    out[len > 0? len: 0] = 0;
+    close(fd);
+    return status;
+}
+
+
+/*
+ * Tests server mode: requests run on the client's fds and return their
+ * status, including parse errors, each is a record in the server's
+ * command log, and the server removes its socket when stopped
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_server()
+{
+    char sock[64];
+    char out[512];
+    char log[] = "/tmp/psh_serverlogXXXXXX";
+    FILE* fp = NULL;
+    snprintf(sock, sizeof(sock), "/tmp/psh_server%d.sock", getpid());
+    close(mkstemp(log));
+
+    test_assert(run_request(sock, "true", out, sizeof(out)) == -1);
+
+    pid_t server = fork();
+    if (server == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDERR_FILENO);
+        if (!LOG_start(log)) _exit(1);
+        int served = SRV_serve(sock);
+        LOG_stop();
+        _exit(served);
+    }
+    for (int i = 0; i < 200 && access(sock, F_OK); i++)
+        usleep(10000);
+
+    test_assert(run_request(sock, "echo hi | tr a-z A-Z", out, sizeof(out)) == 0);
+    test_assert(!strcmp(out, "HI\n"));
+    test_assert(run_request(sock, "sh -c \"exit 3\"", out, sizeof(out)) == 3);
+    test_assert(run_request(sock, "", out, sizeof(out)) == 0);
+    test_assert(run_request(sock, "echo \"open", out, sizeof(out)) == 1);
+    test_assert(!strcmp(out, "Unterminated quote\n"));
+    test_assert(run_request(sock, "limit -t 0.1 sleep 5", out, sizeof(out)) ==
+        LIM_TIMED_OUT);
+
+    // one client's command does not hold up another's
+    pid_t slow = fork();
+    if (slow == 0) _exit(run_request(sock, "sleep 0.5", out, sizeof(out)));
+    usleep(100000);
+    uint64_t start = ST_now();
+    test_assert(run_request(sock, "echo quick", out, sizeof(out)) == 0);
+    test_assert(ST_now() - start < 300000000);
+    int status;
+    test_assert(waitpid(slow, &status, 0) == slow);
+
+    test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    kill(server, SIGTERM);
+    test_assert(waitpid(server, &status, 0) == server);
+    test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    test_assert(access(sock, F_OK) == -1);
+
+    // the requests that ran, each as a record of its own
+    fp = fopen(log, "r");
+    test_assert(fp);
+    test_assert(fgets(out, sizeof(out), fp));
+    test_assert(strstr(out, "\"pipeline\":\"echo hi | tr a-z A-Z\",\"status\":0,"));
+    test_assert(strstr(out, "\"utime_us\":"));
+    test_assert(fgets(out, sizeof(out), fp));
+    test_assert(strstr(out, "\"status\":3,"));
+    int records = 2;
+    while (fgets(out, sizeof(out), fp))
+        records++;
+    test_assert(records == 5);
+    fclose(fp);
+    unlink(log);
+    return 1;
+
+test_error:
+    if (fp) fclose(fp);
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+    unlink(sock);
+    unlink(log);
+    return 0;
+}
+
+
+/*
+ * Tests that CList nodes returned to the node pool are reused without
+ * disturbing lists still holding nodes from the same slabs
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_clist_pool()
+{
+    char value[16];
+    CList a = CL_new();
+    CList b = CL_new();
+
+    // interleave two lists across slabs, then give half of a back
+    for (int i = 0; i < 1000; i++) {
+        snprintf(value, sizeof(value), "%d", i);
+        CL_append(a, TOK_new(TOK_WORD, value));
+        CL_push(b, TOK_new(TOK_WORD, value));
+    }
+    for (int i = 0; i < 500; i++)
+        CL_remove(a, 0);
+    CL_free(a);
+
+    // a new list is built from recycled nodes
+    a = CL_new();
+    for (int i = 0; i < 1500; i++) {
+        snprintf(value, sizeof(value), "%d", -i);
+        CL_push(a, TOK_new(TOK_WORD, value));
+    }
+
+    test_assert(CL_length(a) == 1500 && CL_length(b) == 1000);
+
+    // read both back in one pass each; the values are ours to free
+    static Token tokens[1500];
+    int n = CL_drain(b, tokens, 1500);
+    bool ok = n == 1000;
+    for (int i = 0; i < n; i++) {
+        snprintf(value, sizeof(value), "%d", 999 - i);
+        ok = ok && !strcmp(tokens[i].value, value);
+        free((void *) tokens[i].value);
+    }
+    test_assert(ok);
+
+    n = CL_drain(a, tokens, 1500);
+    ok = n == 1500;
+    for (int i = 0; i < n; i++) {
+        snprintf(value, sizeof(value), "%d", i - 1499);
+        ok = ok && !strcmp(tokens[i].value, value);
+        free((void *) tokens[i].value);
+    }
+    test_assert(ok);
+    test_assert(CL_length(a) == 0 && CL_length(b) == 0);
+
+    CL_free(a);
+    CL_free(b);
+    return 1;
+
+test_error:
+    CL_free(a);
+    CL_free(b);
+    return 0;
+}
+
+
+// test_clist_bulk helper: check that batches tile the list in order
+static void test_clist_bulk_batch(int pos, const Token* batch, int n, void* cb_data)
+{
+    int* next = cb_data;
+    if (pos != *next) return;
+    for (int i = 0; i < n; i++)
+        if (atoi(batch[i].value) != pos + i) return;
+    *next += n;
+}
+
+
+/*
+ * Tests CL_extend, CL_drain and CL_foreach_batch, across partial
+ * batches and drains
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_clist_bulk()
+{
+    enum { N = 1000 };
+    static Token tokens[N];
+    char value[16];
+    CList list = CL_new();
+
+    for (int i = 0; i < N; i++) {
+        snprintf(value, sizeof(value), "%d", i);
+        tokens[i] = TOK_new(TOK_WORD, value);
+    }
+
+    // an empty extend, a short one, then the rest
+    CL_extend(list, tokens, 0);
+    CL_extend(list, tokens, 3);
+    CL_extend(list, tokens + 3, N - 3);
+    test_assert(CL_length(list) == N);
+    test_assert(!strcmp(CL_nth(list, -1).value, "999"));
+
+    int next = 0;
+    CL_foreach_batch(list, test_clist_bulk_batch, &next);
+    test_assert(next == N);
+
+    // drain in odd sizes, and past the end
+    int drained = 0, n;
+    while ((n = CL_drain(list, tokens + drained, 37)) > 0)
+        drained += n;
+    test_assert(drained == N && CL_length(list) == 0);
+    test_assert(CL_drain(list, tokens, 1) == 0);
+    for (int i = 0; i < N; i++)
+        test_assert(atoi(tokens[i].value) == i);
+
+    // the list works as usual after being drained
+    CL_append(list, TOK_new(TOK_WORD, "x"));
+    test_assert(CL_length(list) == 1 && !strcmp(CL_nth(list, -1).value, "x"));
+
+    for (int i = 0; i < N; i++)
+        free((void *) tokens[i].value);
+    CL_free(list);
+    return 1;
+
+test_error:
+    CL_free(list);
+    return 0;
+}
+
+
+/*
+ * Tests that the tail of a CList stays correct through CL_append,
+ * CL_insert, CL_remove, CL_join and CL_reverse
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_clist_tail()
+{
+    char buffer[64];
+    CList a = CL_new();
+    CList b = CL_new();
+
+    // CL_length checks the tail against a walk of the list
+    CL_append(a, TOK_new(TOK_WORD, "b"));
+    CL_push(a, TOK_new(TOK_WORD, "a"));
+    CL_insert(a, TOK_new(TOK_WORD, "d"), -1);
+    CL_insert(a, TOK_new(TOK_WORD, "c"), 2);
+    test_assert(CL_length(a) == 4);
+    test_assert(!strcmp(CL_nth(a, -1).value, "d"));
+
+    // remove the tail, then the only element left
+    CL_remove(a, -1);
+    test_assert(CL_length(a) == 3 && !strcmp(CL_nth(a, -1).value, "c"));
+    CL_append(b, TOK_new(TOK_WORD, "x"));
+    CL_remove(b, 0);
+    test_assert(CL_length(b) == 0 && CL_nth(b, -1).type == TOK_END);
+
+    // join onto a list, from an empty list, and into an empty list
+    CL_append(b, TOK_new(TOK_WORD, "y"));
+    CL_append(b, TOK_new(TOK_WORD, "z"));
+    CL_join(a, b);
+    CL_join(a, b);
+    test_assert(CL_length(a) == 5 && CL_length(b) == 0);
+    CL_join(b, a);
+    test_assert(CL_length(a) == 0 && CL_length(b) == 5);
+    CL_append(b, TOK_new(TOK_WORD, "!"));
+    CL_append(a, TOK_new(TOK_WORD, "?"));
+
+    CL_reverse(b);
+    CL_append(b, TOK_new(TOK_WORD, "."));
+    test_assert(CL_length(b) == 7);
+
+    size_t size = 0;
+    for (int i = 0; i < CL_length(b); i++)
+        size += snprintf(buffer + size, sizeof(buffer) - size, "%s", CL_nth(b, i).value);
+    test_assert(!strcmp(buffer, "!zycba."));
+    test_assert(!strcmp(CL_nth(a, -1).value, "?"));
+
+    CL_free(a);
+    CL_free(b);
+    return 1;
+
+test_error:
+    CL_free(a);
+    CL_free(b);
+    return 0;
+}
+
+
+/*
+ * Tests random CL_insert and CL_remove calls against an array doing the
+ * same, enough to split and empty the chunks of clist_unrolled.c
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_clist_random()
+{
+    enum { OPS = 20000, MAX = 2000 };
+    static int model[MAX];
+    int n = 0;
+    unsigned seed = 12;
+    char value[16];
+    CList list = CL_new();
+
+    for (int op = 0; op < OPS; op++) {
+        // grow to about MAX/2, then hover around it
+        if (n < MAX && (n == 0 || rand_r(&seed) % 3 != 0 || (n < MAX / 2 && rand_r(&seed) % 2))) {
+            int pos = rand_r(&seed) % (n + 1);
+            snprintf(value, sizeof(value), "%d", op);
+            test_assert(CL_insert(list, TOK_new(TOK_WORD, value), pos));
+            memmove(model + pos + 1, model + pos, (n - pos) * sizeof(int));
+            model[pos] = op;
+            n++;
+        }
+        else {
+            int pos = rand_r(&seed) % n;
+            CL_remove(list, pos);
+            memmove(model + pos, model + pos + 1, (n - pos - 1) * sizeof(int));
+            n--;
+        }
+
+        if (op % 1000 == 0 || op == OPS - 1) {
+            test_assert(CL_length(list) == n);
+            for (int i = 0; i < n; i++)
+                test_assert(atoi(CL_nth(list, i).value) == model[i]);
+        }
+    }
+
+    CL_reverse(list);
+    for (int i = 0; i < n; i++)
+        test_assert(atoi(CL_nth(list, -1 - i).value) == model[i]);
+
+    CL_free(list);
+    return 1;
+
+test_error:
+    CL_free(list);
+    return 0;
+}
+
+
+// test_clist_generic helper: a position-weighted sum of an IntList
+static int sum;
+static void test_clist_generic_sum(int pos, int element, void* cb_data)
+{   sum += element * (pos + 1); }
+
+
+/*
+ * Tests a list of ints instantiated with DEFINE_CLIST, and a Token list
+ * alongside it drawing on its own node pool
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_clist_generic()
+{
+    IntList ints = IntL_new();
+    CList tokens = CL_new();
+
+    for (int i = 1; i <= 100; i++) {
+        IntL_append(ints, i);
+        CL_append(tokens, TOK_new(TOK_WORD, "x"));
+    }
+    test_assert(IntL_length(ints) == 100 && CL_length(tokens) == 100);
+    test_assert(IntL_nth(ints, 0) == 1 && IntL_nth(ints, -1) == 100);
+    test_assert(IntL_nth(ints, 100) == -1);
+
+    test_assert(IntL_pop(ints) == 1);
+    test_assert(IntL_remove(ints, -1) == 100);
+    test_assert(IntL_insert(ints, 0, 0) && IntL_insert(ints, 101, -1));
+    IntL_reverse(ints);
+    test_assert(IntL_nth(ints, 0) == 101 && IntL_nth(ints, -1) == 0);
+
+    IntList copy = IntL_copy(ints);
+    IntL_join(ints, copy);
+    test_assert(IntL_length(ints) == 200 && IntL_length(copy) == 0);
+    IntL_free(copy);
+
+    sum = 0;
+    IntL_free(ints);
+    ints = IntL_new();
+    for (int i = 0; i < 3; i++)
+        IntL_push(ints, i);
+    IntL_foreach(ints, test_clist_generic_sum, NULL);
+    test_assert(sum == 2 * 1 + 1 * 2 + 0 * 3);
+
+    test_assert(!strcmp(CL_nth(tokens, 50).value, "x"));
+    IntL_free(ints);
+    CL_free(tokens);
+    return 1;
+
+test_error:
+    IntL_free(ints);
+    CL_free(tokens);
+    return 0;
+}
+
+
 int main(int argc, char* argv[])
 {
     int passed = 0;
     int num_tests = 0;
 
+    num_tests++; passed += test_clist_pool();
+    num_tests++; passed += test_clist_tail();
+    num_tests++; passed += test_clist_random();
+    num_tests++; passed += test_clist_generic();
+    num_tests++; passed += test_clist_bulk();
     num_tests++; passed += test_tok_tokenize_input();
     num_tests++; passed += test_ast_pipeline();
     num_tests++; passed += test_parse();
     num_tests++; passed += test_parse_errors();
     num_tests++; passed += test_ast_execute();
+    num_tests++; passed += test_walk();
+    num_tests++; passed += test_globcache();
+    num_tests++; passed += test_program();
+    num_tests++; passed += test_brace();
+    num_tests++; passed += test_chunk();
+    num_tests++; passed += test_stats();
+    num_tests++; passed += test_ring();
+    num_tests++; passed += test_trace();
+    num_tests++; passed += test_perfstat();
+    num_tests++; passed += test_bench();
+    num_tests++; passed += test_memstats();
+    num_tests++; passed += test_meter();
+    num_tests++; passed += test_cmdlog();
+    num_tests++; passed += test_parallel();
+    num_tests++; passed += test_jobserver();
+    num_tests++; passed += test_placement();
+    num_tests++; passed += test_limit();
+    num_tests++; passed += test_zygote();
+    num_tests++; passed += test_server();
 
 
     printf("Passed %d/%d test cases\n", passed, num_tests);
@@ -0,0 +1,291 @@
+/*
+ * ring.c
+ *
+ * Lock-free single producer, single consumer ring of records
+ *
+ * The ring is a power of two sized byte buffer. head and tail count
+ * bytes ever consumed and produced, so their difference is the space in
+ * use. Each record is a size_t length followed by its data, padded to a
+ * multiple of 8 bytes. A record never wraps: when one does not fit
+ * before the end of the buffer, the producer writes a padding marker
+ * and starts it at the beginning.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "ring.h"
+
+#define RING_ALIGN(n)   (((n) + 7) & ~(size_t) 7)
+#define RING_HDR        sizeof(size_t)
+#define RING_PAD        SIZE_MAX
+
+// Records gathered into one writev, and how long an idle writer sleeps
+#define RING_WRITEV_MAX 64
+#define RING_IDLE_NS    2000000
+
+struct _ring {
+    char* buf;
+    size_t cap;
+    atomic_size_t head;     // written by the consumer only
+    atomic_size_t tail;     // written by the producer only
+    atomic_uint_least64_t dropped;
+};
+
+struct _ring_writer {
+    Ring ring;
+    int fd;
+    RingFormat format;      // NULL to write records as they are
+    size_t max_out;
+    char* scratch;          // RING_WRITEV_MAX * max_out formatted bytes
+    atomic_bool stop;
+    pthread_t thread;
+};
+
+
+
+// Documented in .h file
+Ring RING_new(size_t capacity)
+{
+    Ring ring = calloc(1, sizeof(struct _ring));
+    assert(ring);
+
+    ring->cap = 64;
+    while (ring->cap < capacity) ring->cap *= 2;
+    ring->buf = malloc(ring->cap);
+    assert(ring->buf);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+
+    return ring;
+}
+
+
+// Documented in .h file
+void RING_free(Ring ring)
+{
+    if (!ring) return;
+    free(ring->buf);
+    free(ring);
+}
+
+
+// Documented in .h file
+bool RING_push(Ring ring, const void* data, size_t len)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    size_t need = RING_HDR + RING_ALIGN(len);
+    size_t off = tail & (ring->cap - 1);
+    size_t room = ring->cap - off;
+    size_t total = need <= room? need: room + need;
+    if (need > ring->cap || tail + total - head > ring->cap) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+
+    if (need > room) {
+        *(size_t*) (ring->buf + off) = RING_PAD;
+        tail += room;
+        off = 0;
+    }
+    *(size_t*) (ring->buf + off) = len;
+    memcpy(ring->buf + off + RING_HDR, data, len);
+
+    // publish the record only once it is complete
+    atomic_store_explicit(&ring->tail, tail + need, memory_order_release);
+    return true;
+}
+
+
+/*
+ * Find the record at or after a position, skipping a padding marker
+ *
+ * Returns:
+ *  size_t      The position of the record; equal to tail if there is
+ *              none
+ */
+static size_t ring_record(Ring ring, size_t pos, size_t tail)
+{
+    if (pos != tail) {
+        size_t off = pos & (ring->cap - 1);
+        if (*(size_t*) (ring->buf + off) == RING_PAD)
+            pos += ring->cap - off;
+    }
+    return pos;
+}
+
+
+// Documented in .h file
+int RING_peek(Ring ring, struct iovec* iov, int max)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    int n = 0;
+    for (size_t pos = ring_record(ring, head, tail); n < max && pos != tail; ) {
+        char* rec = ring->buf + (pos & (ring->cap - 1));
+        size_t len = *(size_t*) rec;
+        iov[n++] = (struct iovec) {rec + RING_HDR, len};
+        pos = ring_record(ring, pos + RING_HDR + RING_ALIGN(len), tail);
+    }
+    return n;
+}
+
+
+// Documented in .h file
+void RING_consume(Ring ring, int n)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    for (int i = 0; i < n; i++) {
+        head = ring_record(ring, head, tail);
+        assert(head != tail);
+        head += RING_HDR + RING_ALIGN(*(size_t*) (ring->buf + (head & (ring->cap - 1))));
+    }
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+}
+
+
+// Documented in .h file
+uint64_t RING_dropped(Ring ring)
+{   return atomic_load_explicit(&ring->dropped, memory_order_relaxed); }
+
+
+/*
+ * Write all of an iovec array, resuming after short writes
+ *
+ * Returns:
+ *  bool        false on a write error
+ */
+static bool writev_all(int fd, struct iovec* iov, int n)
+{
+    while (n > 0) {
+        ssize_t written = writev(fd, iov, n);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        while (n > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char*) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+
+/*
+ * Replace records with their formatted bytes, dropping those formatted
+ * to nothing
+ *
+ * Returns:
+ *  int         The number of iovecs left to write
+ */
+static int format_records(RingWriter writer, struct iovec* iov, int n)
+{
+    int nout = 0;
+    for (int i = 0; i < n; i++) {
+        char* out = writer->scratch + i * writer->max_out;
+        size_t len = writer->format(iov[i].iov_base, iov[i].iov_len, out,
+            writer->max_out);
+        if (len) iov[nout++] = (struct iovec) {out, len};
+    }
+    return nout;
+}
+
+
+/*
+ * The writer thread: drain whatever has accumulated, sleep when there is
+ * nothing, and exit once asked to stop and the ring is empty
+ */
+static void* writer_main(void* arg)
+{
+    RingWriter writer = arg;
+    struct iovec iov[RING_WRITEV_MAX];
+
+    while (true) {
+        // read stop before peeking, so records pushed before the stop
+        // request are always seen
+        bool stop = atomic_load(&writer->stop);
+        int n = RING_peek(writer->ring, iov, RING_WRITEV_MAX);
+        if (n) {
+            int nout = n;
+            if (writer->format) nout = format_records(writer, iov, n);
+            if (!writev_all(writer->fd, iov, nout)) perror("ring writer");
+            RING_consume(writer->ring, n);
+        }
+        else if (stop) break;
+        else nanosleep(&(struct timespec) {0, RING_IDLE_NS}, NULL);
+    }
+    return NULL;
+}
+
+
+// Documented in .h file
+RingWriter RING_writer_start(Ring ring, int fd)
+{   return RING_formatter_start(ring, fd, NULL, 0); }
+
+
+// Documented in .h file
+RingWriter RING_formatter_start(Ring ring, int fd, RingFormat format,
+    size_t max_out)
+{
+    RingWriter writer = calloc(1, sizeof(struct _ring_writer));
+    assert(writer);
+    writer->ring = ring;
+    writer->fd = fd;
+    writer->format = format;
+    writer->max_out = max_out;
+    if (format) {
+        writer->scratch = malloc(RING_WRITEV_MAX * max_out);
+        assert(writer->scratch);
+    }
+    atomic_init(&writer->stop, false);
+
+    // the thread starts with every signal blocked, so that one the shell
+    // blocks to read from a signalfd is never delivered to it instead
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &saved);
+    int failed = pthread_create(&writer->thread, NULL, writer_main, writer);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (failed) {
+        free(writer->scratch);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+
+// Documented in .h file
+void RING_writer_stop(RingWriter writer)
+{
+    if (!writer) return;
+    atomic_store(&writer->stop, true);
+    pthread_join(writer->thread, NULL);
+    free(writer->scratch);
+    free(writer);
+}
@@ -0,0 +1,141 @@
+/*
+ * ring.h
+ *
+ * Lock-free single producer, single consumer ring of variable length
+ * records, and a writer thread that drains one to a file descriptor.
+ * The shell thread pushes finished records and never blocks or makes a
+ * system call; the writer does the I/O off the hot path.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+typedef struct _ring* Ring;
+typedef struct _ring_writer* RingWriter;
+
+/*
+ * Turns a record into the bytes to write for it, on the writer thread
+ *
+ * Parameters:
+ *  rec, len    The record
+ *  out, out_sz Where to put the bytes
+ *
+ * Returns:
+ *  size_t      The number of bytes put in out; 0 skips the record
+ */
+typedef size_t (*RingFormat)(const void* rec, size_t len, char* out, size_t out_sz);
+
+
+/*
+ * Create a ring
+ *
+ * Parameters:
+ *  capacity    Its size in bytes, rounded up to a power of two
+ *
+ * Returns:
+ *  Ring        The new ring, released with RING_free
+ */
+Ring RING_new(size_t capacity);
+
+
+/*
+ * Free a ring, and any records still in it
+ */
+void RING_free(Ring ring);
+
+
+/*
+ * Copy a record into the ring. Only one thread may push to a ring.
+ *
+ * Parameters:
+ *  ring        The ring
+ *  data, len   The record
+ *
+ * Returns:
+ *  bool        true if the record was added, false if the ring was too
+ *              full, in which case the record is dropped and counted
+ */
+bool RING_push(Ring ring, const void* data, size_t len);
+
+
+/*
+ * Look at the oldest records in the ring without removing them. Only
+ * one thread may read from a ring.
+ *
+ * Parameters:
+ *  ring        The ring
+ *  iov         Return space for the records, which stay valid until
+ *              they are consumed
+ *  max         The most records to return
+ *
+ * Returns:
+ *  int         The number of records returned, 0 if the ring is empty
+ */
+int RING_peek(Ring ring, struct iovec* iov, int max);
+
+
+/*
+ * Remove the oldest records, which must have been returned by RING_peek
+ *
+ * Parameters:
+ *  ring        The ring
+ *  n           The number of records to remove
+ */
+void RING_consume(Ring ring, int n);
+
+
+/*
+ * The number of records dropped because the ring was full
+ */
+uint64_t RING_dropped(Ring ring);
+
+
+/*
+ * Start a thread that drains a ring to a file descriptor, writing the
+ * records that have accumulated with a single writev. The thread
+ * becomes the ring's only reader.
+ *
+ * Parameters:
+ *  ring        The ring
+ *  fd          Where to write its records
+ *
+ * Returns:
+ *  RingWriter  The writer, stopped with RING_writer_stop; NULL if the
+ *              thread could not be started
+ */
+RingWriter RING_writer_start(Ring ring, int fd);
+
+
+/*
+ * Start a writer that formats each record before writing it, so the
+ * pushing thread only has to copy raw records into the ring
+ *
+ * Parameters:
+ *  ring        The ring
+ *  fd          Where to write the formatted records
+ *  format      Formats one record
+ *  max_out     The most bytes format may produce for a record
+ *
+ * Returns:
+ *  RingWriter  The writer, stopped with RING_writer_stop; NULL if the
+ *              thread could not be started
+ */
+RingWriter RING_formatter_start(Ring ring, int fd, RingFormat format,
+    size_t max_out);
+
+
+/*
+ * Stop a writer once every record pushed so far has been written. The
+ * ring and the file descriptor are left open.
+ */
+void RING_writer_stop(RingWriter writer);
+
+#endif /* _RING_H_ */
@@ -0,0 +1,437 @@
+/*
+ * server.c
+ *
+ * Server mode
+ *
+ * Requests and replies are single SOCK_SEQPACKET messages, so neither
+ * side needs framing: a request is the command line and its NUL with
+ * three fds attached, a reply is the status as an int. The NUL keeps
+ * an empty line from looking like the end of the connection.
+ *
+ * A client has at most one command running; while it does, the loop
+ * watches the command's pidfd for its exit and the client's socket only
+ * for a hangup.
+ *
+ * A forked command lets go of the command log and cannot log itself, so
+ * the server logs and traces each request when it reaps its child, as
+ * one stage with the rusage of everything the child waited for.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE     // accept4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/pidfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "server.h"
+#include "tokenize.h"
+#include "parse.h"
+#include "program.h"
+#include "bench.h"
+#include "limit.h"
+#include "parallel.h"
+#include "cmdlog.h"
+#include "trace.h"
+#include "stats.h"
+
+#define SRV_NFDS        3
+
+struct _client {
+    int sock;
+    pid_t pid;              // its running command, or 0
+    int pidfd;
+    bool hung_up;           // gone while its command runs
+    char* line;             // the running command's line, for the log
+    struct timespec started;    // when it was forked, for the log
+    uint64_t forked;            // the same, from ST_now, for the trace
+};
+
+static struct _client* clients = NULL;
+static int nclients = 0;
+static int cap = 0;
+static int listen_fd = -1;
+static int signal_fd = -1;
+
+
+
+/*
+ * Fill in the address of a socket path
+ *
+ * Returns:
+ *  bool        false if the path is too long
+ */
+static bool make_addr(const char* path, struct sockaddr_un* addr)
+{
+    *addr = (struct sockaddr_un) {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+
+/*
+ * Create the listening socket, replacing a stale one
+ *
+ * Returns:
+ *  int         The socket, or -1
+ */
+static int listen_on(const char* path)
+{
+    struct sockaddr_un addr;
+    if (!make_addr(path, &addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    int ok = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+    if (ok == -1 && errno == EADDRINUSE) {
+        // nobody answering means the server that made it is gone
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (probe != -1 &&
+            connect(probe, (struct sockaddr*) &addr, sizeof(addr)) == -1 &&
+            errno == ECONNREFUSED) {
+            unlink(path);
+            ok = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+        }
+        else errno = EADDRINUSE;
+        if (probe != -1) close(probe);
+    }
+    if (ok == -1 || listen(fd, SOMAXCONN) == -1) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+static void client_add(int sock)
+{
+    if (nclients == cap) {
+        cap = cap? 2 * cap: 16;
+        clients = realloc(clients, cap * sizeof(struct _client));
+        assert(clients);
+    }
+    clients[nclients++] = (struct _client) {sock, 0, -1, false, NULL};
+}
+
+
+static void client_drop(int i)
+{
+    close(clients[i].sock);
+    clients[i] = clients[--nclients];
+}
+
+
+/*
+ * Send a client its command's status
+ *
+ * Returns:
+ *  bool        false if the client is gone
+ */
+static bool reply(struct _client* c, int status)
+{
+    return send(c->sock, &status, sizeof(status), MSG_NOSIGNAL) ==
+        sizeof(status);
+}
+
+
+/*
+ * Child side of a request: run the line on the client's fds and exit
+ * with its status. Does not return.
+ */
+static void run_command(CList tokens, AST pipeline, int* fds)
+{
+    // the child keeps nothing of the server's sockets
+    close(listen_fd);
+    close(signal_fd);
+    for (int i = 0; i < nclients; i++) {
+        close(clients[i].sock);
+        if (clients[i].pidfd != -1) close(clients[i].pidfd);
+    }
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    setpgid(0, 0);
+
+    for (int fd = 0; fd < SRV_NFDS; fd++) {
+        dup2(fds[fd], fd);
+        close(fds[fd]);
+    }
+
+    char errmsg[128];
+    int status;
+    if (pipeline) status = AST_execute(pipeline);
+    else if (BN_is_bench(tokens))
+        status = BN_bench(tokens, stdout, errmsg, sizeof(errmsg));
+    else if (LIM_is_limit(tokens))
+        status = LIM_limit(tokens, errmsg, sizeof(errmsg));
+    else status = PAR_parallel(tokens, STDIN_FILENO, errmsg, sizeof(errmsg));
+    if (status == -1) {
+        fprintf(stderr, "%s\n", errmsg);
+        status = 1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
+}
+
+
+/*
+ * Take a client's next request and start its command
+ *
+ * Returns:
+ *  bool        false if the client has gone and should be dropped
+ */
+static bool start_request(struct _client* c)
+{
+    char* line = malloc(SRV_MAX_LINE + 1);
+    assert(line);
+    union {
+        char buf[CMSG_SPACE(SRV_NFDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {line, SRV_MAX_LINE};
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+    ssize_t n;
+    while ((n = recvmsg(c->sock, &mh, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+    if (n <= 0) {
+        free(line);
+        return false;
+    }
+    line[n] = 0;
+
+    int fds[SRV_NFDS];
+    int nfds = 0;
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+    if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+        nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cm), nfds * sizeof(int));
+    }
+    if (nfds != SRV_NFDS || (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        for (int i = 0; i < nfds; i++)
+            close(fds[i]);
+        free(line);
+        return reply(c, 2);
+    }
+
+    // parsing here, rather than in the child, keeps the caches warm
+    char errmsg[128];
+    int status = -1;
+    AST pipeline = NULL;
+    CList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+    if (!tokens) status = 1;
+    else if (CL_length(tokens) == 0) status = 0;
+    else if (!BN_is_bench(tokens) && !LIM_is_limit(tokens) &&
+        !PAR_is_parallel(tokens)) {
+        pipeline = Parse(tokens, errmsg, sizeof(errmsg));
+        if (!pipeline) status = 1;
+        else PRG_free(PRG_compile(pipeline));
+    }
+    if (status == 1) dprintf(fds[2], "%s\n", errmsg);
+
+    if (status == -1) {
+        fflush(stdout);
+        fflush(stderr);
+        struct timespec started;
+        clock_gettime(CLOCK_REALTIME, &started);
+        uint64_t forked = ST_now();
+        pid_t pid = fork();
+        if (pid == 0) run_command(tokens, pipeline, fds);
+        if (pid == -1) {
+            dprintf(fds[2], "fork: %s\n", strerror(errno));
+            status = 1;
+        }
+        else {
+            // its own group, so that killing it reaches every stage
+            setpgid(pid, pid);
+            *c = (struct _client) {c->sock, pid, pidfd_open(pid, 0), false,
+                strdup(line), started, forked};
+        }
+    }
+
+    for (int i = 0; i < SRV_NFDS; i++)
+        close(fds[i]);
+    AST_free(pipeline);
+    CL_free(tokens);
+    free(line);
+    return status == -1 || reply(c, status);
+}
+
+
+/*
+ * Reap a client's finished command and send its status
+ *
+ * Returns:
+ *  bool        false if the client has gone and should be dropped
+ */
+static bool finish_request(struct _client* c)
+{
+    int status;
+    struct rusage usage;
+    while (wait4(c->pid, &status, 0, &usage) == -1 && errno == EINTR);
+    TR_stage(c->line, c->pid, c->forked, 0, ST_now(), &usage);
+    LOG_child(c->line, &c->started, c->pid, status, &usage);
+    close(c->pidfd);
+    free(c->line);
+    c->line = NULL;
+    c->pid = 0;
+    c->pidfd = -1;
+    if (c->hung_up) return false;
+    return reply(c, WIFSIGNALED(status)? 128 + WTERMSIG(status):
+        WEXITSTATUS(status));
+}
+
+
+// Documented in .h file
+int SRV_serve(const char* path)
+{
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    sigprocmask(SIG_BLOCK, &stop, NULL);
+    signal_fd = signalfd(-1, &stop, SFD_CLOEXEC);
+    listen_fd = listen_on(path);
+    if (signal_fd == -1 || listen_fd == -1) {
+        if (signal_fd != -1) close(signal_fd);
+        sigprocmask(SIG_UNBLOCK, &stop, NULL);
+        return 1;
+    }
+    fprintf(stderr, "plaidsh: serving on %s\n", path);
+
+    for (bool running = true; running; ) {
+        // the listener and signals, then one or two entries per client
+        struct pollfd fds[2 + 2 * nclients];
+        int owner[2 + 2 * nclients];
+        int n = 0;
+        fds[n] = (struct pollfd) {listen_fd, POLLIN, 0};
+        owner[n++] = -1;
+        fds[n] = (struct pollfd) {signal_fd, POLLIN, 0};
+        owner[n++] = -1;
+        for (int i = 0; i < nclients; i++) {
+            struct _client* c = &clients[i];
+            fds[n] = (struct pollfd) {c->sock, c->pid? 0: POLLIN, 0};
+            owner[n++] = i;
+            if (c->pid) {
+                fds[n] = (struct pollfd) {c->pidfd, POLLIN, 0};
+                owner[n++] = i;
+            }
+        }
+
+        if (poll(fds, n, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        // clients are dropped last to first, so owner indexes stay valid
+        bool drop[nclients];
+        memset(drop, 0, sizeof(drop));
+        for (int k = n - 1; k >= 2; k--) {
+            if (!fds[k].revents) continue;
+            struct _client* c = &clients[owner[k]];
+            if (c->pid && fds[k].fd == c->pidfd)
+                drop[owner[k]] = !finish_request(c);
+            else if (c->pid) {
+                // hung up mid-command: nobody is left to read its output;
+                // the group outlives a reused pid until the leader is reaped
+                c->hung_up = true;
+                kill(-c->pid, SIGKILL);
+            }
+            else if (!drop[owner[k]])
+                drop[owner[k]] = !start_request(c);
+        }
+        for (int i = nclients - 1; i >= 0; i--)
+            if (drop[i]) client_drop(i);
+
+        struct signalfd_siginfo info;
+        if (fds[1].revents && read(signal_fd, &info, sizeof(info)) > 0)
+            running = false;
+        if (fds[0].revents & POLLIN) {
+            int sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (sock != -1) client_add(sock);
+        }
+    }
+
+    for (int i = nclients - 1; i >= 0; i--) {
+        if (clients[i].pid) {
+            kill(-clients[i].pid, SIGTERM);
+            clients[i].hung_up = true;
+            finish_request(&clients[i]);
+        }
+        client_drop(i);
+    }
+    close(listen_fd);
+    close(signal_fd);
+    listen_fd = signal_fd = -1;
+    unlink(path);
+    sigprocmask(SIG_UNBLOCK, &stop, NULL);
+    return 0;
+}
+
+
+// Documented in .h file
+int SRV_request(const char* path, const char* line)
+{
+    struct sockaddr_un addr;
+    if (!make_addr(path, &addr)) return -1;
+    size_t len = strlen(line) + 1;
+    if (len > SRV_MAX_LINE) {
+        fprintf(stderr, "plaidsh: command too long\n");
+        return -1;
+    }
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr*) &addr, sizeof(addr))) {
+        perror(path);
+        if (sock != -1) close(sock);
+        return -1;
+    }
+
+    int fds[SRV_NFDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    union {
+        char buf[CMSG_SPACE(SRV_NFDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {(void*) line, len};
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+    int status = -1;
+    ssize_t n;
+    while ((n = sendmsg(sock, &mh, MSG_NOSIGNAL)) == -1 && errno == EINTR);
+    if (n != -1)
+        while ((n = recv(sock, &status, sizeof(status), 0)) == -1 && errno == EINTR);
+    if (n != sizeof(status)) {
+        fprintf(stderr, "plaidsh: %s: no reply from server\n", path);
+        status = -1;
+    }
+    close(sock);
+    return status;
+}
@@ -0,0 +1,64 @@
+/*
+ * server.h
+ *
+ * Server mode: a long-lived shell that runs command lines for local
+ * clients over a Unix socket, so that each command skips shell startup
+ * and finds the command hash and glob cache already warm
+ *
+ *   plaidsh --serve SOCKET
+ *   plaidsh --connect SOCKET command
+ *
+ * A client sends one command line per request, with its stdin, stdout
+ * and stderr passed as SCM_RIGHTS, and gets back the command's exit
+ * status. The server tokenizes and parses the line itself, so globs and
+ * command lookups fill its caches for the commands that follow, then
+ * forks a child to execute it on the client's fds. Every client is
+ * served from one poll loop, whatever its commands are doing. Each
+ * command runs in a process group of its own, all of which is killed
+ * if the client hangs up before it finishes.
+ *
+ * Since each command runs in a child, builtins that change the shell,
+ * such as cd, last only for that command; cmdlog and trace too, so the
+ * server's log and trace are the ones PSH_LOG and PSH_TRACE start. They
+ * get a record per request, with the request as its only stage.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#define SRV_MAX_LINE        65536
+
+
+/*
+ * Serve clients until SIGINT or SIGTERM, then kill any commands still
+ * running and remove the socket
+ *
+ * Parameters:
+ *  path        The socket to listen on; a stale socket left there by a
+ *              server that is gone is replaced
+ *
+ * Returns:
+ *  int         0 once stopped, 1 if the socket could not be set up
+ */
+int SRV_serve(const char* path);
+
+
+/*
+ * Run a command line on a server, with this process's stdin, stdout
+ * and stderr
+ *
+ * Parameters:
+ *  path        The server's socket
+ *  line        The command line
+ *
+ * Returns:
+ *  int         The command's exit status, 128 plus the signal if it was
+ *              killed; or -1 if the server could not be reached, with
+ *              the reason on stderr
+ */
+int SRV_request(const char* path, const char* line);
+
+#endif /* _SERVER_H_ */
@@ -0,0 +1,173 @@
+/*
+ * stats.c
+ *
+ * Per-phase latency statistics of the shell
+ *
+ * Each phase has a log-linear histogram in the manner of HdrHistogram:
+ * values below 128ns count exactly, and every power of two above that
+ * is split into 64 equal sub-buckets. Recording is a count leading
+ * zeros and an increment, and any percentile is within 1/64 of the
+ * true value.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+
+// Sub-buckets per power of two, and the largest value tracked: 2^40ns
+// is over 18 minutes, and longer durations count as that
+#define ST_SUB_BITS 6
+#define ST_SUB (1 << ST_SUB_BITS)
+#define ST_MAX_BITS 40
+#define ST_BUCKETS ((ST_MAX_BITS - ST_SUB_BITS + 1) * ST_SUB)
+
+struct _hist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[ST_BUCKETS];
+};
+
+static struct _hist hists[ST_NPHASES];
+
+static const char* phase_names[ST_NPHASES] = {
+    [ST_TOKENIZE] = "tokenize",
+    [ST_PARSE] = "parse",
+    [ST_COMPILE] = "compile",
+    [ST_PIPE] = "pipe",
+    [ST_FORK] = "fork",
+    [ST_EXEC] = "exec",
+    [ST_WAIT] = "wait",
+    [ST_COMMAND] = "command",
+};
+
+// The shared page for ST_exec_slots, NULL until the first call
+static uint64_t* exec_slots = NULL;
+
+
+
+/*
+ * The bucket holding a value
+ */
+static int bucket_of(uint64_t ns)
+{
+    if (ns < 2 * ST_SUB) return ns;
+    if (ns >= (uint64_t) 1 << ST_MAX_BITS) return ST_BUCKETS - 1;
+
+    // ns is in [2^e, 2^(e+1)) with e >= 7; keep its top 7 bits
+    int shift = 63 - __builtin_clzll(ns) - ST_SUB_BITS;
+    return shift * ST_SUB + (int) (ns >> shift);
+}
+
+
+/*
+ * The smallest value in a bucket, the inverse of bucket_of
+ */
+static uint64_t bucket_value(int bucket)
+{
+    if (bucket < 2 * ST_SUB) return bucket;
+    int shift = bucket / ST_SUB - 1;
+    return (uint64_t) (bucket - shift * ST_SUB) << shift;
+}
+
+
+// Documented in .h file
+uint64_t ST_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Documented in .h file
+void ST_record(StatPhase phase, uint64_t ns)
+{
+    struct _hist* h = &hists[phase];
+    h->buckets[bucket_of(ns)]++;
+    h->count++;
+    if (ns > h->max) h->max = ns;
+}
+
+
+// Documented in .h file
+void ST_since(StatPhase phase, uint64_t start)
+{   ST_record(phase, ST_now() - start); }
+
+
+// Documented in .h file
+uint64_t ST_count(StatPhase phase)
+{   return hists[phase].count; }
+
+
+// Documented in .h file
+uint64_t ST_percentile(StatPhase phase, double q)
+{
+    struct _hist* h = &hists[phase];
+    if (!h->count) return 0;
+
+    // the rank of the sample at q, counting from 1
+    uint64_t rank = (uint64_t) (q / 100 * h->count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank >= h->count) return h->max;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < ST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_value(i);
+            return value < h->max? value: h->max;
+        }
+    }
+    return h->max;
+}
+
+
+// Documented in .h file
+uint64_t* ST_exec_slots()
+{
+    if (!exec_slots) {
+        exec_slots = mmap(NULL, ST_MAX_STAGES * sizeof(uint64_t),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    }
+    return exec_slots == MAP_FAILED? NULL: exec_slots;
+}
+
+
+// Documented in .h file
+void ST_reset()
+{   memset(hists, 0, sizeof(hists)); }
+
+
+/*
+ * Print a duration in the most readable unit
+ */
+static void print_ns(FILE* out, uint64_t ns)
+{
+    if (ns < 10000) fprintf(out, " %8luns", (unsigned long) ns);
+    else if (ns < 10000000) fprintf(out, " %8.1fus", ns / 1e3);
+    else fprintf(out, " %8.1fms", ns / 1e6);
+}
+
+
+// Documented in .h file
+void ST_print(FILE* out)
+{
+    fprintf(out, "%-10s %8s %10s %10s %10s %10s\n",
+        "phase", "count", "p50", "p99", "p99.9", "max");
+    for (int p = 0; p < ST_NPHASES; p++) {
+        fprintf(out, "%-10s %8lu", phase_names[p], (unsigned long) hists[p].count);
+        print_ns(out, ST_percentile(p, 50));
+        print_ns(out, ST_percentile(p, 99));
+        print_ns(out, ST_percentile(p, 99.9));
+        print_ns(out, hists[p].max);
+        fprintf(out, "\n");
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * stats.h
+ *
+ * Per-phase latency statistics of the shell: where the time goes between
+ * Enter and the next prompt, kept in HDR-style log-linear histograms
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Stages of one pipeline that get an exec start slot
+#define ST_MAX_STAGES 64
+
+typedef enum {
+    ST_TOKENIZE,    // TOK_tokenize_input
+    ST_PARSE,       // Parse, including glob and brace expansion
+    ST_COMPILE,     // PRG_compile
+    ST_PIPE,        // creating one pipe
+    ST_FORK,        // one fork, as seen by the parent
+    ST_EXEC,        // from fork to the child calling exec
+    ST_WAIT,        // from the last stage started to every stage reaped
+    ST_COMMAND,     // from readline returning to the next prompt
+    ST_NPHASES
+} StatPhase;
+
+
+/*
+ * The monotonic clock, for timing phases
+ *
+ * Returns:
+ *  uint64_t    Nanoseconds since an arbitrary start
+ */
+uint64_t ST_now();
+
+
+/*
+ * Record one duration of a phase. Takes constant time, well under a
+ * microsecond.
+ *
+ * Parameters:
+ *  phase       The phase
+ *  ns          Its duration, in nanoseconds
+ */
+void ST_record(StatPhase phase, uint64_t ns);
+
+
+/*
+ * Record the time since start as one duration of a phase
+ *
+ * Parameters:
+ *  phase       The phase
+ *  start       When the phase started, from ST_now
+ */
+void ST_since(StatPhase phase, uint64_t start);
+
+
+/*
+ * The number of durations recorded for a phase
+ */
+uint64_t ST_count(StatPhase phase);
+
+
+/*
+ * A percentile of the durations recorded for a phase, to within the
+ * histogram's precision of 1/64 of the value
+ *
+ * Parameters:
+ *  phase       The phase
+ *  q           The percentile, in [0, 100]
+ *
+ * Returns:
+ *  uint64_t    The duration in nanoseconds, 0 if none were recorded
+ */
+uint64_t ST_percentile(StatPhase phase, double q);
+
+
+/*
+ * Slots in memory shared with child processes, one per stage of the
+ * pipeline being run, in which a child stores ST_now() just before it
+ * calls exec
+ *
+ * Returns:
+ *  uint64_t*   ST_MAX_STAGES slots, or NULL if shared memory is not
+ *              available
+ */
+uint64_t* ST_exec_slots();
+
+
+/*
+ * Forget every recorded duration
+ */
+void ST_reset();
+
+
+/*
+ * Print the count, p50, p99, p99.9 and maximum of each phase
+ *
+ * Parameters:
+ *  out         The stream to print to
+ */
+void ST_print(FILE* out);
+
+#endif /* _STATS_H_ */
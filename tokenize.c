@@ -17,6 +17,7 @@
 #include "clist.h"
 #include "tokenize.h"
 #include "token.h"
+#include "memstats.h"
 
 // Documented in .h file
 const char* TT_to_str(TokenType tt)
@@ -55,11 +56,42 @@ static bool isescape(char ch)
 }
 
 
+/*
+ * Tokens waiting to be appended to the list together with CL_extend
+ */
+struct _tokbuf {
+    CList tokens;
+    int n;
+    Token batch[CLIST_BATCH];
+};
+
+
+/*
+ * Move the buffered tokens onto the list
+ */
+static void tokbuf_flush(struct _tokbuf* buf)
+{
+    CL_extend(buf->tokens, buf->batch, buf->n);
+    buf->n = 0;
+}
+
+
+/*
+ * Buffer a token, flushing the buffer when it is full
+ */
+static void tokbuf_add(struct _tokbuf* buf, Token token)
+{
+    buf->batch[buf->n++] = token;
+    if (buf->n == CLIST_BATCH) tokbuf_flush(buf);
+}
+
+
 // Documented in .h file
 CList TOK_tokenize_input(const char* input, char* errmsg, size_t errmsg_sz)
 {
     *errmsg = 0;
     CList tokens = CL_new();
+    struct _tokbuf buf = {tokens, 0};
     const char* start = NULL;
     size_t len;
 
@@ -69,13 +101,14 @@ CList TOK_tokenize_input(const char* input, char* errmsg, size_t errmsg_sz)
             // end of WORD: unescaped double quote
             if (start) {
                 len = input - start;
-                CL_append(tokens, TOK_nnew(TOK_WORD, start, len));
+                tokbuf_add(&buf, TOK_nnew(TOK_WORD, start, len));
             }
             start = ++input;
             while (*input && *input != '"') {
                 if ((ch = *input++) == '\\' && !isescape(*input)) {
                     snprintf(errmsg, errmsg_sz,
                         "Illegal escape character %c", *input);
+                    tokbuf_flush(&buf);
                     CL_free(tokens);
                     return NULL;
                 }
@@ -83,11 +116,12 @@ CList TOK_tokenize_input(const char* input, char* errmsg, size_t errmsg_sz)
 
             if (!*input) {
                 snprintf(errmsg, errmsg_sz, "Unterminated quote");
+                tokbuf_flush(&buf);
                 CL_free(tokens);
                 return NULL;
             }
             len = input - start;
-            CL_append(tokens, TOK_nnew(TOK_QUOTED_WORD, start, len));
+            tokbuf_add(&buf, TOK_nnew(TOK_QUOTED_WORD, start, len));
             start = NULL;
 
         } else if (ch == '<' || ch == '>' || ch == '|' || isspace(ch)) {
@@ -95,11 +129,11 @@ CList TOK_tokenize_input(const char* input, char* errmsg, size_t errmsg_sz)
 
             if (start) {
                 len = input - start;
-                CL_append(tokens, TOK_nnew(TOK_WORD, start, len));
+                tokbuf_add(&buf, TOK_nnew(TOK_WORD, start, len));
             }
-            if (ch == '<') CL_append(tokens, (Token){TOK_LESSTHAN});
-            if (ch == '>') CL_append(tokens, (Token){TOK_GREATERTHAN});
-            if (ch == '|') CL_append(tokens, (Token){TOK_PIPE});
+            if (ch == '<') tokbuf_add(&buf, (Token){TOK_LESSTHAN});
+            if (ch == '>') tokbuf_add(&buf, (Token){TOK_GREATERTHAN});
+            if (ch == '|') tokbuf_add(&buf, (Token){TOK_PIPE});
 
             start = NULL;
 
@@ -108,6 +142,7 @@ CList TOK_tokenize_input(const char* input, char* errmsg, size_t errmsg_sz)
             if (ch == '\\' && !isescape(*++input)) {
                 snprintf(errmsg, errmsg_sz,
                     "Illegal escape character %c", *input);
+                tokbuf_flush(&buf);
                 CL_free(tokens);
                 return NULL;
             }
@@ -118,11 +153,12 @@ CList TOK_tokenize_input(const char* input, char* errmsg, size_t errmsg_sz)
         if (!*input && start) {
             // end of WORD: end of the input line
             len = input - start + 1;
-            CL_append(tokens, TOK_nnew(TOK_WORD, start, len));
+            tokbuf_add(&buf, TOK_nnew(TOK_WORD, start, len));
             start = NULL;
         }
     }
 
+    tokbuf_flush(&buf);
     return tokens;
 }
 
@@ -168,7 +204,7 @@ Token TOK_nnew(TokenType tt, const char* value, size_t len)
     if (tt == TOK_WORD || tt == TOK_QUOTED_WORD) {
         assert(value);
         if (!len) len = strlen(value);
-        token.value = strndup(value, len);
+        token.value = MEM_strndup(value, len);
     }
     return token;
 }
@@ -0,0 +1,184 @@
+/*
+ * trace.c
+ *
+ * Chrome trace event export
+ *
+ * Every event is one JSON object, formatted by the shell thread and
+ * pushed to a ring that a writer thread drains to the file, so tracing
+ * never waits on the disk. All events belong to the shell's process;
+ * the shell's own phases are on its thread and each pipeline stage is
+ * on a thread named after its pid. Times are in microseconds of the
+ * monotonic clock, as Chrome expects.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "trace.h"
+#include "ring.h"
+#include "stats.h"
+
+#define TR_RING_BYTES   (1 << 20)
+#define TR_EVENT_MAX    1024
+#define TR_NAME_MAX     256
+
+static Ring ring = NULL;
+static RingWriter writer = NULL;
+static int trace_fd = -1;
+static bool first = true;       // no event written yet, so no comma
+static int shell_pid;
+
+
+
+/*
+ * Format one event and queue it for the writer
+ */
+static void emit(const char* fmt, ...)
+{
+    char event[TR_EVENT_MAX];
+    int len = first? 0: snprintf(event, sizeof(event), ",\n");
+
+    va_list ap;
+    va_start(ap, fmt);
+    len += vsnprintf(event + len, sizeof(event) - len, fmt, ap);
+    va_end(ap);
+
+    // a truncated event would break the JSON
+    if ((size_t) len >= sizeof(event)) return;
+    if (RING_push(ring, event, len)) first = false;
+}
+
+
+/*
+ * Copy a string into buf as the inside of a JSON string, truncating it
+ * if need be
+ */
+static const char* json_escape(char* buf, size_t buf_sz, const char* s)
+{
+    size_t n = 0;
+    for (; *s && n + 7 < buf_sz; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            buf[n++] = '\\';
+            buf[n++] = c;
+        }
+        else if (c < 0x20) n += snprintf(buf + n, buf_sz - n, "\\u%04x", c);
+        else buf[n++] = c;
+    }
+    buf[n] = 0;
+    return buf;
+}
+
+
+// Prints a time in nanoseconds, passed through TS_ARG, as microseconds
+#define TS_FMT          "%lu.%03u"
+#define TS_ARG(ns)      (unsigned long) ((ns) / 1000), (unsigned) ((ns) % 1000)
+
+
+// Documented in .h file
+bool TR_start(const char* path)
+{
+    TR_stop();
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) return false;
+    if (write(fd, "[\n", 2) != 2) {
+        close(fd);
+        return false;
+    }
+
+    ring = RING_new(TR_RING_BYTES);
+    writer = RING_writer_start(ring, fd);
+    if (!writer) {
+        RING_free(ring);
+        ring = NULL;
+        close(fd);
+        return false;
+    }
+    trace_fd = fd;
+    first = true;
+    shell_pid = getpid();
+
+    emit("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+        "\"args\":{\"name\":\"plaidsh\"}}", shell_pid);
+    emit("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+        "\"args\":{\"name\":\"shell\"}}", shell_pid, shell_pid);
+    return true;
+}
+
+
+// Documented in .h file
+void TR_stop()
+{
+    if (!ring) return;
+
+    RING_writer_stop(writer);
+    if (write(trace_fd, "\n]\n", 3) != 3) perror("trace");
+    close(trace_fd);
+    if (RING_dropped(ring))
+        fprintf(stderr, "trace: %lu events dropped\n",
+            (unsigned long) RING_dropped(ring));
+
+    RING_free(ring);
+    ring = NULL;
+    writer = NULL;
+    trace_fd = -1;
+}
+
+
+// Documented in .h file
+bool TR_enabled()
+{   return ring != NULL; }
+
+
+// Documented in .h file
+void TR_since(const char* name, uint64_t start)
+{
+    if (!ring) return;
+
+    uint64_t end = ST_now();
+    emit("{\"name\":\"%s\",\"cat\":\"shell\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+        "\"ts\":" TS_FMT ",\"dur\":" TS_FMT "}",
+        name, shell_pid, shell_pid, TS_ARG(start), TS_ARG(end - start));
+}
+
+
+// Documented in .h file
+void TR_stage(const char* name, int pid, uint64_t forked, uint64_t execed,
+        uint64_t exited, const struct rusage* usage)
+{
+    if (!ring) return;
+
+    char escaped[TR_NAME_MAX];
+    json_escape(escaped, sizeof(escaped), name);
+
+    emit("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+        "\"args\":{\"name\":\"%s [%d]\"}}", shell_pid, pid, escaped, pid);
+    emit("{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+        "\"ts\":" TS_FMT ",\"dur\":" TS_FMT ",\"args\":{\"pid\":%d}}",
+        escaped, shell_pid, pid, TS_ARG(forked), TS_ARG(exited - forked), pid);
+    if (execed >= forked && execed <= exited)
+        emit("{\"name\":\"fork to exec\",\"cat\":\"stage\",\"ph\":\"X\","
+            "\"pid\":%d,\"tid\":%d,\"ts\":" TS_FMT ",\"dur\":" TS_FMT "}",
+            shell_pid, pid, TS_ARG(forked), TS_ARG(execed - forked));
+
+    emit("{\"name\":\"rusage %s [%d]\",\"cat\":\"stage\",\"ph\":\"C\","
+        "\"pid\":%d,\"ts\":" TS_FMT ",\"args\":{"
+        "\"utime_us\":%ld,\"stime_us\":%ld,\"maxrss_kb\":%ld,"
+        "\"minflt\":%ld,\"majflt\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld}}",
+        escaped, pid, shell_pid, TS_ARG(exited),
+        usage->ru_utime.tv_sec * 1000000 + usage->ru_utime.tv_usec,
+        usage->ru_stime.tv_sec * 1000000 + usage->ru_stime.tv_usec,
+        usage->ru_maxrss, usage->ru_minflt, usage->ru_majflt,
+        usage->ru_nvcsw, usage->ru_nivcsw);
+}
@@ -0,0 +1,75 @@
+/*
+ * trace.h
+ *
+ * Chrome trace event export of the shell's timeline: the phases of each
+ * command and a span per pipeline stage, in the JSON array format that
+ * Perfetto and chrome://tracing load. Started by the PSH_TRACE
+ * environment variable or the trace builtin.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+
+/*
+ * Start writing a trace. Events are formatted by the shell and written
+ * to the file by a separate thread; a trace already being written is
+ * stopped first.
+ *
+ * Parameters:
+ *  path        The file to write, truncated if it exists
+ *
+ * Returns:
+ *  bool        false if the file could not be opened
+ */
+bool TR_start(const char* path);
+
+
+/*
+ * Finish the trace being written, if any, and close its file
+ */
+void TR_stop();
+
+
+/*
+ * Whether a trace is being written
+ */
+bool TR_enabled();
+
+
+/*
+ * Add a span of the shell itself, from start to now. Does nothing when
+ * no trace is being written.
+ *
+ * Parameters:
+ *  name        The phase, such as "parse"
+ *  start       When it started, from ST_now
+ */
+void TR_since(const char* name, uint64_t start);
+
+
+/*
+ * Add one pipeline stage: its process on a track of its own, a span
+ * from fork to exit with the startup up to exec marked inside it, and
+ * its resource usage as counters at exit. Does nothing when no trace is
+ * being written.
+ *
+ * Parameters:
+ *  name        The command
+ *  pid         Its process ID
+ *  forked      When it was forked, from ST_now
+ *  execed      When it called exec, or 0 if unknown
+ *  exited      When it was reaped
+ *  usage       Its resource usage, from wait4
+ */
+void TR_stage(const char* name, int pid, uint64_t forked, uint64_t execed,
+        uint64_t exited, const struct rusage* usage);
+
+#endif /* _TRACE_H_ */
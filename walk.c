@@ -0,0 +1,468 @@
+/*
+ * walk.c
+ *
+ * Parallel, work-stealing directory walker used to expand recursive
+ * "**" (globstar) patterns
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "walk.h"
+
+// The set of pattern positions reachable at a directory is kept as a
+// bitmask, which bounds the number of pattern components after the
+// literal prefix
+#define WALK_MAX_SEGMENTS   63
+#define WALK_MAX_THREADS    64
+#define WALK_DEQUE_INIT     64
+
+
+// A directory still to be read
+struct _walk_task {
+    char* relpath;      // path relative to the walk root, "" for the root
+    uint64_t states;    // pattern positions reachable at this directory
+};
+
+// Tasks live in [top, bottom), indices taken modulo cap. The owner pushes
+// and pops at the bottom (depth first); thieves take from the top, which
+// holds the shallowest and therefore largest pending subtrees.
+struct _walk_deque {
+    pthread_mutex_t lock;
+    struct _walk_task* tasks;
+    size_t cap;
+    size_t top;
+    size_t bottom;
+};
+
+struct _walk_worker {
+    struct _walk_deque deque;
+    struct _walk* walk;
+    int id;
+    char** paths;       // matches found by this worker
+    size_t npaths;
+    size_t cap;
+};
+
+struct _walk {
+    int rootfd;
+    char* prefix;       // prepended to every match: "", "/" or "root/"
+    char** segs;        // pattern components below the root
+    bool* globstar;     // whether segs[i] is "**"
+    int nsegs;
+    int nworkers;
+    struct _walk_worker* workers;
+    atomic_size_t pending;  // tasks pushed but not yet fully processed
+};
+
+
+
+/*
+ * Checks whether segment [s, s+len) has an unescaped glob metacharacter
+ *
+ * Parameters:
+ *  s, len      The segment
+ *
+ * Returns:
+ *  bool        true if the segment needs matching, false if it is literal
+ */
+static bool has_magic(const char* s, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '\\') i++;
+        else if (s[i] == '*' || s[i] == '?' || s[i] == '[') return true;
+    }
+    return false;
+}
+
+
+/*
+ * Find the end of the path component starting at s
+ *
+ * Parameters:
+ *  s           The start of the component
+ *
+ * Returns:
+ *  const char* The '/' ending the component, or the terminating \0
+ */
+static const char* segment_end(const char* s)
+{
+    while (*s && *s != '/') s++;
+    return s;
+}
+
+
+/*
+ * qsort comparator for an array of paths
+ */
+static int path_cmp(const void* a, const void* b)
+{   return strcmp(*(char* const*) a, *(char* const*) b); }
+
+
+/*
+ * Append segment [s, s+len) to buf with backslash escapes removed
+ *
+ * Parameters:
+ *  buf         The buffer, large enough to hold the result
+ *  s, len      The segment
+ */
+static void unescape_cat(char* buf, const char* s, size_t len)
+{
+    buf += strlen(buf);
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '\\' && i+1 < len) i++;
+        *buf++ = s[i];
+    }
+    *buf = 0;
+}
+
+
+// Documented in .h file
+bool WALK_is_globstar(const char* pattern)
+{
+    for (const char* s = pattern; *s; ) {
+        const char* end = segment_end(s);
+        if (end - s == 2 && s[0] == '*' && s[1] == '*') return true;
+        s = *end? end + 1: end;
+    }
+    return false;
+}
+
+
+/*
+ * Add the positions reachable by letting a "**" match zero directories
+ */
+static uint64_t walk_closure(struct _walk* w, uint64_t states)
+{
+    for (int i = 0; i < w->nsegs; i++)
+        if ((states >> i & 1) && w->globstar[i])
+            states |= 1ull << (i+1);
+    return states;
+}
+
+
+/*
+ * Advance a set of pattern positions over one path component
+ *
+ * Parameters:
+ *  w           The walk
+ *  states      The positions reachable at the parent directory
+ *  name        The directory entry name
+ *
+ * Returns:
+ *  uint64_t    The positions reachable at the entry, 0 if none
+ */
+static uint64_t walk_step(struct _walk* w, uint64_t states, const char* name)
+{
+    uint64_t next = 0;
+    for (int i = 0; i < w->nsegs; i++) {
+        if (!(states >> i & 1)) continue;
+        if (w->globstar[i]) {
+            if (name[0] != '.') next |= 1ull << i;
+        }
+        else if (!fnmatch(w->segs[i], name, FNM_PERIOD))
+            next |= 1ull << (i+1);
+    }
+    return walk_closure(w, next);
+}
+
+
+static void deque_push(struct _walk_deque* dq, struct _walk_task task)
+{
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom - dq->top == dq->cap) {
+        size_t cap = dq->cap? 2 * dq->cap: WALK_DEQUE_INIT;
+        struct _walk_task* tasks = malloc(cap * sizeof(struct _walk_task));
+        assert(tasks);
+        for (size_t i = dq->top; i < dq->bottom; i++)
+            tasks[i - dq->top] = dq->tasks[i % dq->cap];
+        free(dq->tasks);
+        dq->tasks = tasks;
+        dq->bottom -= dq->top;
+        dq->top = 0;
+        dq->cap = cap;
+    }
+    dq->tasks[dq->bottom++ % dq->cap] = task;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+
+static bool deque_pop(struct _walk_deque* dq, struct _walk_task* task)
+{
+    bool ok = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom != dq->top) {
+        *task = dq->tasks[--dq->bottom % dq->cap];
+        ok = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+
+static bool deque_steal(struct _walk_deque* dq, struct _walk_task* task)
+{
+    bool ok = false;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom != dq->top) {
+        *task = dq->tasks[dq->top++ % dq->cap];
+        ok = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+
+/*
+ * Record a match, found at relpath below the walk root
+ */
+static void walk_emit(struct _walk_worker* self, const char* relpath)
+{
+    if (self->npaths == self->cap) {
+        self->cap = self->cap? 2 * self->cap: 64;
+        self->paths = realloc(self->paths, self->cap * sizeof(char*));
+        assert(self->paths);
+    }
+
+    const char* prefix = self->walk->prefix;
+    char* path = malloc(strlen(prefix) + strlen(relpath) + 1);
+    assert(path);
+    strcpy(path, prefix);
+    strcat(path, relpath);
+    self->paths[self->npaths++] = path;
+}
+
+
+/*
+ * Read one directory: record the entries that complete the pattern and
+ * queue the subdirectories that can still lead to a match
+ */
+static void walk_dir(struct _walk_worker* self, struct _walk_task* task)
+{
+    struct _walk* w = self->walk;
+    uint64_t nonfinal = (1ull << w->nsegs) - 1;
+    const char* dirpath = *task->relpath? task->relpath: ".";
+
+    int fd = openat(w->rootfd, dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return;
+    DIR* dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return;
+    }
+
+    size_t dirlen = strlen(task->relpath);
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        const char* name = ent->d_name;
+        if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+            continue;
+
+        uint64_t next = walk_step(w, task->states, name);
+        if (!next) continue;
+
+        char* relpath = malloc(dirlen + strlen(name) + 2);
+        assert(relpath);
+        strcpy(relpath, task->relpath);
+        if (dirlen) strcat(relpath, "/");
+        strcat(relpath, name);
+
+        if (next >> w->nsegs & 1) walk_emit(self, relpath);
+
+        bool isdir = ent->d_type == DT_DIR;
+        if (ent->d_type == DT_UNKNOWN) {
+            struct stat st;
+            if (!fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW))
+                isdir = S_ISDIR(st.st_mode);
+        }
+
+        if (isdir && (next & nonfinal)) {
+            atomic_fetch_add(&w->pending, 1);
+            deque_push(&self->deque, (struct _walk_task) {relpath, next});
+        }
+        else free(relpath);
+    }
+    closedir(dir);
+}
+
+
+static void* walk_worker(void* arg)
+{
+    struct _walk_worker* self = (struct _walk_worker*) arg;
+    struct _walk* w = self->walk;
+    struct _walk_task task;
+
+    for (;;) {
+        bool found = deque_pop(&self->deque, &task);
+        for (int i = 1; !found && i < w->nworkers; i++) {
+            int victim = (self->id + i) % w->nworkers;
+            found = deque_steal(&w->workers[victim].deque, &task);
+        }
+
+        if (found) {
+            walk_dir(self, &task);
+            free(task.relpath);
+            atomic_fetch_sub(&w->pending, 1);
+        }
+        else if (atomic_load(&w->pending) == 0) break;
+        else sched_yield();
+    }
+    return NULL;
+}
+
+
+/*
+ * Split a pattern into its literal root and the components to match
+ *
+ * Parameters:
+ *  w           The walk to set up; rootfd, prefix and segs are filled in
+ *  pattern     The pattern, with any leading ~ already expanded
+ *
+ * Returns:
+ *  bool        true on success, false if the root cannot be opened or
+ *              the pattern has too many components
+ */
+static bool walk_setup(struct _walk* w, const char* pattern)
+{
+    size_t patlen = strlen(pattern);
+    char* root = calloc(patlen + 2, 1);
+    assert(root);
+    w->segs = calloc(patlen + 1, sizeof(char*));
+    w->globstar = calloc(patlen + 1, sizeof(bool));
+    assert(w->segs && w->globstar);
+
+    if (*pattern == '/') strcpy(root, "/");
+
+    bool literal = true;
+    for (const char* s = pattern; *s; ) {
+        const char* end = segment_end(s);
+        size_t len = end - s;
+        if (literal && len && has_magic(s, len)) literal = false;
+
+        if (!len) ;
+        else if (literal) {
+            if (*root && strcmp(root, "/")) strcat(root, "/");
+            unescape_cat(root, s, len);
+        }
+        else {
+            w->globstar[w->nsegs] = len == 2 && s[0] == '*' && s[1] == '*';
+            w->segs[w->nsegs++] = strndup(s, len);
+        }
+        s = *end? end + 1: end;
+    }
+
+    w->rootfd = open(*root? root: ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    w->prefix = malloc(strlen(root) + 2);
+    assert(w->prefix);
+    strcpy(w->prefix, root);
+    if (*root && strcmp(root, "/")) strcat(w->prefix, "/");
+    free(root);
+
+    return w->rootfd != -1 && w->nsegs > 0 && w->nsegs <= WALK_MAX_SEGMENTS;
+}
+
+
+// Documented in .h file
+char** WALK_glob(const char* pattern, int flags, int nthreads, size_t* countp)
+{
+    struct _walk w = {.rootfd = -1};
+    char* expanded = NULL;
+    *countp = 0;
+
+    // ~ and ~/... refer to $HOME, as with GLOB_TILDE
+    const char* home = getenv("HOME");
+    if (pattern[0] == '~' && (!pattern[1] || pattern[1] == '/') && home) {
+        expanded = malloc(strlen(home) + strlen(pattern));
+        assert(expanded);
+        strcpy(expanded, home);
+        strcat(expanded, pattern + 1);
+        pattern = expanded;
+    }
+
+    if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0) nthreads = 1;
+    if (nthreads > WALK_MAX_THREADS) nthreads = WALK_MAX_THREADS;
+
+    w.workers = calloc(nthreads, sizeof(struct _walk_worker));
+    assert(w.workers);
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&w.workers[i].deque.lock, NULL);
+        w.workers[i].walk = &w;
+        w.workers[i].id = i;
+    }
+    w.nworkers = nthreads;
+
+    if (walk_setup(&w, pattern)) {
+        struct _walk_task root = {strdup(""), walk_closure(&w, 1)};
+        atomic_store(&w.pending, 1);
+        deque_push(&w.workers[0].deque, root);
+
+        // the calling thread doubles as worker 0. nworkers stays as set
+        // above while the threads run: a worker that could not be started
+        // never pushes, so its deque is only ever found empty
+        pthread_t tids[nthreads];
+        int started = 1;
+        for (; started < nthreads; started++)
+            if (pthread_create(&tids[started], NULL, walk_worker,
+                    &w.workers[started]))
+                break;
+        walk_worker(&w.workers[0]);
+        for (int i = 1; i < started; i++)
+            pthread_join(tids[i], NULL);
+    }
+
+    // gather the per-worker results
+    size_t count = 0;
+    for (int i = 0; i < nthreads; i++)
+        count += w.workers[i].npaths;
+
+    char** paths = malloc((count + 1) * sizeof(char*));
+    assert(paths);
+    for (int i = 0; i < nthreads; i++) {
+        struct _walk_worker* worker = &w.workers[i];
+        memcpy(paths + *countp, worker->paths, worker->npaths * sizeof(char*));
+        *countp += worker->npaths;
+        free(worker->paths);
+        free(worker->deque.tasks);
+        pthread_mutex_destroy(&worker->deque.lock);
+    }
+    paths[count] = NULL;
+
+    if (flags & WALK_SORT) qsort(paths, count, sizeof(char*), path_cmp);
+
+    if (w.rootfd != -1) close(w.rootfd);
+    for (int i = 0; i < w.nsegs; i++)
+        free(w.segs[i]);
+    free(w.segs);
+    free(w.globstar);
+    free(w.prefix);
+    free(w.workers);
+    free(expanded);
+
+    return paths;
+}
+
+
+// Documented in .h file
+void WALK_free(char** paths)
+{
+    if (!paths) return;
+    for (char** p = paths; *p; p++)
+        free(*p);
+    free(paths);
+}
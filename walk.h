@@ -0,0 +1,69 @@
+/*
+ * walk.h
+ *
+ * Parallel directory walker used to expand recursive "**" (globstar)
+ * patterns
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _WALK_H_
+#define _WALK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Flags for WALK_glob
+#define WALK_SORT   0x1     // return the matched paths in strcmp order
+
+
+/*
+ * Checks whether a pattern contains a "**" path component, i.e. whether
+ * it needs a recursive walk rather than a plain glob(3)
+ *
+ * Parameters:
+ *  pattern     The pattern to check, as taken from a WORD token
+ *
+ * Returns:
+ *  bool        true if the pattern has a "**" component, false otherwise
+ */
+bool WALK_is_globstar(const char* pattern);
+
+
+/*
+ * Expand a globstar pattern by walking the directory tree below the
+ * pattern's literal prefix. A "**" component matches zero or more
+ * directories; every other component is matched with fnmatch(3). As in
+ * other shells, "**" does not descend into hidden directories, and
+ * symbolic links to directories are not followed.
+ *
+ * The walk is spread over nthreads workers, each owning a deque of
+ * directories still to be read; idle workers steal from the others.
+ * Directories are opened with openat(2) relative to the walk root and
+ * entries are classified by d_type, so a stat is only needed on file
+ * systems that do not report it.
+ *
+ * Parameters:
+ *  pattern     The pattern to expand
+ *  flags       Bitwise or of WALK_* flags
+ *  nthreads    The number of workers, or 0 to use one per online CPU
+ *  countp      Return space for the number of matched paths
+ *
+ * Returns:
+ *  char**      A malloc'd, NULL terminated array of malloc'd paths, which
+ *              must be released with WALK_free. Without WALK_SORT the
+ *              order of the paths is unspecified.
+ */
+char** WALK_glob(const char* pattern, int flags, int nthreads, size_t* countp);
+
+
+/*
+ * Release the array returned by WALK_glob
+ *
+ * Parameters:
+ *  paths       The array to free, may be NULL
+ */
+void WALK_free(char** paths);
+
+#endif /* _WALK_H_ */
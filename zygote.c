@@ -0,0 +1,274 @@
+/*
+ * zygote.c
+ *
+ * Pre-forked worker pool
+ *
+ * The shell and its workers talk over a stream socketpair per worker:
+ * a header carrying the fds as SCM_RIGHTS, then the message. A worker
+ * that reads EOF instead, because the shell closed its end or exited,
+ * exits. The pool belongs to the process that filled it; a child of the
+ * shell, such as a parallel job, inherits the shell's ends of the
+ * sockets but not the workers, so it drops the pool on first use.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#define _GNU_SOURCE     // close_range
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "zygote.h"
+
+#define ZY_SOCK_FD      3
+
+struct _worker {
+    pid_t pid;
+    int sock;               // the shell's end
+};
+
+struct _header {
+    uint32_t len;
+    uint32_t nfds;
+};
+
+static struct _worker pool[ZY_MAX_SIZE];
+static int nready = 0;
+static int size = 0;
+static ZygoteMain handler = NULL;
+static pid_t owner = 0;     // the process the workers are children of
+
+
+
+/*
+ * Forget a pool inherited from the parent, whose workers are not ours
+ */
+static void check_owner()
+{
+    if (!size || owner == getpid()) return;
+    for (int i = 0; i < nready; i++)
+        close(pool[i].sock);
+    nready = size = 0;
+}
+
+
+/*
+ * Read exactly len bytes, or fail at EOF
+ */
+static bool read_all(int fd, void* buf, size_t len)
+{
+    for (size_t got = 0; got < len; ) {
+        ssize_t n = read(fd, (char*) buf + got, len - got);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+
+/*
+ * Body of a worker: wait for a message, then run the handler on it.
+ * Does not return.
+ */
+static void worker_main(int sock)
+{
+    // nothing of the shell's stays open, not even its stdio
+    int devnull = open("/dev/null", O_RDWR);
+    for (int fd = 0; fd < 3; fd++)
+        if (devnull != fd) dup2(devnull, fd);
+    if (sock != ZY_SOCK_FD) {
+        dup3(sock, ZY_SOCK_FD, O_CLOEXEC);
+        sock = ZY_SOCK_FD;
+    }
+    close_range(ZY_SOCK_FD + 1, ~0U, 0);
+
+    struct sigaction dfl = {.sa_handler = SIG_DFL};
+    for (int sig = 1; sig < NSIG; sig++)
+        sigaction(sig, &dfl, NULL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    struct _header hdr;
+    union {
+        char buf[CMSG_SPACE(ZY_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {&hdr, sizeof(hdr)};
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+    ssize_t n;
+    while ((n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+    if (n <= 0) _exit(0);
+
+    int fds[ZY_MAX_FDS];
+    int nfds = 0;
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+    if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+        nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cm), nfds * sizeof(int));
+    }
+
+    char* msg = malloc(hdr.len + 1);
+    if (!msg || !read_all(sock, (char*) &hdr + n, sizeof(hdr) - n) ||
+        !read_all(sock, msg, hdr.len))
+        _exit(EXIT_FAILURE);
+    msg[hdr.len] = 0;
+    close(sock);
+
+    handler(msg, hdr.len, fds, nfds);
+    _exit(EXIT_FAILURE);
+}
+
+
+/*
+ * Fork one worker into the pool
+ *
+ * Returns:
+ *  bool        false if it could not be started
+ */
+static bool fork_worker()
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) return false;
+
+    // buffered output would otherwise be written again by the worker
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) worker_main(sv[1]);
+    close(sv[1]);
+    if (pid == -1) {
+        close(sv[0]);
+        return false;
+    }
+    pool[nready++] = (struct _worker) {pid, sv[0]};
+    return true;
+}
+
+
+/*
+ * Make a worker exit and reap it
+ */
+static void retire(struct _worker* w)
+{
+    close(w->sock);
+    while (waitpid(w->pid, NULL, 0) == -1 && errno == EINTR);
+}
+
+
+// Documented in .h file
+void ZY_start(int n, ZygoteMain fn)
+{
+    check_owner();
+    if (n < 0) n = 0;
+    if (n > ZY_MAX_SIZE) n = ZY_MAX_SIZE;
+    if (fn != handler) ZY_flush();
+    handler = fn;
+    size = n;
+    owner = getpid();
+    while (nready > size)
+        retire(&pool[--nready]);
+    ZY_refill();
+}
+
+
+// Documented in .h file
+void ZY_stop()
+{   ZY_start(0, handler); }
+
+
+// Documented in .h file
+int ZY_size()
+{
+    check_owner();
+    return size;
+}
+
+
+// Documented in .h file
+int ZY_ready()
+{
+    check_owner();
+    return nready;
+}
+
+
+// Documented in .h file
+void ZY_refill()
+{
+    check_owner();
+    while (nready < size && fork_worker());
+}
+
+
+// Documented in .h file
+void ZY_flush()
+{
+    check_owner();
+    while (nready)
+        retire(&pool[--nready]);
+}
+
+
+// Documented in .h file
+pid_t ZY_spawn(const void* msg, size_t len, const int* fds, int nfds)
+{
+    check_owner();
+    if (nfds > ZY_MAX_FDS || len > UINT32_MAX) return -1;
+
+    struct _header hdr = {len, nfds};
+    union {
+        char buf[CMSG_SPACE(ZY_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov[2] = {{&hdr, sizeof(hdr)}, {(void*) msg, len}};
+    struct msghdr mh = {.msg_iov = iov, .msg_iovlen = 2};
+    if (nfds) {
+        mh.msg_control = control.buf;
+        mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+    }
+
+    while (nready) {
+        struct _worker w = pool[--nready];
+        ssize_t n;
+        while ((n = sendmsg(w.sock, &mh, MSG_NOSIGNAL)) == -1 && errno == EINTR);
+
+        // a long message goes on in plain writes, once the fds are across
+        size_t sent = n > 0? n: 0;
+        while (n > 0 && sent < sizeof(hdr) + len) {
+            if (sent < sizeof(hdr))
+                n = send(w.sock, (char*) &hdr + sent, sizeof(hdr) - sent,
+                    MSG_NOSIGNAL);
+            else n = send(w.sock, (const char*) msg + sent - sizeof(hdr),
+                len - (sent - sizeof(hdr)), MSG_NOSIGNAL);
+            if (n > 0) sent += n;
+            else if (n == -1 && errno == EINTR) n = 1;
+        }
+        if (sent == sizeof(hdr) + len) {
+            close(w.sock);
+            return w.pid;
+        }
+
+        // the worker is gone or was cut off mid-message
+        kill(w.pid, SIGKILL);
+        retire(&w);
+    }
+    return -1;
+}
@@ -0,0 +1,104 @@
+/*
+ * zygote.h
+ *
+ * A pool of pre-forked workers, so that a stage can be handed to a
+ * process that already exists instead of paying for a fork while the
+ * pipeline starts. Each worker is a child of the shell, forked with
+ * nothing open but its end of a socket, default signal dispositions and
+ * an empty signal mask. It sleeps until it is sent a message and a few
+ * fds, over SCM_RIGHTS, runs a handler on them, and is never reused:
+ * the handler execs, so the worker's pid becomes the stage's, to be
+ * reaped like any other child.
+ *
+ * Workers are forked from the shell as it was when the pool was last
+ * refilled, so state they rely on must either travel in the message or
+ * be flushed from the pool when it changes.
+ *
+ * Author:
+ *  Jean Baptiste Kwizera <jkwizera@andrew.cmu.edu>
+ */
+
+#ifndef _ZYGOTE_H_
+#define _ZYGOTE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define ZY_DEFAULT_SIZE     4
+#define ZY_MAX_SIZE         64
+#define ZY_MAX_FDS          8
+
+/*
+ * What a worker runs when handed a message. It should not return; if it
+ * does, the worker exits with a failure status.
+ *
+ * Parameters:
+ *  msg         The message, in memory the handler may keep
+ *  len         The length of msg
+ *  fds         The fds sent with it, all above 2
+ *  nfds        The number of fds
+ */
+typedef void (*ZygoteMain)(char* msg, size_t len, int* fds, int nfds);
+
+
+/*
+ * Start a pool, or resize the running one, and fill it
+ *
+ * Parameters:
+ *  size        The number of idle workers to keep, up to ZY_MAX_SIZE;
+ *              0 stops the pool
+ *  fn          The handler the workers run
+ */
+void ZY_start(int size, ZygoteMain fn);
+
+
+/*
+ * Stop the pool: its idle workers exit and are reaped
+ */
+void ZY_stop();
+
+
+/*
+ * The number of idle workers the pool keeps, 0 if it is stopped
+ */
+int ZY_size();
+
+
+/*
+ * The number of idle workers ready now
+ */
+int ZY_ready();
+
+
+/*
+ * Fork workers until the pool is full again
+ */
+void ZY_refill();
+
+
+/*
+ * Replace the idle workers, after a change to state they were forked
+ * with, such as the working directory. The new ones are forked by the
+ * next ZY_refill.
+ */
+void ZY_flush();
+
+
+/*
+ * Hand a message and fds to an idle worker. The fds are duplicated into
+ * the worker and stay open in the caller.
+ *
+ * Parameters:
+ *  msg         The message
+ *  len         The length of msg
+ *  fds         The fds to send
+ *  nfds        The number of fds, up to ZY_MAX_FDS
+ *
+ * Returns:
+ *  pid_t       The worker, now running the handler; or -1 if no worker
+ *              is ready or none took the message
+ */
+pid_t ZY_spawn(const void* msg, size_t len, const int* fds, int nfds);
+
+#endif /* _ZYGOTE_H_ */